@@ -57,11 +57,24 @@ struct irqHandler {
   uint64_t argument; // extra
 };
 
+#define ISR_IRQ_BASE    32 // Legacy PIC IRQs get remapped here.
+#define ISR_IRQ_COUNT   16
+#define ISR_LAPIC_TIMER    48 // Local APIC vectors, right after the PIC.
+#define ISR_IPI_RESCHED    49
+#define ISR_APIC_COUNT     2
+#define ISR_SYSCALL        128
+#define ISR_LAPIC_SPURIOUS 255
+
 void        initiateISR();
 irqHandler *registerIRQhandler(uint8_t id, void *handler);
+// Waits for interrupts still running the handler, don't call it from one.
+void        unregisterIRQhandler(irqHandler *node);
+// CPU exceptions (vectors 0 - 31). Without a handler they are fatal.
+void        registerExceptionHandler(uint8_t vector, FunctionPtr handler);
 
 extern void  asm_isr_exit();
 extern void *asm_isr_redirect_table[];
 extern void  isr128();
+extern void  isr255();
 
 #endif
\ No newline at end of file
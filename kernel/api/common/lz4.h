@@ -0,0 +1,13 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include "types.h"
+
+// LZ4 block format (no frame header), for inputs up to 64 KiB.
+
+// Returns the compressed size, or 0 when it doesn't fit in dst_capacity.
+size_t lz4_compress(const void *src, size_t src_len, void *dst, size_t dst_capacity);
+// Returns the decompressed size, or -1 when the input is malformed.
+int lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_capacity);
+
+#endif
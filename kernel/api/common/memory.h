@@ -8,15 +8,74 @@
 
 typedef uintptr_t physaddr_t;
 
+struct MemTag; // common/memtag.h
+
+// Higher half direct map (HHDM), every physical frame is reachable through it:
+extern uint64_t hhdm_offset;
+#define PHYS_TO_VIRT(addr) ((void *)((uintptr_t)(addr) + hhdm_offset))
+#define VIRT_TO_PHYS(addr) ((physaddr_t)((uintptr_t)(addr) - hhdm_offset))
+
+// Page table entry bits. Anonymous page slots use the same layout, so that
+// real page tables can later be handed to the same functions.
+#define PTE_PRESENT    (1ULL << 0)
+#define PTE_WRITABLE   (1ULL << 1)
+#define PTE_ACCESSED   (1ULL << 5)
+#define PTE_FRAME_MASK 0x000FFFFFFFFFF000ULL
+
 // Memory Syscalls:
 void *mmap(/*size_t requested_amount*/);
 void munmap(physaddr_t *freeable_ptr /* size_t regions*/);
 
+// Physical memory setup (from the Limine memory map):
+void init_pmm();
+void pfa_init(physaddr_t region_start, size_t page_count, void *bitmap_virt_addr);
+
 // __placeholder_allocator__: (Paging is only allocation way, for now...):
+// The frame gets charged to the caller's call site.
 physaddr_t alloc_page(void);
+// Charged to an explicit owner (NULL = the caller's call site):
+physaddr_t alloc_page_tagged(struct MemTag *tag);
+// Same as alloc_page_tagged(), but never tries to reclaim memory when we run out:
+physaddr_t alloc_page_noreclaim(struct MemTag *tag);
+// Physically contiguous run of pages, next fit (a bitmap search, recycle them):
+physaddr_t alloc_contiguous_pages(size_t count);
 // __placeholder_deallocator__: (^):
 void free_page(physaddr_t paddr);
 
+// Cache colouring:
+// Frames whose physical page numbers are equal modulo the colour count share
+// the same sets of the (physically indexed) last level cache. In colour mode
+// alloc_page() hands colours out round-robin, address spaces and objects can
+// keep their own cursor so their pages spread over the whole cache.
+typedef struct PageColourCursor
+{
+    uint32_t next;
+} colour_cursor_t;
+
+void pfa_init_colours(void); // Colour count from CPUID cache parameters.
+void pfa_set_colouring(bool enabled);
+uint32_t pfa_colour_count(void);
+uint32_t pfa_page_colour(physaddr_t paddr);
+physaddr_t alloc_page_colour(uint32_t colour, struct MemTag *tag); // Exactly this colour, or 0.
+physaddr_t alloc_page_coloured(colour_cursor_t *cursor, struct MemTag *tag);
+
+size_t pfa_frame_count(void);
+size_t pfa_free_count(void);
+size_t pfa_frame_index(physaddr_t paddr); // Returns pfa_frame_count() for foreign frames.
+physaddr_t pfa_frame_addr(size_t index);
+
+// Anonymous (swappable) pages:
+// The slot is owned by the caller and works like a page table entry: when the
+// page gets swapped out the slot holds a swap entry instead of a frame.
+// anon_fault() hands the frame back pinned: reclaim won't touch it until the
+// caller is done with it and calls anon_unpin().
+void anon_init(void);
+bool anon_map(physaddr_t *slot);
+physaddr_t anon_fault(physaddr_t *slot); // Swaps the page back in if needed. 0 = out of memory.
+void anon_unpin(physaddr_t *slot);
+void anon_unmap(physaddr_t *slot);       // Not while pinned.
+physaddr_t swap_reclaim_page(void);
+
 // Memory Utilities:
 
 void memset(void *_dst, int val, size_t len);
@@ -25,4 +84,4 @@ void *memmove(void *dstptr, const void *srcptr, size_t size);
 int memcmp(const void *aptr, const void *bptr, size_t size);
 
 
-#endif
\ No newline at end of file
+#endif
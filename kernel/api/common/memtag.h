@@ -0,0 +1,48 @@
+#ifndef MEMTAG_H
+#define MEMTAG_H
+
+#include "types.h"
+#include "memory.h"
+
+// Memory accounting:
+// Every frame (and every sub-page object, once allocators report them) is
+// charged to a tag. A tag is either a subsystem declared with DEFINE_MEMTAG()
+// or, for plain alloc_page()/mmap() calls, the call site itself.
+// Counters are per CPU and only get summed when somebody reads them.
+
+#define MEMTAG_MAX 128 // Tag ids, including call sites.
+
+typedef struct MemTag
+{
+    const char *name; // NULL for call site tags.
+    void *site;
+    uint16_t id;      // 0 until the first charge registers it.
+} memtag_t;
+
+#define DEFINE_MEMTAG(var, tag_name) memtag_t var = { .name = (tag_name), .site = NULL, .id = 0 }
+
+typedef struct MemTagUsage
+{
+    int64_t pages;
+    int64_t bytes; // Sub-page objects (slabs etc.)
+    int64_t objects;
+} memtag_usage_t;
+
+extern memtag_t memtag_anon;
+extern memtag_t memtag_zram;
+
+void memtag_init(void);
+
+memtag_t *memtag_callsite(void *site);
+
+// Frames remember their owner, so freeing doesn't need the tag:
+void memtag_charge_page(physaddr_t frame, memtag_t *tag);
+void memtag_uncharge_page(physaddr_t frame);
+
+void memtag_charge_object(memtag_t *tag, int64_t bytes);
+void memtag_uncharge_object(memtag_t *tag, int64_t bytes);
+
+void memtag_read(memtag_t *tag, memtag_usage_t *out);
+void memtag_dump(size_t top);
+
+#endif
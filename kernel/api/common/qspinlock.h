@@ -0,0 +1,85 @@
+#ifndef QSPINLOCK_H
+#define QSPINLOCK_H
+
+#include "spinlock.h"
+
+// Queued (MCS) spinlock for locks that are contended from many CPUs at
+// once. Uncontended it is one cmpxchg on a 32-bit word like any other
+// lock. Contenders queue up behind each other instead: each one spins on
+// a flag in its own per-CPU node until its predecessor hands the lock
+// on, so a release touches one waiter's cache line rather than bouncing
+// the lock's line through every waiting core. Only the head of the queue
+// watches the lock word itself.
+//
+// The word holds a locked byte and the tail of the queue, a (CPU,
+// nesting level) pair, 0 for an empty queue. The slow path runs with
+// interrupts off, so a CPU needs at most a couple of nodes.
+
+#define QSPIN_NODES 4 // Per CPU: process context, and nested ones in exceptions and NMIs.
+
+typedef struct QSpinlock
+{
+    union
+    {
+        uint32_t val;
+        struct
+        {
+            uint8_t locked;
+            uint8_t reserved;
+            uint16_t tail; // ((cpu + 1) << 2) | node index.
+        } b;
+    } word;
+    LOCK_STAT_FIELD
+} qspinlock_t;
+
+#define QSPINLOCK_INIT { .word = { 0 } LOCK_STAT_INIT }
+
+void qspin_lock_slowpath(qspinlock_t *lock);
+
+static inline void __qspin_lock_init(qspinlock_t *lock, const char *name) {
+    *lock = (qspinlock_t){ .word = { 0 } };
+    lock_stat_set_name(&lock->stat, name);
+}
+
+#define qspin_lock_init(lock) __qspin_lock_init((lock), LOCK_SITE(#lock))
+
+static inline bool qspin_is_locked(qspinlock_t *lock) {
+    return __atomic_load_n(&lock->word.b.locked, __ATOMIC_RELAXED) != 0;
+}
+
+static inline bool qspin_trylock(qspinlock_t *lock) {
+    uint32_t val = 0;
+    if (!__atomic_compare_exchange_n(&lock->word.val, &val, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return false;
+    lock_stat_acquired(&lock->stat, 0);
+    return true;
+}
+
+static inline void qspin_lock(qspinlock_t *lock) {
+    uint32_t val = 0;
+    if (__atomic_compare_exchange_n(&lock->word.val, &val, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        lock_stat_acquired(&lock->stat, 0);
+        return;
+    }
+    uint64_t wait_start = lock_stat_now();
+    qspin_lock_slowpath(lock);
+    lock_stat_acquired(&lock->stat, wait_start);
+}
+
+static inline void qspin_unlock(qspinlock_t *lock) {
+    lock_stat_released(&lock->stat);
+    __atomic_store_n(&lock->word.b.locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t qspin_lock_irqsave(qspinlock_t *lock) {
+    uint64_t flags = irq_save();
+    qspin_lock(lock);
+    return flags;
+}
+
+static inline void qspin_unlock_irqrestore(qspinlock_t *lock, uint64_t flags) {
+    qspin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include "types.h"
+
+// Intrusive red-black tree: embed rb_node_t in your struct and use rb_entry()
+// to get back to it. The leftmost node is cached, so rb_first() is O(1).
+
+typedef struct RBNode
+{
+    struct RBNode *parent;
+    struct RBNode *left;
+    struct RBNode *right;
+    bool red;
+} rb_node_t;
+
+typedef struct RBTree
+{
+    rb_node_t *root;
+    rb_node_t *leftmost;
+} rb_tree_t;
+
+// Ordering callback: true when a sorts before b. Equal keys go to the right.
+typedef bool (*rb_less_t)(const rb_node_t *a, const rb_node_t *b);
+
+#define rb_entry(ptr, type, member) ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
+
+void rb_insert(rb_tree_t *tree, rb_node_t *node, rb_less_t less);
+void rb_erase(rb_tree_t *tree, rb_node_t *node);
+rb_node_t *rb_next(const rb_node_t *node);
+
+static inline rb_node_t *rb_first(const rb_tree_t *tree) { return tree->leftmost; }
+static inline bool rb_empty(const rb_tree_t *tree) { return tree->root == NULL; }
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+#include "spinlock.h"
+
+// Reader-writer spinlock: any number of readers or one writer. A waiting
+// writer keeps new readers out, so a steady stream of them can't starve
+// it. Readers still all write the same word, for read-mostly data that
+// is traversed constantly a lock-free scheme scales better.
+
+#define RW_WRITER  (1U << 31)
+#define RW_WAITING (1U << 30) // A writer wants in, readers hold off.
+#define RW_READERS (RW_WAITING - 1)
+
+typedef struct RwLock
+{
+    uint32_t val;
+    LOCK_STAT_FIELD
+} rwlock_t;
+
+#define RWLOCK_INIT { .val = 0 LOCK_STAT_INIT }
+
+static inline void __rwlock_init(rwlock_t *lock, const char *name) {
+    *lock = (rwlock_t){ .val = 0 };
+    lock_stat_set_name(&lock->stat, name);
+}
+
+#define rwlock_init(lock) __rwlock_init((lock), LOCK_SITE(#lock))
+
+// The raw attempts leave the statistics to their callers.
+static inline bool __read_trylock(rwlock_t *lock) {
+    uint32_t val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+    while (!(val & (RW_WRITER | RW_WAITING)))
+        if (__atomic_compare_exchange_n(&lock->val, &val, val + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
+    return false;
+}
+
+static inline bool read_trylock(rwlock_t *lock) {
+    if (!__read_trylock(lock)) return false;
+    lock_stat_acquired_shared(&lock->stat, 0);
+    return true;
+}
+
+static inline void read_lock(rwlock_t *lock) {
+    uint64_t wait_start = 0;
+    while (!__read_trylock(lock))
+    {
+        if (wait_start == 0) wait_start = lock_stat_now();
+        while (__atomic_load_n(&lock->val, __ATOMIC_RELAXED) & (RW_WRITER | RW_WAITING)) __builtin_ia32_pause();
+    }
+    lock_stat_acquired_shared(&lock->stat, wait_start);
+}
+
+static inline void read_unlock(rwlock_t *lock) {
+    __atomic_sub_fetch(&lock->val, 1, __ATOMIC_RELEASE);
+}
+
+static inline bool __write_trylock(rwlock_t *lock) {
+    uint32_t val = __atomic_load_n(&lock->val, __ATOMIC_RELAXED);
+    if (val & ~RW_WAITING) return false;
+    return __atomic_compare_exchange_n(&lock->val, &val, RW_WRITER, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline bool write_trylock(rwlock_t *lock) {
+    if (!__write_trylock(lock)) return false;
+    lock_stat_acquired(&lock->stat, 0);
+    return true;
+}
+
+// Taking the lock clears RW_WAITING, other waiting writers set it again.
+static inline void write_lock(rwlock_t *lock) {
+    uint64_t wait_start = 0;
+    while (!__write_trylock(lock))
+    {
+        if (wait_start == 0) wait_start = lock_stat_now();
+        __atomic_or_fetch(&lock->val, RW_WAITING, __ATOMIC_RELAXED);
+        while (__atomic_load_n(&lock->val, __ATOMIC_RELAXED) & ~RW_WAITING) __builtin_ia32_pause();
+    }
+    lock_stat_acquired(&lock->stat, wait_start);
+}
+
+static inline void write_unlock(rwlock_t *lock) {
+    lock_stat_released(&lock->stat);
+    __atomic_and_fetch(&lock->val, ~RW_WRITER, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t read_lock_irqsave(rwlock_t *lock) {
+    uint64_t flags = irq_save();
+    read_lock(lock);
+    return flags;
+}
+
+static inline void read_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+    read_unlock(lock);
+    irq_restore(flags);
+}
+
+static inline uint64_t write_lock_irqsave(rwlock_t *lock) {
+    uint64_t flags = irq_save();
+    write_lock(lock);
+    return flags;
+}
+
+static inline void write_unlock_irqrestore(rwlock_t *lock, uint64_t flags) {
+    write_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "types.h"
+#include "memtag.h"
+#include "spinlock.h"
+#include "cpu.h"
+
+// Fixed size object caches.
+// A slab is one frame: a small header, then equally sized objects. Every
+// CPU keeps a magazine of free objects, so most allocations and frees never
+// touch the cache lock. Slab frames and objects are charged to the cache's
+// memtag.
+
+#define SLAB_MAGAZINE 16
+
+typedef struct SlabMagazine
+{
+    uint32_t count;
+    void *objects[SLAB_MAGAZINE];
+} __attribute__((aligned(64))) slab_magazine_t;
+
+typedef struct KmemCache
+{
+    const char *name;
+    size_t size;
+    size_t align;
+    memtag_t tag;
+
+    spinlock_t lock;
+    struct Slab *partial; // Some objects free.
+    struct Slab *full;
+    struct Slab *empty;   // At most one kept around.
+    uint32_t per_slab;    // Worked out on the first refill.
+    uint64_t slabs;
+
+    slab_magazine_t magazines[MAX_CPUS];
+} kmem_cache_t;
+
+#define DEFINE_KMEM_CACHE(var, cache_name, type)                                 \
+    kmem_cache_t var = { .name = (cache_name), .size = sizeof(type),             \
+                         .align = __alignof__(type), .tag = { .name = (cache_name) }, \
+                         .lock = SPINLOCK_INIT }
+
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void *kmem_cache_zalloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *object);
+void kmem_cache_dump(kmem_cache_t *cache);
+
+#endif
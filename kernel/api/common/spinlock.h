@@ -0,0 +1,146 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include "types.h"
+#include "cpu.h"
+
+// Ticket spinlock: every contender draws the next ticket and waits until
+// the owner field shows it, so the lock is handed out in FIFO order and
+// nobody starves. Fine as long as contention is light, every waiter still
+// watches the same cache line. Locks the whole machine fights over want
+// the queued qspinlock_t (qspinlock.h), reader heavy ones rwlock_t.
+//
+// Built with SPINLOCK_STATS (`make SPINLOCK_STATS=1`) every lock records
+// per lock class how often it was taken, how often it had to wait for it,
+// and the wait and hold times in TSC cycles, see lock_stat_dump(). A class
+// is where the lock was defined (SPINLOCK_INIT) or initialised
+// (spin_lock_init()), so all run queue locks are one class. Without it
+// the hooks are empty and locks are their bare word.
+
+#ifdef SPINLOCK_STATS
+struct LockClass;
+
+typedef struct LockStat
+{
+    const char *name;        // Names the class.
+    struct LockClass *class; // Looked up by name on first use.
+    uint64_t acquired_at;    // TSC, exclusive holders only.
+} lock_stat_t;
+
+#define __lock_str(x) #x
+#define lock_str(x) __lock_str(x)
+#define LOCK_SITE(what) what " (" __FILE__ ":" lock_str(__LINE__) ")"
+
+#define LOCK_STAT_FIELD lock_stat_t stat;
+#define LOCK_STAT_INIT , .stat = { .name = __FILE__ ":" lock_str(__LINE__) }
+
+static inline uint64_t lock_stat_now(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// wait_start is 0 when it didn't have to wait. Shared holders (readers)
+// don't get their hold time measured.
+void lock_stat_acquired(lock_stat_t *stat, uint64_t wait_start);
+void lock_stat_acquired_shared(lock_stat_t *stat, uint64_t wait_start);
+void lock_stat_released(lock_stat_t *stat);
+static inline void lock_stat_set_name(lock_stat_t *stat, const char *name) {
+    stat->name = name;
+    stat->class = NULL;
+}
+
+void lock_stat_dump();  // Classes by total wait time, the worst first.
+void lock_stat_reset();
+#else
+#define LOCK_SITE(what) NULL
+#define LOCK_STAT_FIELD
+#define LOCK_STAT_INIT
+#define lock_stat_now() 0ULL
+#define lock_stat_acquired(stat, wait_start) ((void)(wait_start))
+#define lock_stat_acquired_shared(stat, wait_start) ((void)(wait_start))
+#define lock_stat_released(stat) ((void)0)
+#define lock_stat_set_name(stat, name) ((void)(name))
+#endif
+
+typedef struct Spinlock
+{
+    union
+    {
+        uint32_t val;
+        struct
+        {
+            uint16_t owner; // Ticket being served, only the holder moves it.
+            uint16_t next;  // Next ticket to draw.
+        } t;
+    } tickets;
+    LOCK_STAT_FIELD
+} spinlock_t;
+
+#define SPINLOCK_INIT { .tickets = { 0 } LOCK_STAT_INIT }
+
+static inline void __spin_lock_init(spinlock_t *lock, const char *name) {
+    *lock = (spinlock_t){ .tickets = { 0 } };
+    lock_stat_set_name(&lock->stat, name);
+}
+
+#define spin_lock_init(lock) __spin_lock_init((lock), LOCK_SITE(#lock))
+
+static inline bool spin_is_locked(spinlock_t *lock) {
+    uint32_t val = __atomic_load_n(&lock->tickets.val, __ATOMIC_RELAXED);
+    return (uint16_t)val != (uint16_t)(val >> 16);
+}
+
+static inline bool spin_trylock(spinlock_t *lock) {
+    uint32_t val = __atomic_load_n(&lock->tickets.val, __ATOMIC_RELAXED);
+    if ((uint16_t)val != (uint16_t)(val >> 16)) return false;
+    if (!__atomic_compare_exchange_n(&lock->tickets.val, &val, val + (1U << 16), false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return false;
+    lock_stat_acquired(&lock->stat, 0);
+    return true;
+}
+
+static inline void spin_lock(spinlock_t *lock) {
+    uint16_t ticket = (uint16_t)(__atomic_fetch_add(&lock->tickets.val, 1U << 16, __ATOMIC_ACQUIRE) >> 16);
+    uint16_t owner = __atomic_load_n(&lock->tickets.t.owner, __ATOMIC_ACQUIRE);
+    if (owner == ticket)
+    {
+        lock_stat_acquired(&lock->stat, 0);
+        return;
+    }
+    uint64_t wait_start = lock_stat_now();
+    // Back off in proportion to the queue ahead of us, the line is only
+    // worth another look around when our turn could have come.
+    while (owner != ticket)
+    {
+        for (uint16_t ahead = (uint16_t)(ticket - owner); ahead; ahead--) __builtin_ia32_pause();
+        owner = __atomic_load_n(&lock->tickets.t.owner, __ATOMIC_ACQUIRE);
+    }
+    lock_stat_acquired(&lock->stat, wait_start);
+}
+
+static inline void spin_unlock(spinlock_t *lock) {
+    lock_stat_released(&lock->stat);
+    uint16_t owner = __atomic_load_n(&lock->tickets.t.owner, __ATOMIC_RELAXED);
+    __atomic_store_n(&lock->tickets.t.owner, (uint16_t)(owner + 1), __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline bool spin_trylock_irqsave(spinlock_t *lock, uint64_t *flags) {
+    *flags = irq_save();
+    if (spin_trylock(lock)) return true;
+    irq_restore(*flags);
+    return false;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include "types.h"
+
+// Clock data page, shared read-only with user space at VDSO_DATA_ADDR, so
+// reading the time needs no trap. The kernel rewrites it under a sequence
+// counter (odd while it writes); readers retry until they see the same even
+// value before and after. Everything in here is plain inline code, user
+// programs include this header as is.
+
+#define VDSO_DATA_ADDR 0x00007FFFFFFFE000ULL // Top of the user half, below the guard page.
+#define VDSO_DATA_VERSION 1
+
+typedef enum { VDSO_CLOCK_NONE, VDSO_CLOCK_TSC } EVdsoClockMode;
+
+typedef struct VdsoClockData
+{
+    volatile uint32_t seq;
+    uint32_t version;
+    uint32_t clock_mode; // VDSO_CLOCK_NONE: the counter can't be read from user space.
+    uint32_t shift;
+    uint64_t mult;       // ns = (cycles * mult) >> shift
+    uint64_t cycle_last; // TSC at the time below.
+    uint64_t mono_ns;    // Monotonic time at cycle_last.
+    uint64_t real_offset_ns; // Realtime = monotonic + this.
+    uint64_t tsc_hz;
+} vdso_clock_data_t;
+
+static inline uint32_t vdso_read_begin(const vdso_clock_data_t *vd) {
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&vd->seq, __ATOMIC_ACQUIRE)) & 1) __builtin_ia32_pause();
+    return seq;
+}
+
+static inline bool vdso_read_retry(const vdso_clock_data_t *vd, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&vd->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline uint64_t vdso_rdtsc(void) {
+    uint32_t lo, hi;
+    // rdtscp waits for earlier loads, so the TSC isn't read before the base.
+    __asm__ __volatile__ ("rdtscp" : "=a"(lo), "=d"(hi) : : "rcx");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// False if the clock has to be asked for through a system call instead.
+static inline bool vdso_clock_monotonic(const vdso_clock_data_t *vd, uint64_t *ns) {
+    uint32_t seq;
+    uint64_t now;
+    do
+    {
+        seq = vdso_read_begin(vd);
+        if (vd->clock_mode != VDSO_CLOCK_TSC) return false;
+        uint64_t cycles = vdso_rdtsc() - vd->cycle_last;
+        now = vd->mono_ns + (uint64_t)(((unsigned __int128)cycles * vd->mult) >> vd->shift);
+    } while (vdso_read_retry(vd, seq));
+    *ns = now;
+    return true;
+}
+
+// Nanoseconds since 1970-01-01 UTC.
+static inline bool vdso_clock_realtime(const vdso_clock_data_t *vd, uint64_t *ns) {
+    uint32_t seq;
+    uint64_t offset, mono;
+    do
+    {
+        seq = vdso_read_begin(vd);
+        offset = vd->real_offset_ns;
+        if (!vdso_clock_monotonic(vd, &mono)) return false;
+    } while (vdso_read_retry(vd, seq));
+    *ns = mono + offset;
+    return true;
+}
+
+#ifndef VDSO_USER
+// Kernel side:
+void vdso_init(); // After clocksource_init().
+void vdso_update(); // Clocksource or wall clock changed.
+void vdso_settime(uint64_t real_ns);
+uint64_t ktime_get_real_ns();
+
+extern vdso_clock_data_t *vdso_data; // HHDM address.
+extern uint64_t vdso_data_phys;      // For address spaces to map read-only at VDSO_DATA_ADDR.
+#endif
+
+#endif
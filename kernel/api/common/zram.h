@@ -0,0 +1,38 @@
+#ifndef ZRAM_H
+#define ZRAM_H
+
+#include "types.h"
+#include "memory.h"
+
+// Compressed RAM-backed swap tier.
+// Cold anonymous pages get LZ4 compressed into a pool of size-classed frames.
+
+typedef uint64_t swp_entry_t; // Pool frame | slot index. Never 0.
+
+typedef struct ZramStats
+{
+    uint64_t stored_pages;     // Pages currently held in the pool.
+    uint64_t compressed_bytes; // Compressed payload of those pages.
+    uint64_t pool_pages;       // Frames backing the pool.
+    uint64_t swap_outs;
+    uint64_t swap_ins;
+    uint64_t rejected;         // Pages that didn't compress well enough.
+    uint64_t compress_cycles;  // Totals, in TSC cycles.
+    uint64_t decompress_cycles;
+    uint64_t max_compress_cycles;
+    uint64_t max_decompress_cycles;
+} zram_stats_t;
+
+void zram_init(void);
+
+bool zram_store(const void *page, swp_entry_t *entry);
+bool zram_load(swp_entry_t entry, void *page); // Also releases the entry.
+void zram_free(swp_entry_t entry);
+
+// Emergency frames, so that the pool can grow while we are out of memory.
+bool zram_donate_page(physaddr_t frame);
+
+void zram_get_stats(zram_stats_t *out);
+void zram_dump_stats(void);
+
+#endif
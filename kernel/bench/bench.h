@@ -0,0 +1,11 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// In-kernel micro benchmarks. They run at boot when the kernel is built
+// with `make BENCH=1`, results go through printf_().
+
+void bench_cache_colour(void);
+void bench_context_switch(void);
+void bench_swap(void); // After anon_init() and zram_init().
+
+#endif
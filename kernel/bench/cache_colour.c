@@ -0,0 +1,72 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "timing.h"
+#include "bench.h"
+
+// Same-colour pages all compete for the same LLC sets, so once there are
+// more of them than the cache has ways they keep evicting each other.
+// The spread set has the same size but covers every colour.
+#define BENCH_COLOUR_PAGES  64
+#define BENCH_COLOUR_ROUNDS 32
+#define BENCH_LINE_SIZE     64
+
+static uint64_t bench_colour_walk(physaddr_t *pages, size_t count) {
+    uint64_t sum = 0;
+    uint64_t start = rdtsc();
+    for (size_t round = 0; round < BENCH_COLOUR_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            volatile uint64_t *page = (volatile uint64_t *)PHYS_TO_VIRT(pages[i]);
+            for (size_t line = 0; line < PAGE_SIZE / sizeof(uint64_t); line += BENCH_LINE_SIZE / sizeof(uint64_t))
+                sum += page[line];
+        }
+    }
+    (void)sum;
+    return rdtsc() - start;
+}
+
+static size_t bench_colour_fill(physaddr_t *pages, bool same_colour) {
+    uint32_t colours = pfa_colour_count();
+    size_t count = 0;
+    for (; count < BENCH_COLOUR_PAGES; count++)
+    {
+        pages[count] = alloc_page_colour(same_colour ? 0 : count % colours, NULL);
+        if (pages[count] == 0) break;
+    }
+    return count;
+}
+
+static void bench_colour_release(physaddr_t *pages, size_t count) {
+    for (size_t i = 0; i < count; i++) free_page(pages[i]);
+}
+
+void bench_cache_colour(void) {
+    static physaddr_t same[BENCH_COLOUR_PAGES];
+    static physaddr_t spread[BENCH_COLOUR_PAGES];
+
+    if (pfa_colour_count() < 2)
+    {
+        printf_("bench: cache colour: only one page colour, nothing to compare\n");
+        return;
+    }
+
+    size_t same_count = bench_colour_fill(same, true);
+    size_t spread_count = bench_colour_fill(spread, false);
+    size_t count = MIN(same_count, spread_count);
+
+    // Warm up once, then time.
+    bench_colour_walk(same, count);
+    uint64_t same_cycles = bench_colour_walk(same, count);
+    bench_colour_walk(spread, count);
+    uint64_t spread_cycles = bench_colour_walk(spread, count);
+
+    uint64_t accesses = (uint64_t)count * BENCH_COLOUR_ROUNDS * (PAGE_SIZE / BENCH_LINE_SIZE);
+    if (accesses == 0) accesses = 1;
+    printf_("bench: cache colour: %u colours, %lu pages\n", pfa_colour_count(), count);
+    printf_("bench: cache colour: same colour %lu cycles/line, spread %lu cycles/line\n",
+            same_cycles / accesses, spread_cycles / accesses);
+
+    bench_colour_release(same, same_count);
+    bench_colour_release(spread, spread_count);
+}
@@ -0,0 +1,34 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "timing.h"
+#include "cpu.h"
+#include "context.h"
+#include "bench.h"
+
+// Two threads handing the CPU back and forth with switch_to(), without the
+// scheduler in between. Every round trip is two switches.
+#define BENCH_SWITCH_ROUNDS 100000
+
+static ctx_t bench_main;
+static ctx_t bench_peer;
+
+static void bench_peer_loop(void) {
+    for (;;) switch_to(&bench_peer, &bench_main);
+}
+
+void bench_context_switch(void) {
+    physaddr_t stack = alloc_page();
+    if (stack == 0) return;
+    init_context(&bench_peer, (uint8_t *)PHYS_TO_VIRT(stack) + PAGE_SIZE, bench_peer_loop);
+
+    uint64_t flags = irq_save();
+    for (int i = 0; i < 1000; i++) switch_to(&bench_main, &bench_peer); // Warm up.
+
+    uint64_t start = rdtsc();
+    for (int i = 0; i < BENCH_SWITCH_ROUNDS; i++) switch_to(&bench_main, &bench_peer);
+    uint64_t cycles = rdtsc() - start;
+    irq_restore(flags);
+
+    printf_("bench: context switch: %lu cycles/switch\n", cycles / (2 * BENCH_SWITCH_ROUNDS));
+    free_page(stack); // The peer is parked inside switch_to() for good.
+}
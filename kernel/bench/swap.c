@@ -0,0 +1,83 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "common/zram.h"
+#include "timing.h"
+#include "bench.h"
+
+// Anonymous pages pushed out to zram by the reclaim path and faulted back
+// in. One page stays pinned the whole time and must never leave. Every page
+// gets a pattern of its own so mixed up or corrupt swap-ins show.
+#define BENCH_SWAP_PAGES 64
+#define BENCH_SWAP_WORDS (PAGE_SIZE / sizeof(uint64_t))
+
+static uint64_t bench_swap_word(size_t page, size_t word) {
+    return (page << 16) | (word & 0xF); // Compressible, but not trivially.
+}
+
+static size_t bench_swap_out(physaddr_t *slots, size_t count) {
+    size_t out = 0;
+    while (out < count)
+    {
+        physaddr_t frame = swap_reclaim_page();
+        if (frame == 0) break;
+        free_page(frame);
+        out = 0;
+        for (size_t i = 0; i < count; i++) out += !(slots[i] & PTE_PRESENT);
+    }
+    return out;
+}
+
+void bench_swap(void) {
+    static physaddr_t slots[BENCH_SWAP_PAGES];
+
+    size_t count = 0;
+    for (; count < BENCH_SWAP_PAGES; count++)
+    {
+        if (!anon_map(&slots[count])) break;
+        physaddr_t frame = anon_fault(&slots[count]);
+        uint64_t *page = (uint64_t *)PHYS_TO_VIRT(frame);
+        for (size_t word = 0; word < BENCH_SWAP_WORDS; word++) page[word] = bench_swap_word(count, word);
+        if (count) anon_unpin(&slots[count]); // Page 0 stays pinned.
+    }
+    if (count < 2)
+    {
+        printf_("bench: swap: out of memory\n");
+        if (count) anon_unpin(&slots[0]);
+        for (size_t i = 0; i < count; i++) anon_unmap(&slots[i]);
+        return;
+    }
+
+    uint64_t start = rdtsc();
+    size_t out = bench_swap_out(slots + 1, count - 1);
+    uint64_t out_cycles = rdtsc() - start;
+    bool pinned_kept = slots[0] & PTE_PRESENT;
+    anon_unpin(&slots[0]);
+
+    size_t bad = 0;
+    start = rdtsc();
+    for (size_t i = 0; i < count; i++)
+    {
+        physaddr_t frame = anon_fault(&slots[i]);
+        if (frame == 0)
+        {
+            bad++;
+            continue;
+        }
+        uint64_t *page = (uint64_t *)PHYS_TO_VIRT(frame);
+        for (size_t word = 0; word < BENCH_SWAP_WORDS; word++)
+        {
+            if (page[word] == bench_swap_word(i, word)) continue;
+            bad++;
+            break;
+        }
+        anon_unpin(&slots[i]);
+    }
+    uint64_t in_cycles = rdtsc() - start;
+
+    printf_("bench: swap: %lu of %lu pages out, %lu cycles/page out, %lu cycles/page in\n",
+            out, count - 1, out ? out_cycles / out : 0, in_cycles / count);
+    printf_("bench: swap: pinned page %s, %lu bad pages\n", pinned_kept ? "kept" : "LOST", bad);
+    zram_dump_stats();
+
+    for (size_t i = 0; i < count; i++) anon_unmap(&slots[i]);
+}
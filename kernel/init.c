@@ -4,24 +4,53 @@
 #include "kernel/gdt.h"
 #include "kernel/idt.h"
 #include "kernel/timing.h"
+#include "kernel/cpu.h"
+#include "kernel/smp.h"
+#include "kernel/fpu.h"
+#include "kernel/clocksource.h"
+#include "common/isr.h"
+
+#include "common/memory.h"
+#include "common/zram.h"
+#include "common/memtag.h"
+#include "common/vdso.h"
 
 #include "isched/scheduler.h"
+#include "isched/workqueue.h"
+
+#include "bench/bench.h"
 
 static volatile LIMINE_BASE_REVISION(2);
 
 void _start(void) {
     printf_("Tui");
     initiateGDT();
+    percpu_init(0);
+    initiateISR();
     set_idt();
-    pit_init(1193182);
-   // char *args1[2] = {"/system/foo", "--test"};
-   // char *args2[2] = {"/system/bar", "-d"};
-   // // Two hard coded processes (FOR TESTING ONLY!):
-   // process_t *proc0 = create_process(KERNEL, 0, args1);
-   // process_t *proc1 = create_process(USER, 0, args2);
-   // // Then we evaluate them:
-   // evaluate_loop();
-   //     
-   // proc0->
-    
+    pit_init(TIMER_HZ);
+    init_pmm();
+    clocksource_init();
+    pfa_init_colours();
+    memtag_init();
+    vdso_init();
+    anon_init();
+    zram_init();
+    fpu_init();
+#ifdef KERNEL_BENCH
+    bench_cache_colour();
+    bench_context_switch();
+    bench_swap();
+#endif
+    sched_init();
+    irq_enable();
+    smp_init();
+    workqueue_init();
+
+   // Hard coded processes (FOR TESTING ONLY!):
+   // process_t *proc0 = create_process(KERNEL, foo);
+   // process_t *proc1 = create_process(USER, bar);
+
+    // The boot thread is the idle process from now on:
+    evaluate_loop();
 }
\ No newline at end of file
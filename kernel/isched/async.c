@@ -0,0 +1,158 @@
+#include "async.h"
+#include "workqueue.h"
+#include "timing.h"
+#include "percpu.h"
+#include "printf.h"
+#include "common/spinlock.h"
+
+#define TASK_IDLE    0 // Waiting for something.
+#define TASK_QUEUED  1
+#define TASK_RUNNING 2
+#define TASK_REPOLL  3 // Woken while running, goes back on the queue.
+#define TASK_DONE    4
+
+typedef struct AsyncExecutor
+{
+    spinlock_t lock;
+    async_task_t *head;
+    async_task_t *tail;
+    work_t work;
+    uint64_t spawned;
+    uint64_t polls;
+    uint64_t finished;
+} __attribute__((aligned(64))) async_executor_t;
+
+static void async_run(work_t *work);
+
+static async_executor_t executors[MAX_CPUS] = {
+    [0 ... MAX_CPUS - 1] = { .work = WORK_INIT(async_run) },
+};
+
+static inline async_executor_t *executor_of(uint32_t cpu) {
+    return &executors[cpu < MAX_CPUS ? cpu : 0];
+}
+
+// Locked.
+static void executor_push(async_executor_t *ex, async_task_t *task) {
+    task->next = NULL;
+    task->state = TASK_QUEUED;
+    if (ex->tail) ex->tail->next = task;
+    else ex->head = task;
+    ex->tail = task;
+}
+
+// Queueing our work item again while it runs is fine, it just runs once more.
+static bool executor_wake(async_executor_t *ex, async_task_t *task) {
+    uint64_t flags = spin_lock_irqsave(&ex->lock);
+    bool queued = false;
+    if (task->state == TASK_IDLE)
+    {
+        executor_push(ex, task);
+        queued = true;
+    }
+    else if (task->state == TASK_RUNNING)
+    {
+        task->state = TASK_REPOLL;
+    }
+    spin_unlock_irqrestore(&ex->lock, flags);
+
+    if (queued) queue_work_on(task->cpu, &ex->work);
+    return queued;
+}
+
+void async_wake(async_task_t *task) {
+    executor_wake(executor_of(task->cpu), task);
+}
+
+static bool async_wake_func(wait_entry_t *wait) {
+    async_task_t *task = (async_task_t *)((uint8_t *)wait - __builtin_offsetof(async_task_t, wait));
+    async_wake(task);
+    return true;
+}
+
+static void async_timer(ktimer_t *timer) {
+    async_wake(timer->data);
+}
+
+void async_spawn_on(uint32_t cpu, async_task_t *task, async_status_t (*poll)(async_task_t *task),
+                    void (*done)(async_task_t *task)) {
+    async_executor_t *ex = executor_of(cpu);
+    task->poll = poll;
+    task->done = done;
+    task->resume = 0;
+    task->cpu = (uint32_t)(ex - executors);
+    task->state = TASK_IDLE;
+    wait_entry_init_func(&task->wait, async_wake_func);
+    timer_setup(&task->timer, async_timer, task);
+    __atomic_add_fetch(&ex->spawned, 1, __ATOMIC_RELAXED);
+    executor_wake(ex, task);
+}
+
+void async_spawn(async_task_t *task, async_status_t (*poll)(async_task_t *task), void (*done)(async_task_t *task)) {
+    async_spawn_on(cpu_index(), task, poll, done);
+}
+
+// Queued before the second look, so a complete() in between wakes us.
+bool async_try_completion(async_task_t *task, completion_t *c) {
+    if (!try_wait_for_completion(c))
+    {
+        add_wait_queue(&c->wq, &task->wait, WAIT_EXCLUSIVE);
+        if (!try_wait_for_completion(c)) return false;
+    }
+    remove_wait_queue(&c->wq, &task->wait);
+    return true;
+}
+
+void async_timer_start(async_task_t *task, uint64_t ticks) {
+    timer_add(&task->timer, get_jiffies() + (ticks ? ticks : 1));
+}
+
+// Work item of the executor: polls what's ready, ASYNC_BATCH at most.
+static void async_run(work_t *work) {
+    async_executor_t *ex = (async_executor_t *)((uint8_t *)work - __builtin_offsetof(async_executor_t, work));
+    for (uint32_t polls = 0; polls < ASYNC_BATCH; polls++)
+    {
+        uint64_t flags = spin_lock_irqsave(&ex->lock);
+        async_task_t *task = ex->head;
+        if (task == NULL)
+        {
+            spin_unlock_irqrestore(&ex->lock, flags);
+            return;
+        }
+        ex->head = task->next;
+        if (ex->head == NULL) ex->tail = NULL;
+        task->state = TASK_RUNNING;
+        ex->polls++;
+        spin_unlock_irqrestore(&ex->lock, flags);
+
+        async_status_t status = task->poll(task);
+
+        flags = spin_lock_irqsave(&ex->lock);
+        if (status == ASYNC_DONE)
+        {
+            task->state = TASK_DONE;
+            ex->finished++;
+        }
+        else if (task->state == TASK_REPOLL)
+        {
+            executor_push(ex, task);
+        }
+        else
+        {
+            task->state = TASK_IDLE;
+        }
+        spin_unlock_irqrestore(&ex->lock, flags);
+
+        if (status == ASYNC_DONE && task->done) task->done(task);
+    }
+    queue_work_on((uint32_t)(ex - executors), work); // More to do, after whatever else the pool has queued.
+}
+
+void async_dump_stats() {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        async_executor_t *ex = &executors[cpu];
+        if (ex->spawned == 0) continue;
+        printf_("async cpu%u: %lu spawned, %lu finished, %lu polls\n", cpu, ex->spawned, ex->finished, ex->polls);
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include "wait.h"
+#include "timer.h"
+
+// Stackless tasks: multi-step asynchronous operations written as one C
+// function that returns whenever it has to wait and continues where it
+// left off the next time it is polled. A task is a struct of a hundred
+// odd bytes inside the operation it drives, not a thread with a stack.
+//
+//     typedef struct ReadOp { async_task_t task; completion_t irq; int tries; } read_op_t;
+//
+//     static async_status_t read_poll(async_task_t *task) {
+//         read_op_t *op = (read_op_t *)task;
+//         ASYNC_BEGIN(task);
+//         for (op->tries = 0; op->tries < 3; op->tries++)
+//         {
+//             start_read(op);
+//             ASYNC_AWAIT_COMPLETION(task, &op->irq);
+//             if (read_ok(op)) break;
+//             ASYNC_AWAIT_TIMER(task, 10); // Give the device a moment.
+//         }
+//         ASYNC_END(task);
+//     }
+//
+//     async_spawn(&op->task, read_poll, read_done);
+//
+// Locals don't survive an await, keep state in the surrounding struct.
+// The body must not have switch statements of its own around an await
+// and must never block, it shares the CPU with every other task.
+//
+// Every CPU has a ready queue of tasks, drained by a work item on the
+// workqueue of that CPU, so tasks run in the existing worker threads.
+// A task stays on the CPU it was spawned on.
+
+typedef enum { ASYNC_PENDING, ASYNC_DONE } async_status_t;
+
+#define ASYNC_BATCH 64 // Polls per run of the executor before others get the worker.
+
+typedef struct AsyncTask
+{
+    struct AsyncTask *next; // Ready queue link.
+    async_status_t (*poll)(struct AsyncTask *task);
+    void (*done)(struct AsyncTask *task); // After it finished, may free it.
+    uint32_t resume; // Where poll continues, a line number.
+    uint32_t cpu;
+    uint8_t state;   // Executor bookkeeping, under its lock.
+    wait_entry_t wait;
+    ktimer_t timer;
+} async_task_t;
+
+// done may be NULL. The task gets polled for the first time soon after.
+void async_spawn(async_task_t *task, async_status_t (*poll)(async_task_t *task), void (*done)(async_task_t *task));
+void async_spawn_on(uint32_t cpu, async_task_t *task, async_status_t (*poll)(async_task_t *task),
+                    void (*done)(async_task_t *task));
+
+// Makes sure the task gets polled again, from anywhere (interrupts too).
+void async_wake(async_task_t *task);
+
+// Helpers of the macros.
+bool async_try_completion(async_task_t *task, completion_t *c);
+void async_timer_start(async_task_t *task, uint64_t ticks);
+
+#define ASYNC_BEGIN(task) switch ((task)->resume) { case 0:
+
+#define ASYNC_END(task) } (task)->resume = 0; return ASYNC_DONE
+
+// Resume point: polls after this one start right here.
+#define __ASYNC_LABEL(task) (task)->resume = __LINE__; __attribute__((fallthrough)); case __LINE__:
+
+// Polls again later, after everybody else on the ready queue.
+#define ASYNC_YIELD(task) do {                                                    \
+    (task)->resume = __LINE__;                                                    \
+    async_wake(task);                                                             \
+    return ASYNC_PENDING;                                                         \
+    case __LINE__:;                                                               \
+} while (0)
+
+// Somebody that makes the condition true has to async_wake() the task.
+#define ASYNC_AWAIT(task, condition) do {                                         \
+    __ASYNC_LABEL(task)                                                           \
+    if (!(condition)) return ASYNC_PENDING;                                       \
+} while (0)
+
+// Takes one completion like wait_for_completion().
+#define ASYNC_AWAIT_COMPLETION(task, c) ASYNC_AWAIT(task, async_try_completion((task), (c)))
+
+// Waits ticks jiffies.
+#define ASYNC_AWAIT_TIMER(task, ticks) do {                                       \
+    async_timer_start((task), (ticks));                                           \
+    ASYNC_AWAIT(task, !timer_pending(&(task)->timer));                            \
+} while (0)
+
+void async_dump_stats();
+
+#endif
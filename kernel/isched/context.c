@@ -1,39 +1,48 @@
 #include "common/types.h"
 #include "context.h"
 
+// Only rbx, rbp and r12 - r15 survive a call, the caller already saved
+// everything else. CR3 gets reloaded only when the address space changes,
+// since that write flushes the TLB.
+__asm__ (
+    ".text\n"
+    ".global switch_to\n"
+    ".type switch_to, @function\n"
+    "switch_to:\n\t"
+    "pushq %rbp\n\t"
+    "pushq %rbx\n\t"
+    "pushq %r12\n\t"
+    "pushq %r13\n\t"
+    "pushq %r14\n\t"
+    "pushq %r15\n\t"
+    "pushfq\n\t"
+    "movq %rsp, 0(%rdi)\n\t"
+    "movq 0(%rsi), %rsp\n\t"
+    "movq 8(%rsi), %rax\n\t"
+    "testq %rax, %rax\n\t"
+    "jz 1f\n\t"
+    "movq %cr3, %rdx\n\t"
+    "cmpq %rax, %rdx\n\t"
+    "je 1f\n\t"
+    "movq %rax, %cr3\n"
+    "1:\n\t"
+    "popfq\n\t"
+    "popq %r15\n\t"
+    "popq %r14\n\t"
+    "popq %r13\n\t"
+    "popq %r12\n\t"
+    "popq %rbx\n\t"
+    "popq %rbp\n\t"
+    "ret\n"
+);
 
-void save_context(ctx_t *ctx, void (*rip)(void)) {
-    __asm__ __volatile__ (
-        "movq %%rsp, %0\n\t"
-        "movq %%rbx, %1\n\t"
-        "movq %%rbp, %2\n\t"
-        "movq %%r12, %3\n\t"
-        "movq %%r13, %4\n\t"
-        "movq %%r14, %5\n\t"
-        "movq %%r15, %6\n\t"
-        : "=m"(ctx->rsp), "=m"(ctx->rbx), "=m"(ctx->rbp),
-          "=m"(ctx->r12), "=m"(ctx->r13), "=m"(ctx->r14),
-          "=m"(ctx->r15)
-        :
-        : "memory"
-    );
-    ctx->rip = rip;
-}
+void init_context(ctx_t *ctx, void *stack_top, void (*entry)(void)) {
+    uint64_t *sp = (uint64_t *)((uintptr_t)stack_top & ~0xFULL);
+    *--sp = 0; // Fake return address: entry() sees the stack as if it was called.
+    *--sp = (uint64_t)entry;
+    for (int reg = 0; reg < 6; reg++) *--sp = 0; // rbp, rbx, r12 - r15
+    *--sp = 0x2; // RFLAGS, reserved bit only.
 
-void restore_context(ctx_t *ctx) {
-    __asm__ __volatile__ (
-        "movq %0, %%rsp\n\t"
-        "movq %1, %%rbx\n\t"
-        "movq %2, %%rbp\n\t"
-        "movq %3, %%r12\n\t"
-        "movq %4, %%r13\n\t"
-        "movq %5, %%r14\n\t"
-        "movq %6, %%r15\n\t"
-        "jmp *%7\n\t"
-        :
-        : "m"(ctx->rsp), "m"(ctx->rbx), "m"(ctx->rbp),
-          "m"(ctx->r12), "m"(ctx->r13), "m"(ctx->r14),
-          "m"(ctx->r15), "m"(ctx->rip)
-        : "memory"
-    );
-}
\ No newline at end of file
+    ctx->rsp = (uint64_t)sp;
+    ctx->cr3 = 0;
+}
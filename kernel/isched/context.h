@@ -3,21 +3,21 @@
 
 #include "common/types.h"
 
+// A switched-out thread keeps its callee-saved registers and RFLAGS on its
+// own stack, so the context is only the stack pointer and the address space.
+// The offsets are used by the assembly in context.c!
 typedef struct Context
 {
     uint64_t rsp;
-    uint64_t rbx;
-    uint64_t rbp;
-    uint64_t r12;
-    uint64_t r13;
-    uint64_t r14;
-    uint64_t r15;
-    void (*rip)(void);
+    uint64_t cr3; // 0 for kernel threads, they run on whatever is loaded.
 } ctx_t;
 
+// Saves the current thread into prev and continues next. Returns when
+// somebody switches back to prev.
+void switch_to(ctx_t *prev, ctx_t *next);
 
-void save_context(ctx_t *ctx, void(*rip)(void));
-void restore_context(ctx_t *ctx);
+// Fresh context that starts executing entry() on the given stack, with
+// interrupts off.
+void init_context(ctx_t *ctx, void *stack_top, void (*entry)(void));
 
-
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,244 @@
+#include "futex.h"
+#include "scheduler.h"
+#include "clocksource.h"
+#include "syscall_defs.h"
+#include "uaccess.h"
+#include "common/spinlock.h"
+
+typedef struct FutexKey
+{
+    uint64_t space; // Address space (CR3), 0 for the shared kernel one.
+    uintptr_t addr;
+} futex_key_t;
+
+struct FutexBucket;
+
+// One per waiter, on its stack.
+typedef struct FutexQ
+{
+    futex_key_t key;
+    process_t *proc;
+    struct FutexBucket *bucket; // Changes on requeue, under both bucket locks.
+    struct FutexQ *prev;
+    struct FutexQ *next;
+    bool queued;
+} futex_q_t;
+
+typedef struct FutexBucket
+{
+    spinlock_t lock;
+    futex_q_t *head;
+    futex_q_t *tail;
+} __attribute__((aligned(64))) futex_bucket_t;
+
+static futex_bucket_t futex_buckets[FUTEX_BUCKETS];
+
+// 0 or the error for a bad address. Only user space addresses are taken,
+// the word itself is read with get_user_u32().
+static int64_t futex_key(uint32_t *uaddr, futex_key_t *key) {
+    if (uaddr == NULL || ((uintptr_t)uaddr & 3)) return ERR(EINVAL);
+    if (!access_ok(uaddr, sizeof(*uaddr))) return ERR(EFAULT);
+    key->space = current_process()->context.cr3;
+    key->addr = (uintptr_t)uaddr;
+    return 0;
+}
+
+static inline bool key_equal(const futex_key_t *a, const futex_key_t *b) {
+    return a->space == b->space && a->addr == b->addr;
+}
+
+static futex_bucket_t *futex_hash(const futex_key_t *key) {
+    uint64_t h = (key->addr >> 2) ^ (key->space >> 12);
+    h *= 0x9E3779B97F4A7C15ULL;
+    return &futex_buckets[h >> (64 - 8)];
+}
+
+static void q_insert(futex_bucket_t *bucket, futex_q_t *q) {
+    q->bucket = bucket;
+    q->next = NULL;
+    q->prev = bucket->tail;
+    if (bucket->tail) bucket->tail->next = q;
+    else bucket->head = q;
+    bucket->tail = q;
+    q->queued = true;
+}
+
+static void q_remove(futex_bucket_t *bucket, futex_q_t *q) {
+    if (q->prev) q->prev->next = q->next;
+    else bucket->head = q->next;
+    if (q->next) q->next->prev = q->prev;
+    else bucket->tail = q->prev;
+    q->prev = NULL;
+    q->next = NULL;
+    q->queued = false;
+}
+
+// The bucket a queued waiter sits in, locked; requeue may move it meanwhile.
+static futex_bucket_t *q_lock(futex_q_t *q) {
+    for (;;)
+    {
+        futex_bucket_t *bucket = __atomic_load_n(&q->bucket, __ATOMIC_ACQUIRE);
+        spin_lock(&bucket->lock);
+        if (bucket == q->bucket) return bucket;
+        spin_unlock(&bucket->lock);
+    }
+}
+
+static void double_bucket_lock(futex_bucket_t *a, futex_bucket_t *b) {
+    if (a == b)
+    {
+        spin_lock(&a->lock);
+    }
+    else if (a < b)
+    {
+        spin_lock(&a->lock);
+        spin_lock(&b->lock);
+    }
+    else
+    {
+        spin_lock(&b->lock);
+        spin_lock(&a->lock);
+    }
+}
+
+static void double_bucket_unlock(futex_bucket_t *a, futex_bucket_t *b) {
+    spin_unlock(&a->lock);
+    if (a != b) spin_unlock(&b->lock);
+}
+
+int64_t futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns) {
+    futex_q_t q;
+    int64_t err = futex_key(uaddr, &q.key);
+    if (err) return err;
+    q.proc = current_process();
+    q.prev = q.next = NULL;
+    q.queued = false;
+    uint64_t deadline = timeout_ns ? ktime_get_ns() + timeout_ns : 0;
+
+    futex_bucket_t *bucket = futex_hash(&q.key);
+    uint64_t flags = spin_lock_irqsave(&bucket->lock);
+    // Checked under the bucket lock: a waker changes the value first and
+    // takes the lock after, so it either finds us queued or we see its value.
+    uint32_t cur;
+    err = get_user_u32(&cur, uaddr);
+    if (err == 0 && cur != val) err = ERR(EAGAIN);
+    if (err)
+    {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return err;
+    }
+    q_insert(bucket, &q);
+    sched_prepare_block();
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    bool timed_out = false;
+    if (deadline) timed_out = schedule_hrtimeout(deadline);
+    else schedule();
+
+    flags = irq_save();
+    bucket = q_lock(&q);
+    bool woken = !q.queued;
+    if (!woken) q_remove(bucket, &q);
+    spin_unlock(&bucket->lock);
+    if (q.proc->state == PROC_BLOCKED) sched_wakeup(q.proc);
+    irq_restore(flags);
+
+    if (woken) return 0;
+    return timed_out ? ERR(ETIMEDOUT) : ERR(EAGAIN); // Spurious, let user space look again.
+}
+
+// Bucket locked. Wakes up to nr waiters on key, returns how many.
+static uint32_t wake_locked(futex_bucket_t *bucket, const futex_key_t *key, uint32_t nr) {
+    uint32_t woken = 0;
+    futex_q_t *q = bucket->head;
+    while (q && woken < nr)
+    {
+        futex_q_t *next = q->next;
+        if (key_equal(&q->key, key))
+        {
+            process_t *proc = q->proc;
+            q_remove(bucket, q); // Its owner may return as soon as we unlock.
+            sched_wakeup(proc);
+            woken++;
+        }
+        q = next;
+    }
+    return woken;
+}
+
+int64_t futex_wake(uint32_t *uaddr, uint32_t nr) {
+    futex_key_t key;
+    int64_t err = futex_key(uaddr, &key);
+    if (err) return err;
+    if (nr == 0) return 0;
+
+    futex_bucket_t *bucket = futex_hash(&key);
+    uint64_t flags = spin_lock_irqsave(&bucket->lock);
+    uint32_t woken = bucket->head ? wake_locked(bucket, &key, nr) : 0;
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return woken;
+}
+
+// Condition variable broadcast: wake one waiter, move the rest onto the
+// mutex word instead of letting them all stampede for it.
+int64_t futex_requeue(uint32_t *uaddr, uint32_t nr_wake, uint32_t *uaddr2, uint32_t nr_requeue,
+                      bool cmp, uint32_t val) {
+    futex_key_t key, key2;
+    int64_t err = futex_key(uaddr, &key);
+    if (err == 0) err = futex_key(uaddr2, &key2);
+    if (err) return err;
+
+    futex_bucket_t *bucket = futex_hash(&key);
+    futex_bucket_t *bucket2 = futex_hash(&key2);
+    uint64_t flags = irq_save();
+    double_bucket_lock(bucket, bucket2);
+
+    uint32_t cur = val;
+    if (cmp) err = get_user_u32(&cur, uaddr);
+    if (err == 0 && cur != val) err = ERR(EAGAIN);
+    if (err)
+    {
+        double_bucket_unlock(bucket, bucket2);
+        irq_restore(flags);
+        return err;
+    }
+
+    uint32_t done = wake_locked(bucket, &key, nr_wake);
+    uint32_t moved = 0;
+    futex_q_t *q = bucket->head;
+    while (q && moved < nr_requeue)
+    {
+        futex_q_t *next = q->next;
+        if (key_equal(&q->key, &key))
+        {
+            q->key = key2;
+            if (bucket != bucket2)
+            {
+                q_remove(bucket, q);
+                q_insert(bucket2, q);
+            }
+            moved++;
+        }
+        q = next;
+    }
+
+    double_bucket_unlock(bucket, bucket2);
+    irq_restore(flags);
+    return done + moved;
+}
+
+int64_t futex(uint32_t *uaddr, int op, uint32_t val, uint64_t arg, uint32_t *uaddr2, uint32_t val3) {
+    switch (op)
+    {
+        case FUTEX_WAIT:
+            return futex_wait(uaddr, val, arg);
+        case FUTEX_WAKE:
+            return futex_wake(uaddr, val);
+        case FUTEX_REQUEUE:
+            return futex_requeue(uaddr, val, uaddr2, (uint32_t)MIN(arg, 0xFFFFFFFFULL), false, 0);
+        case FUTEX_CMP_REQUEUE:
+            return futex_requeue(uaddr, val, uaddr2, (uint32_t)MIN(arg, 0xFFFFFFFFULL), true, val3);
+        default:
+            return ERR(ENOSYS);
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include "common/types.h"
+
+// Fast user space mutexes: the lock word lives in user memory and is only
+// touched by atomics there; the kernel gets involved only to sleep on it
+// or wake its sleepers. Waiters hash by (address space, address) into
+// buckets with their own lock, so unrelated futexes rarely contend.
+//
+// Returns 0 (WAIT), the number woken/moved (WAKE, REQUEUE) or a negative
+// E* value from syscall_defs.h. Addresses must lie in user space (EFAULT).
+
+#define FUTEX_BUCKETS 256
+
+int64_t futex(uint32_t *uaddr, int op, uint32_t val, uint64_t arg, uint32_t *uaddr2, uint32_t val3);
+
+int64_t futex_wait(uint32_t *uaddr, uint32_t val, uint64_t timeout_ns);
+int64_t futex_wake(uint32_t *uaddr, uint32_t nr);
+int64_t futex_requeue(uint32_t *uaddr, uint32_t nr_wake, uint32_t *uaddr2, uint32_t nr_requeue,
+                      bool cmp, uint32_t val);
+
+#endif
@@ -0,0 +1,67 @@
+#include "mutex.h"
+
+void mutex_init(mutex_t *mutex) {
+    mutex->owner = NULL;
+    wait_queue_init(&mutex->wq);
+}
+
+bool mutex_trylock(mutex_t *mutex) {
+    process_t *expected = NULL;
+    return __atomic_compare_exchange_n(&mutex->owner, &expected, current_process(), false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+void mutex_lock(mutex_t *mutex) {
+    if (mutex_trylock(mutex)) return;
+    wait_event_exclusive(mutex->wq, mutex_trylock(mutex));
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    // Sequentially consistent: a contender queues itself before its last
+    // trylock, so either it sees the mutex free or we see it waiting.
+    __atomic_store_n(&mutex->owner, NULL, __ATOMIC_SEQ_CST);
+    wake_up(&mutex->wq);
+}
+
+bool mutex_is_locked(mutex_t *mutex) {
+    return __atomic_load_n(&mutex->owner, __ATOMIC_RELAXED) != NULL;
+}
+
+void sem_init(semaphore_t *sem, int32_t count) {
+    sem->count = count;
+    wait_queue_init(&sem->wq);
+}
+
+bool sem_trydown(semaphore_t *sem) {
+    int32_t count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count > 0)
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return true;
+    return false;
+}
+
+void sem_down(semaphore_t *sem) {
+    wait_event_exclusive(sem->wq, sem_trydown(sem));
+}
+
+bool sem_down_timeout(semaphore_t *sem, uint64_t ticks) {
+    if (sem_trydown(sem)) return true;
+
+    wait_entry_t wait;
+    wait_entry_init(&wait);
+    bool done = false;
+    while (!done && ticks)
+    {
+        prepare_to_wait(&sem->wq, &wait, WAIT_EXCLUSIVE);
+        done = sem_trydown(sem);
+        if (!done) ticks = schedule_timeout(ticks);
+    }
+    finish_wait(&sem->wq, &wait);
+    if (!done) done = sem_trydown(sem);
+    return done;
+}
+
+void sem_up(semaphore_t *sem) {
+    __atomic_add_fetch(&sem->count, 1, __ATOMIC_SEQ_CST);
+    wake_up(&sem->wq);
+}
@@ -0,0 +1,39 @@
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include "wait.h"
+
+// Sleeping locks for process context. An uncontended mutex_lock() is one
+// compare-and-swap; contenders sleep on the wait queue and get woken one at
+// a time. Never from interrupt handlers, use a spinlock_t there.
+
+typedef struct Mutex
+{
+    process_t *owner;
+    wait_queue_t wq;
+} mutex_t;
+
+#define MUTEX_INIT { NULL, WAIT_QUEUE_INIT }
+
+void mutex_init(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+bool mutex_trylock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+bool mutex_is_locked(mutex_t *mutex);
+
+// Counting semaphore.
+typedef struct Semaphore
+{
+    int32_t count;
+    wait_queue_t wq;
+} semaphore_t;
+
+#define SEMAPHORE_INIT(n) { (n), WAIT_QUEUE_INIT }
+
+void sem_init(semaphore_t *sem, int32_t count);
+void sem_down(semaphore_t *sem);
+bool sem_trydown(semaphore_t *sem);
+bool sem_down_timeout(semaphore_t *sem, uint64_t ticks); // False on timeout.
+void sem_up(semaphore_t *sem);
+
+#endif
@@ -0,0 +1,127 @@
+#include "pid.h"
+#include "scheduler.h"
+#include "common/memory.h"
+#include "common/memtag.h"
+#include "common/spinlock.h"
+
+// Set bits mean free. pid_top has a bit per pid_mid word with a free bit
+// below it, pid_mid a bit per pid_leaf word.
+#define PID_LEAF_WORDS (PID_MAX / 64)
+#define PID_MID_WORDS  (PID_LEAF_WORDS / 64)
+
+// Slot -> process: pages of slots, allocated when first needed.
+typedef struct PidSlot
+{
+    process_t *proc;
+    uint32_t generation;
+} pid_slot_t;
+
+#define PID_PER_PAGE   (PAGE_SIZE / sizeof(pid_slot_t))
+#define PID_DIR        (PID_MAX / PID_PER_PAGE)
+
+static uint64_t pid_top;
+static uint64_t pid_mid[PID_MID_WORDS];
+static uint64_t pid_leaf[PID_LEAF_WORDS];
+static pid_slot_t *pid_dir[PID_DIR];
+static uint32_t pid_used;
+static bool pid_ready;
+
+static spinlock_t pid_lock = SPINLOCK_INIT;
+
+static DEFINE_MEMTAG(memtag_pid, "pid");
+
+_Static_assert(PID_MID_WORDS <= 64, "pid_top is a single word");
+
+static void pid_setup(void) {
+    for (size_t i = 0; i < PID_LEAF_WORDS; i++) pid_leaf[i] = ~0ULL;
+    for (size_t i = 0; i < PID_MID_WORDS; i++) pid_mid[i] = ~0ULL;
+    pid_top = PID_MID_WORDS == 64 ? ~0ULL : (1ULL << PID_MID_WORDS) - 1;
+    pid_leaf[0] &= ~1ULL; // Idle.
+    pid_ready = true;
+}
+
+static void pid_mark_free(uint32_t index) {
+    uint32_t leaf = index / 64;
+    pid_leaf[leaf] |= 1ULL << (index % 64);
+    pid_mid[leaf / 64] |= 1ULL << (leaf % 64);
+    pid_top |= 1ULL << (leaf / 64);
+}
+
+static void pid_mark_used(uint32_t index) {
+    uint32_t leaf = index / 64;
+    pid_leaf[leaf] &= ~(1ULL << (index % 64));
+    if (pid_leaf[leaf]) return;
+    pid_mid[leaf / 64] &= ~(1ULL << (leaf % 64));
+    if (pid_mid[leaf / 64]) return;
+    pid_top &= ~(1ULL << (leaf / 64));
+}
+
+// Also sets proc->pd, before anybody can look it up.
+int32_t pid_alloc(process_t *proc) {
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+    if (!pid_ready) pid_setup();
+    if (pid_top == 0)
+    {
+        spin_unlock_irqrestore(&pid_lock, flags);
+        return -1;
+    }
+
+    uint32_t mid = __builtin_ctzll(pid_top);
+    uint32_t leaf = mid * 64 + __builtin_ctzll(pid_mid[mid]);
+    uint32_t index = leaf * 64 + __builtin_ctzll(pid_leaf[leaf]);
+
+    pid_slot_t *page = pid_dir[index / PID_PER_PAGE];
+    if (page == NULL)
+    {
+        physaddr_t frame = alloc_page_noreclaim(&memtag_pid);
+        if (frame == 0)
+        {
+            spin_unlock_irqrestore(&pid_lock, flags);
+            return -1;
+        }
+        page = (pid_slot_t *)PHYS_TO_VIRT(frame);
+        memset(page, 0, PAGE_SIZE);
+        __atomic_store_n(&pid_dir[index / PID_PER_PAGE], page, __ATOMIC_RELEASE);
+    }
+
+    pid_mark_used(index);
+    pid_used++;
+    // Keep pds positive: the generation wraps within 15 bits.
+    pid_slot_t *slot = &page[index % PID_PER_PAGE];
+    uint32_t generation = ++slot->generation & 0x7FFF;
+    int32_t pd = (int32_t)((generation << PID_INDEX_BITS) | index);
+    proc->pd = pd;
+    __atomic_store_n(&slot->proc, proc, __ATOMIC_RELEASE);
+
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return pd;
+}
+
+void pid_free(int32_t pd) {
+    uint32_t index = PID_INDEX(pd);
+    if (pd <= 0 || index == 0) return;
+
+    uint64_t flags = spin_lock_irqsave(&pid_lock);
+    pid_slot_t *page = pid_dir[index / PID_PER_PAGE];
+    pid_slot_t *slot = page ? &page[index % PID_PER_PAGE] : NULL;
+    if (slot && slot->proc && slot->proc->pd == pd)
+    {
+        __atomic_store_n(&slot->proc, NULL, __ATOMIC_RELEASE);
+        pid_mark_free(index);
+        pid_used--;
+    }
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+// Without a lock: the caller has to know the process can't be freed under it.
+process_t *pid_lookup(int32_t pd) {
+    if (pd <= 0) return NULL;
+    pid_slot_t *page = __atomic_load_n(&pid_dir[PID_INDEX(pd) / PID_PER_PAGE], __ATOMIC_ACQUIRE);
+    if (page == NULL) return NULL;
+    process_t *proc = __atomic_load_n(&page[PID_INDEX(pd) % PID_PER_PAGE].proc, __ATOMIC_ACQUIRE);
+    return proc && proc->pd == pd ? proc : NULL;
+}
+
+uint32_t pid_count() {
+    return pid_used;
+}
@@ -0,0 +1,23 @@
+#ifndef PID_H
+#define PID_H
+
+#include "common/types.h"
+
+struct Process;
+
+// Process descriptors.
+// The low PID_INDEX_BITS of a pd pick a slot, the bits above count how often
+// that slot was handed out, so a stale pd never finds the wrong process.
+// Slots come from a three level bitmap: allocation, freeing and lookup are
+// all O(1). Pd 0 belongs to the idle threads and is never handed out.
+
+#define PID_INDEX_BITS 16
+#define PID_MAX        (1 << PID_INDEX_BITS) // Live processes.
+#define PID_INDEX(pd)  ((uint32_t)(pd) & (PID_MAX - 1))
+
+int32_t pid_alloc(struct Process *proc); // -1 when full.
+void pid_free(int32_t pd);
+struct Process *pid_lookup(int32_t pd);
+uint32_t pid_count();
+
+#endif
@@ -0,0 +1,181 @@
+#include "rcu.h"
+#include "wait.h"
+#include "workqueue.h"
+#include "tick.h"
+#include "printf.h"
+#include "common/isr.h"
+#include "common/spinlock.h"
+
+// One grace period at a time, numbered. gp_started > gp_completed while
+// one runs, qs_mask has the CPUs that still have to pass a quiescent
+// state in it. Callbacks wait in one list in call order, so their grace
+// period numbers only grow along it.
+static spinlock_t rcu_lock = SPINLOCK_INIT;
+static uint64_t rcu_gp_started;
+static uint64_t rcu_gp_completed;
+static uint64_t rcu_qs_mask;
+static rcu_head_t *rcu_waiting;
+static rcu_head_t **rcu_waiting_tail = &rcu_waiting;
+static rcu_head_t *rcu_done;
+static rcu_head_t **rcu_done_tail = &rcu_done;
+static uint64_t rcu_callbacks_run;
+
+static void rcu_do_callbacks(work_t *work);
+static DEFINE_WORK(rcu_work, rcu_do_callbacks);
+
+static inline bool rcu_gp_in_progress(void) {
+    return __atomic_load_n(&rcu_gp_started, __ATOMIC_ACQUIRE) != __atomic_load_n(&rcu_gp_completed, __ATOMIC_ACQUIRE);
+}
+
+static void rcu_gp_start(void);
+
+// Locked. Hands what waited for it to the worker, starts the next one if
+// anybody is waiting for that.
+static void rcu_gp_end(void) {
+    __atomic_store_n(&rcu_gp_completed, rcu_gp_started, __ATOMIC_RELEASE);
+
+    bool ready = false;
+    while (rcu_waiting && rcu_waiting->gp <= rcu_gp_completed)
+    {
+        rcu_head_t *head = rcu_waiting;
+        rcu_waiting = head->next;
+        head->next = NULL;
+        *rcu_done_tail = head;
+        rcu_done_tail = &head->next;
+        ready = true;
+    }
+    if (rcu_waiting == NULL) rcu_waiting_tail = &rcu_waiting;
+
+    if (ready) queue_work(&rcu_work);
+    if (rcu_waiting) rcu_gp_start();
+}
+
+// Locked. Idle CPUs are left out, they can't be reading right now and
+// anything they start reading later already sees the new version.
+static void rcu_gp_start(void) {
+    __atomic_store_n(&rcu_gp_started, rcu_gp_started + 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    uint64_t mask = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        if (!cpu_data[cpu].online || __atomic_load_n(&cpu_data[cpu].rcu_idle, __ATOMIC_SEQ_CST)) continue;
+        mask |= 1ULL << cpu;
+        tick_nohz_kick(cpu); // A stretched tick would hold the grace period up.
+    }
+    rcu_qs_mask = mask;
+    if (mask == 0) rcu_gp_end();
+}
+
+// This CPU is in a quiescent state: done with everything it read so far.
+static void rcu_report_qs(void) {
+    uint64_t gp = __atomic_load_n(&rcu_gp_started, __ATOMIC_ACQUIRE);
+    if (this_cpu_read(rcu_qs_gp) == gp || !rcu_gp_in_progress()) return;
+
+    uint32_t cpu = cpu_index();
+    uint64_t flags = spin_lock_irqsave(&rcu_lock);
+    if (rcu_gp_in_progress() && (rcu_qs_mask & (1ULL << cpu)))
+    {
+        rcu_qs_mask &= ~(1ULL << cpu);
+        if (rcu_qs_mask == 0) rcu_gp_end();
+    }
+    this_cpu_write(rcu_qs_gp, gp);
+    spin_unlock_irqrestore(&rcu_lock, flags);
+}
+
+void call_rcu(rcu_head_t *head, void (*fn)(rcu_head_t *head)) {
+    head->next = NULL;
+    head->fn = fn;
+
+    uint64_t flags = spin_lock_irqsave(&rcu_lock);
+    // The running grace period may have started after a reader picked up
+    // what's being retired, only the next one covers all of them.
+    head->gp = rcu_gp_started + 1;
+    *rcu_waiting_tail = head;
+    rcu_waiting_tail = &head->next;
+    if (!rcu_gp_in_progress()) rcu_gp_start();
+    spin_unlock_irqrestore(&rcu_lock, flags);
+}
+
+static void rcu_do_callbacks(work_t *work) {
+    (void)work;
+    uint64_t flags = spin_lock_irqsave(&rcu_lock);
+    rcu_head_t *head = rcu_done;
+    rcu_done = NULL;
+    rcu_done_tail = &rcu_done;
+    spin_unlock_irqrestore(&rcu_lock, flags);
+
+    while (head)
+    {
+        rcu_head_t *next = head->next;
+        head->fn(head);
+        __atomic_add_fetch(&rcu_callbacks_run, 1, __ATOMIC_RELAXED);
+        head = next;
+    }
+}
+
+typedef struct RcuSync
+{
+    rcu_head_t head;
+    completion_t done;
+} rcu_sync_t;
+
+static void rcu_sync_done(rcu_head_t *head) {
+    complete(&((rcu_sync_t *)head)->done);
+}
+
+void synchronize_rcu() {
+    rcu_sync_t sync;
+    completion_init(&sync.done);
+    call_rcu(&sync.head, rcu_sync_done);
+    wait_for_completion(&sync.done);
+}
+
+void rcu_read_unlock_special() {
+    uint64_t flags;
+    __asm__ __volatile__ ("pushfq; popq %0" : "=r"(flags));
+    if (flags & RFLAGS_IF) sched_preempt(); // Not from interrupt handlers.
+}
+
+void rcu_note_context_switch() {
+    __atomic_store_n(&this_cpu()->rcu_idle, 0, __ATOMIC_SEQ_CST);
+    rcu_report_qs();
+}
+
+bool rcu_needs_cpu() {
+    return rcu_gp_in_progress() && (__atomic_load_n(&rcu_qs_mask, __ATOMIC_RELAXED) & (1ULL << cpu_index()));
+}
+
+void rcu_idle_enter() {
+    rcu_report_qs();
+    __atomic_store_n(&this_cpu()->rcu_idle, 1, __ATOMIC_SEQ_CST);
+}
+
+void rcu_idle_exit() {
+    __atomic_store_n(&this_cpu()->rcu_idle, 0, __ATOMIC_SEQ_CST);
+}
+
+// Interrupts can come in from idle, where the CPU isn't being waited for
+// and so mustn't read either.
+void rcu_irq_enter() {
+    bool idle = __atomic_load_n(&this_cpu()->rcu_idle, __ATOMIC_RELAXED);
+    this_cpu_write(rcu_irq_from_idle, idle);
+    if (idle) rcu_idle_exit();
+}
+
+void rcu_irq_exit() {
+    if (this_cpu_read(rcu_irq_from_idle))
+    {
+        this_cpu_write(rcu_irq_from_idle, false);
+        rcu_idle_enter();
+    }
+    else if (this_cpu_read(rcu_nesting) == 0)
+    {
+        rcu_report_qs(); // Whatever we interrupted wasn't reading.
+    }
+}
+
+void rcu_dump_stats() {
+    printf_("rcu: %lu grace periods, %lu callbacks run%s\n", rcu_gp_completed, rcu_callbacks_run,
+            rcu_gp_in_progress() ? ", one in progress" : "");
+}
@@ -0,0 +1,121 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include "scheduler.h"
+#include "percpu.h"
+
+// Read-copy-update for read-mostly data. Readers walk the structure
+// between rcu_read_lock() and rcu_read_unlock(), which only bump a per-CPU
+// counter: no locks, no atomic writes, no shared cache lines. Updaters
+// (serialised among themselves by a lock of their own) publish new
+// versions with rcu_assign_pointer() and hand the old ones to call_rcu(),
+// which frees them once every reader that could still see them is gone.
+//
+// That is a grace period: every CPU has passed a quiescent state, a point
+// where it can't be inside a read-side section. They are reported on
+// context switches, at the end of interrupts (the tick included) that
+// didn't interrupt a reader, and when a CPU goes idle. Idle CPUs aren't
+// waited for at all.
+//
+// Read-side sections must not block and aren't preempted (a pending
+// preemption happens at rcu_read_unlock()). They nest, interrupt handlers
+// may use them too.
+
+typedef struct RcuHead
+{
+    struct RcuHead *next;
+    void (*fn)(struct RcuHead *head);
+    uint64_t gp; // Grace period that has to complete first.
+} rcu_head_t;
+
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_CONSUME)
+// Everything written to *v before is visible to readers that see it.
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+void rcu_read_unlock_special();
+
+static inline void rcu_read_lock() {
+    this_cpu_inc(rcu_nesting);
+    __asm__ __volatile__ ("" : : : "memory");
+}
+
+static inline void rcu_read_unlock() {
+    __asm__ __volatile__ ("" : : : "memory");
+    this_cpu_add(rcu_nesting, -1);
+    if (this_cpu_read(rcu_nesting) == 0 && sched_need_resched()) rcu_read_unlock_special();
+}
+
+static inline bool rcu_read_lock_held() {
+    return this_cpu_read(rcu_nesting) != 0;
+}
+
+// fn(head) runs after a grace period, in a workqueue worker (it may block).
+void call_rcu(rcu_head_t *head, void (*fn)(rcu_head_t *head));
+// Blocks until a full grace period has passed.
+void synchronize_rcu();
+
+// Scheduler and interrupt hooks, interrupts off.
+void rcu_note_context_switch(); // Entering schedule(), before any run queue lock.
+bool rcu_needs_cpu();           // This CPU holds up a grace period, keep the tick.
+void rcu_idle_enter();
+void rcu_idle_exit();
+void rcu_irq_enter();
+void rcu_irq_exit();
+
+void rcu_dump_stats();
+
+// Lists: readers follow next only, updaters unlink through pprev. A
+// removed node keeps its next so readers still on it can go on, it may be
+// freed (or reused) after a grace period.
+typedef struct RcuHlistNode
+{
+    struct RcuHlistNode *next;
+    struct RcuHlistNode **pprev;
+} rcu_hlist_node_t;
+
+typedef struct RcuHlistHead
+{
+    rcu_hlist_node_t *first;
+} rcu_hlist_head_t;
+
+#define RCU_HLIST_HEAD_INIT { NULL }
+#define rcu_hlist_entry(ptr, type, member) ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
+
+#define rcu_hlist_for_each(pos, head) \
+    for ((pos) = rcu_dereference((head)->first); (pos); (pos) = rcu_dereference((pos)->next))
+
+static inline void rcu_hlist_add_head(rcu_hlist_head_t *head, rcu_hlist_node_t *node) {
+    node->next = head->first;
+    node->pprev = &head->first;
+    if (head->first) head->first->pprev = &node->next;
+    rcu_assign_pointer(head->first, node);
+}
+
+static inline void rcu_hlist_add_behind(rcu_hlist_node_t *prev, rcu_hlist_node_t *node) {
+    node->next = prev->next;
+    node->pprev = &prev->next;
+    if (prev->next) prev->next->pprev = &node->next;
+    rcu_assign_pointer(prev->next, node);
+}
+
+static inline void rcu_hlist_del(rcu_hlist_node_t *node) {
+    if (node->pprev == NULL) return;
+    rcu_assign_pointer(*node->pprev, node->next);
+    if (node->next) node->next->pprev = node->pprev;
+    node->pprev = NULL;
+}
+
+// Readers see either the old node or the complete new one.
+static inline void rcu_hlist_replace(rcu_hlist_node_t *old, rcu_hlist_node_t *node) {
+    node->next = old->next;
+    node->pprev = old->pprev;
+    if (old->next) old->next->pprev = &node->next;
+    rcu_assign_pointer(*old->pprev, node);
+    old->pprev = NULL;
+}
+
+static inline bool rcu_hlist_unhashed(const rcu_hlist_node_t *node) {
+    return node->pprev == NULL;
+}
+
+#endif
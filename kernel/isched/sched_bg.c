@@ -0,0 +1,90 @@
+#include "sched_class.h"
+#include "timing.h"
+
+// Background class: one FIFO below the fair class. Its processes only get a
+// CPU nobody else wants and take turns every SCHED_BG_SLICE ticks; any
+// other runnable process preempts them right away.
+
+static void bg_enqueue(runqueue_t *rq, process_t *proc, int flags) {
+    (void)flags;
+    bg_rq_t *bg = &rq->bg;
+    proc->next = NULL;
+    proc->enqueued_at = get_jiffies();
+    if (bg->tail) bg->tail->next = proc;
+    else bg->head = proc;
+    bg->tail = proc;
+}
+
+static void bg_dequeue(runqueue_t *rq, process_t *proc, int flags) {
+    (void)flags;
+    bg_rq_t *bg = &rq->bg;
+    process_t *prev = NULL;
+    for (process_t *it = bg->head; it; prev = it, it = it->next)
+    {
+        if (it != proc) continue;
+        if (prev) prev->next = it->next;
+        else bg->head = it->next;
+        if (bg->tail == it) bg->tail = prev;
+        break;
+    }
+    proc->next = NULL;
+}
+
+static process_t *bg_pick_next(runqueue_t *rq) {
+    bg_rq_t *bg = &rq->bg;
+    process_t *proc = bg->head;
+    if (proc == NULL) return NULL;
+
+    bg->head = proc->next;
+    if (bg->head == NULL) bg->tail = NULL;
+    proc->next = NULL;
+    proc->wait_time += get_jiffies() - proc->enqueued_at;
+    proc->slice_left = SCHED_BG_SLICE;
+    return proc;
+}
+
+static void bg_put_prev(runqueue_t *rq, process_t *proc, bool runnable) {
+    if (runnable) bg_enqueue(rq, proc, 0);
+}
+
+static void bg_set_curr(runqueue_t *rq, process_t *proc) {
+    (void)rq;
+    proc->slice_left = SCHED_BG_SLICE;
+}
+
+static void bg_tick(runqueue_t *rq, process_t *curr) {
+    if (curr->slice_left) curr->slice_left--;
+    if (curr->slice_left == 0 && rq->bg.head) rq->need_resched = true;
+}
+
+static bool bg_wakeup_preempt(runqueue_t *rq, process_t *curr, process_t *woken) {
+    (void)rq;
+    (void)curr;
+    (void)woken;
+    return false;
+}
+
+static bool bg_has_ready(runqueue_t *rq) {
+    return rq->bg.head != NULL;
+}
+
+static process_t *bg_migration_candidate(runqueue_t *rq, uint32_t dst_cpu, bool allow_hot) {
+    for (process_t *proc = rq->bg.head; proc; proc = proc->next)
+        if (sched_can_migrate(proc, dst_cpu, allow_hot)) return proc;
+    return NULL;
+}
+
+const sched_class_t bg_sched_class = {
+    .name = "background",
+    .rank = 3,
+    .enqueue = bg_enqueue,
+    .dequeue = bg_dequeue,
+    .pick_next = bg_pick_next,
+    .put_prev = bg_put_prev,
+    .set_curr = bg_set_curr,
+    .tick = bg_tick,
+    .wakeup_preempt = bg_wakeup_preempt,
+    .has_ready = bg_has_ready,
+    .migration_candidate = bg_migration_candidate,
+    .next = NULL,
+};
@@ -0,0 +1,138 @@
+#ifndef SCHED_CLASS_H
+#define SCHED_CLASS_H
+
+#include "scheduler.h"
+#include "common/spinlock.h"
+#include "cpu.h"
+#include "timer.h"
+#include "hrtimer.h"
+
+// Scheduling classes. Each CPU has its own run queue and every class keeps
+// its part of it; the core asks the classes in rank order and runs the first
+// process it gets. The running process is never queued, classes get it back
+// via put_prev().
+// All class callbacks run with the run queue locked and interrupts off.
+
+#define ENQUEUE_WAKEUP   (1 << 0) // Coming back from sched_block().
+#define ENQUEUE_NEW      (1 << 1) // Freshly created.
+#define ENQUEUE_RESTORE  (1 << 2) // Moved between classes or re-weighted.
+#define ENQUEUE_MIGRATED (1 << 3) // Came from another CPU.
+
+#define DEQUEUE_MIGRATE  (1 << 0) // Going to another CPU.
+
+typedef struct RtQueue
+{
+    process_t *head[SCHED_PRIORITIES];
+    process_t *tail[SCHED_PRIORITIES];
+    uint64_t bitmap; // Non-empty priorities.
+
+    // Throttling, see SCHED_RT_RUNTIME:
+    uint64_t period_start; // jiffies
+    uint32_t used;         // Ticks the class ran this period.
+    bool throttled;
+    ktimer_t unthrottle;
+} rt_rq_t;
+
+typedef struct BackgroundQueue
+{
+    process_t *head;
+    process_t *tail;
+} bg_rq_t;
+
+typedef struct DeadlineQueue
+{
+    rb_tree_t ready;     // By absolute deadline.
+    rb_tree_t throttled; // By the start of their next period.
+    process_t *curr;
+    hrtimer_t replenish; // First throttled process gets its budget back.
+    hrtimer_t budget;    // Running process runs out of budget.
+    uint64_t misses;     // Periods that ended before the budget was used.
+} dl_rq_t;
+
+typedef struct FairQueue
+{
+    rb_tree_t tree;
+    uint64_t min_vruntime;
+    uint64_t load; // Weights of everything queued plus the running one.
+    uint32_t nr;
+    process_t *curr;
+} fair_rq_t;
+
+typedef struct RunQueue
+{
+    spinlock_t lock;
+    uint32_t cpu;
+    bool online;
+    volatile bool need_resched;
+
+    process_t *curr;
+    process_t *idle;   // Runs when nothing else can.
+    process_t *zombie; // Dead process whose stack we were still standing on.
+    process_t *push;   // Switched out, but may not stay here: off to its own CPU.
+    uint32_t nr_running; // Queued plus running, without the idle process.
+
+    dl_rq_t dl;
+    rt_rq_t rt;
+    fair_rq_t fair;
+    bg_rq_t bg;
+
+    uint64_t tsc_per_tick; // Measured by the tick itself.
+    uint64_t last_tick_tsc;
+    uint64_t next_balance; // jiffies
+
+    // Statistics:
+    uint64_t switches;
+    uint64_t pulled; // Processes this CPU took from others.
+} __attribute__((aligned(64))) runqueue_t;
+
+extern runqueue_t runqueues[MAX_CPUS];
+
+static inline runqueue_t *this_rq(void) { return this_cpu_read(rq); }
+static inline runqueue_t *cpu_rq(uint32_t cpu) { return &runqueues[cpu]; }
+
+typedef struct SchedClass
+{
+    const char *name;
+    int rank; // Lower ranks always run first.
+
+    void (*enqueue)(runqueue_t *rq, process_t *proc, int flags);
+    void (*dequeue)(runqueue_t *rq, process_t *proc, int flags);
+    process_t *(*pick_next)(runqueue_t *rq);
+    void (*put_prev)(runqueue_t *rq, process_t *proc, bool runnable);
+    void (*set_curr)(runqueue_t *rq, process_t *proc); // Adopt the running process (class change).
+    void (*tick)(runqueue_t *rq, process_t *curr);
+    bool (*wakeup_preempt)(runqueue_t *rq, process_t *curr, process_t *woken);
+    bool (*has_ready)(runqueue_t *rq);
+    // A queued process that may move to dst_cpu, NULL if there is none.
+    process_t *(*migration_candidate)(runqueue_t *rq, uint32_t dst_cpu, bool allow_hot);
+    // Optional. A blocked process from src wakes up on another CPU: what
+    // dequeue() does with DEQUEUE_MIGRATE, for one that isn't queued.
+    void (*migrate_sleeper)(runqueue_t *src, process_t *proc);
+
+    const struct SchedClass *next;
+} sched_class_t;
+
+extern const sched_class_t dl_sched_class;
+extern const sched_class_t rt_sched_class;
+extern const sched_class_t fair_sched_class;
+extern const sched_class_t bg_sched_class;
+
+extern uint32_t sched_time_slice;    // Real time class, in ticks.
+extern uint32_t sched_latency_ticks; // Fair class period.
+
+void fair_set_nice(process_t *proc, int nice); // Only updates the weight.
+void rt_rq_init(runqueue_t *rq);
+void dl_rq_init(runqueue_t *rq);
+void dl_set_params(process_t *proc, uint64_t runtime, uint64_t deadline, uint64_t period);
+bool dl_admit(process_t *proc, uint64_t runtime, uint64_t period); // Reserves the bandwidth.
+void dl_release(process_t *proc);
+
+// Core helpers for classes that queue processes from timers:
+runqueue_t *task_rq_lock(process_t *proc, uint64_t *flags);
+void check_preempt(runqueue_t *rq, process_t *proc);
+
+// Recently running processes still have their working set in this CPU's caches.
+bool sched_cache_hot(runqueue_t *rq, process_t *proc);
+bool sched_can_migrate(process_t *proc, uint32_t dst_cpu, bool allow_hot);
+
+#endif
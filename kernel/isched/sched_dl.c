@@ -0,0 +1,282 @@
+#include "sched_class.h"
+#include "clocksource.h"
+#include "smp.h"
+#include "timing.h"
+#include "percpu.h"
+
+// Deadline class: earliest deadline first over constant bandwidth servers.
+// Every process reserves runtime per period and is ordered by the absolute
+// deadline of its current period. Running out of budget throttles it until
+// its next period starts, so an overrunning process only ever delays
+// itself. Processes are partitioned: admission puts each one on a CPU whose
+// reserved utilisation stays below SCHED_DL_BW_LIMIT with it, and it stays
+// there. EDF on one CPU meets every deadline below full utilisation, so
+// that is what makes them meetable in the first place.
+
+#define DL_NONE      0
+#define DL_READY     1
+#define DL_THROTTLED 2
+
+static spinlock_t dl_bw_lock = SPINLOCK_INIT;
+static uint64_t dl_cpu_bw[MAX_CPUS];
+
+static inline uint64_t dl_next_period(const sched_dl_entity_t *dl) {
+    return dl->abs_deadline - dl->deadline + dl->period;
+}
+
+static bool dl_less(const rb_node_t *a, const rb_node_t *b) {
+    return rb_entry(a, sched_dl_entity_t, node)->abs_deadline < rb_entry(b, sched_dl_entity_t, node)->abs_deadline;
+}
+
+static bool dl_throttled_less(const rb_node_t *a, const rb_node_t *b) {
+    return dl_next_period(rb_entry(a, sched_dl_entity_t, node)) < dl_next_period(rb_entry(b, sched_dl_entity_t, node));
+}
+
+static inline process_t *dl_first(rb_tree_t *tree) {
+    rb_node_t *node = rb_first(tree);
+    return node ? rb_entry(node, process_t, dl.node) : NULL;
+}
+
+static void dl_arm_replenish(dl_rq_t *dlq) {
+    process_t *first = dl_first(&dlq->throttled);
+    if (first) hrtimer_start(&dlq->replenish, dl_next_period(&first->dl));
+    else hrtimer_cancel(&dlq->replenish);
+}
+
+static void dl_insert(runqueue_t *rq, process_t *proc) {
+    sched_dl_entity_t *dl = &proc->dl;
+    if (dl->throttled)
+    {
+        rb_insert(&rq->dl.throttled, &dl->node, dl_throttled_less);
+        dl->queued = DL_THROTTLED;
+        if (dl_first(&rq->dl.throttled) == proc) dl_arm_replenish(&rq->dl);
+    }
+    else
+    {
+        rb_insert(&rq->dl.ready, &dl->node, dl_less);
+        dl->queued = DL_READY;
+    }
+}
+
+static void dl_remove(runqueue_t *rq, process_t *proc) {
+    sched_dl_entity_t *dl = &proc->dl;
+    if (dl->queued == DL_READY) rb_erase(&rq->dl.ready, &dl->node);
+    else if (dl->queued == DL_THROTTLED) rb_erase(&rq->dl.throttled, &dl->node);
+    dl->queued = DL_NONE;
+}
+
+// Fresh budget and deadline for the period that has started by now.
+static void dl_replenish(runqueue_t *rq, sched_dl_entity_t *dl, uint64_t now) {
+    while (dl->runtime_left <= 0)
+    {
+        dl->abs_deadline += dl->period;
+        dl->runtime_left += dl->runtime;
+    }
+    if (dl->abs_deadline <= now)
+    {
+        // Fell behind by more than the overrun, start over.
+        rq->dl.misses++;
+        dl->abs_deadline = now + dl->deadline;
+        dl->runtime_left = dl->runtime;
+    }
+    dl->throttled = false;
+}
+
+// CBS wakeup rule: keep the current deadline unless the budget left would
+// let the process use more than its bandwidth until then.
+static void dl_update_on_wakeup(sched_dl_entity_t *dl, uint64_t now) {
+    if (dl->throttled) return;
+    bool overflow = dl->abs_deadline <= now || dl->runtime_left <= 0 ||
+                    (unsigned __int128)dl->runtime_left * dl->deadline > (unsigned __int128)dl->runtime * (dl->abs_deadline - now);
+    if (overflow)
+    {
+        dl->abs_deadline = now + dl->deadline;
+        dl->runtime_left = dl->runtime;
+    }
+}
+
+static void dl_update_curr(runqueue_t *rq) {
+    process_t *curr = rq->dl.curr;
+    if (curr == NULL) return;
+
+    sched_dl_entity_t *dl = &curr->dl;
+    uint64_t now = ktime_get_ns();
+    dl->runtime_left -= (int64_t)(now - dl->exec_start);
+    dl->exec_start = now;
+    if (dl->runtime_left > 0) return;
+
+    // Out of budget: throttle unless the next period has begun already.
+    if (dl_next_period(dl) <= now) dl_replenish(rq, dl, now);
+    else dl->throttled = true;
+    rq->need_resched = true;
+}
+
+static void dl_start_curr(runqueue_t *rq, process_t *proc) {
+    uint64_t now = ktime_get_ns();
+    proc->dl.exec_start = now;
+    rq->dl.curr = proc;
+    hrtimer_start(&rq->dl.budget, now + (uint64_t)MAX(proc->dl.runtime_left, 0));
+}
+
+static void dl_enqueue(runqueue_t *rq, process_t *proc, int flags) {
+    if (flags & (ENQUEUE_WAKEUP | ENQUEUE_NEW | ENQUEUE_RESTORE)) dl_update_on_wakeup(&proc->dl, ktime_get_ns());
+    proc->enqueued_at = get_jiffies();
+    dl_insert(rq, proc);
+}
+
+static void dl_dequeue(runqueue_t *rq, process_t *proc, int flags) {
+    (void)flags;
+    bool first = proc->dl.queued == DL_THROTTLED && dl_first(&rq->dl.throttled) == proc;
+    dl_remove(rq, proc);
+    if (first) dl_arm_replenish(&rq->dl);
+}
+
+static process_t *dl_pick_next(runqueue_t *rq) {
+    process_t *proc = dl_first(&rq->dl.ready);
+    if (proc == NULL) return NULL;
+
+    dl_remove(rq, proc);
+    proc->wait_time += get_jiffies() - proc->enqueued_at;
+    dl_start_curr(rq, proc);
+    return proc;
+}
+
+static void dl_put_prev(runqueue_t *rq, process_t *proc, bool runnable) {
+    dl_update_curr(rq);
+    hrtimer_cancel(&rq->dl.budget);
+    rq->dl.curr = NULL;
+    if (runnable)
+    {
+        proc->enqueued_at = get_jiffies();
+        dl_insert(rq, proc);
+    }
+}
+
+static void dl_set_curr(runqueue_t *rq, process_t *proc) {
+    dl_update_on_wakeup(&proc->dl, ktime_get_ns());
+    dl_start_curr(rq, proc);
+}
+
+static void dl_tick(runqueue_t *rq, process_t *curr) {
+    dl_update_curr(rq);
+    process_t *first = dl_first(&rq->dl.ready);
+    if (first && first->dl.abs_deadline < curr->dl.abs_deadline) rq->need_resched = true;
+}
+
+static bool dl_wakeup_preempt(runqueue_t *rq, process_t *curr, process_t *woken) {
+    (void)rq;
+    return woken->dl.queued == DL_READY && woken->dl.abs_deadline < curr->dl.abs_deadline;
+}
+
+static bool dl_has_ready(runqueue_t *rq) {
+    return !rb_empty(&rq->dl.ready);
+}
+
+static process_t *dl_migration_candidate(runqueue_t *rq, uint32_t dst_cpu, bool allow_hot) {
+    for (rb_node_t *node = rb_first(&rq->dl.ready); node; node = rb_next(node))
+    {
+        process_t *proc = rb_entry(node, process_t, dl.node);
+        if (sched_can_migrate(proc, dst_cpu, allow_hot)) return proc;
+    }
+    return NULL;
+}
+
+// Hands budgets back to every throttled process whose period has started.
+static void dl_replenish_timer(hrtimer_t *timer) {
+    runqueue_t *rq = timer->data;
+    spin_lock(&rq->lock);
+
+    uint64_t now = ktime_get_ns();
+    process_t *proc;
+    while ((proc = dl_first(&rq->dl.throttled)) && dl_next_period(&proc->dl) <= now)
+    {
+        dl_remove(rq, proc);
+        dl_replenish(rq, &proc->dl, now);
+        dl_insert(rq, proc);
+        check_preempt(rq, proc);
+    }
+    dl_arm_replenish(&rq->dl);
+    spin_unlock(&rq->lock);
+}
+
+// The tick may be stretched or far too coarse for small budgets.
+static void dl_budget_timer(hrtimer_t *timer) {
+    runqueue_t *rq = timer->data;
+    spin_lock(&rq->lock);
+    dl_update_curr(rq);
+    // Started by whoever moved the process into the class, maybe elsewhere.
+    if (rq->need_resched && rq != this_rq()) smp_send_resched(rq->cpu);
+    spin_unlock(&rq->lock);
+}
+
+void dl_rq_init(runqueue_t *rq) {
+    hrtimer_setup(&rq->dl.replenish, dl_replenish_timer, rq);
+    hrtimer_set_slack(&rq->dl.replenish, 0);
+    hrtimer_setup(&rq->dl.budget, dl_budget_timer, rq);
+    hrtimer_set_slack(&rq->dl.budget, 0);
+}
+
+void dl_set_params(process_t *proc, uint64_t runtime, uint64_t deadline, uint64_t period) {
+    sched_dl_entity_t *dl = &proc->dl;
+    dl->runtime = runtime;
+    dl->deadline = deadline;
+    dl->period = period;
+    dl->abs_deadline = 0; // Starts a new period when it gets queued.
+    dl->runtime_left = 0;
+    dl->throttled = false;
+}
+
+// Stays on the CPU it already has a reservation on if that one still has
+// room, otherwise goes to the least reserved one it may run on.
+bool dl_admit(process_t *proc, uint64_t runtime, uint64_t period) {
+    uint64_t bw = (runtime << SCHED_DL_BW_SHIFT) / period;
+    uint64_t flags = spin_lock_irqsave(&dl_bw_lock);
+
+    int32_t best = -1;
+    uint64_t best_total = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        if (!cpu_data[cpu].online || !(proc->cpus_allowed & (1ULL << cpu))) continue;
+        bool ours = proc->dl.bw && proc->dl.cpu == cpu;
+        uint64_t total = dl_cpu_bw[cpu] - (ours ? proc->dl.bw : 0) + bw;
+        if (total > SCHED_DL_BW_LIMIT) continue;
+        if (ours || best < 0 || total < best_total)
+        {
+            best = (int32_t)cpu;
+            best_total = total;
+        }
+        if (ours) break;
+    }
+
+    if (best >= 0)
+    {
+        if (proc->dl.bw) dl_cpu_bw[proc->dl.cpu] -= proc->dl.bw;
+        dl_cpu_bw[best] += bw;
+        proc->dl.bw = bw;
+        proc->dl.cpu = (uint32_t)best;
+    }
+    spin_unlock_irqrestore(&dl_bw_lock, flags);
+    return best >= 0;
+}
+
+void dl_release(process_t *proc) {
+    uint64_t flags = spin_lock_irqsave(&dl_bw_lock);
+    if (proc->dl.bw) dl_cpu_bw[proc->dl.cpu] -= proc->dl.bw;
+    proc->dl.bw = 0;
+    spin_unlock_irqrestore(&dl_bw_lock, flags);
+}
+
+const sched_class_t dl_sched_class = {
+    .name = "deadline",
+    .rank = 0,
+    .enqueue = dl_enqueue,
+    .dequeue = dl_dequeue,
+    .pick_next = dl_pick_next,
+    .put_prev = dl_put_prev,
+    .set_curr = dl_set_curr,
+    .tick = dl_tick,
+    .wakeup_preempt = dl_wakeup_preempt,
+    .has_ready = dl_has_ready,
+    .migration_candidate = dl_migration_candidate,
+    .next = &rt_sched_class,
+};
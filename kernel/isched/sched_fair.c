@@ -0,0 +1,232 @@
+#include "sched_class.h"
+#include "timing.h"
+
+// Fair class: ready processes sit in a red-black tree ordered by virtual
+// runtime (real runtime scaled by their weight), the leftmost one runs next.
+// Within one latency period every runnable process gets a share of the CPU
+// proportional to its weight. Waking processes get placed close to the
+// minimum vruntime, so a sleeper gets the CPU quickly without being able to
+// bank unlimited credit. The policy (see ESchedPolicy) bends these rules:
+// interactive processes get half slices, a full period of wakeup credit and
+// preempt at half the granularity; batch processes get four times the slice,
+// no wakeup credit and never preempt on wakeup.
+
+#define NICE_0_LOAD 1024
+#define FAIR_MIGRATION_SCAN 32 // Candidates looked at per migration attempt.
+
+// Every nice level is ~10% more/less CPU than its neighbour.
+static const uint32_t nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+     9548,  7620,  6100,  4904,  3906,
+     3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,
+      335,   272,   215,   172,   137,
+      110,    87,    70,    56,    45,
+       36,    29,    23,    18,    15,
+};
+
+static bool fair_less(const rb_node_t *a, const rb_node_t *b) {
+    // Signed difference, vruntimes are allowed to wrap.
+    return (int64_t)(rb_entry(a, sched_entity_t, node)->vruntime - rb_entry(b, sched_entity_t, node)->vruntime) < 0;
+}
+
+static inline process_t *fair_leftmost(fair_rq_t *fair) {
+    rb_node_t *node = rb_first(&fair->tree);
+    return node ? rb_entry(node, process_t, se.node) : NULL;
+}
+
+static inline uint64_t fair_latency(runqueue_t *rq) { return sched_latency_ticks * rq->tsc_per_tick; }
+static inline uint64_t fair_min_granularity(runqueue_t *rq) { return fair_latency(rq) / 8; }
+static inline uint64_t fair_wakeup_granularity(runqueue_t *rq) { return fair_latency(rq) / 6; }
+
+static inline uint64_t fair_scale(uint64_t delta, const sched_entity_t *se) {
+    return se->weight == NICE_0_LOAD ? delta : delta * NICE_0_LOAD / se->weight;
+}
+
+static void fair_update_min_vruntime(fair_rq_t *fair) {
+    uint64_t vruntime = fair->min_vruntime;
+    process_t *left = fair_leftmost(fair);
+
+    if (fair->curr) vruntime = fair->curr->se.vruntime;
+    if (left && (!fair->curr || (int64_t)(left->se.vruntime - vruntime) < 0)) vruntime = left->se.vruntime;
+
+    // Never goes backwards:
+    if ((int64_t)(vruntime - fair->min_vruntime) > 0) fair->min_vruntime = vruntime;
+}
+
+static void fair_update_curr(fair_rq_t *fair) {
+    if (fair->curr == NULL) return;
+
+    sched_entity_t *se = &fair->curr->se;
+    uint64_t now = rdtsc();
+    uint64_t delta = now - se->exec_start;
+    se->exec_start = now;
+
+    se->sum_exec += delta;
+    se->vruntime += fair_scale(delta, se);
+    fair_update_min_vruntime(fair);
+}
+
+// This process's share of the current period.
+static uint64_t fair_slice(runqueue_t *rq, const sched_entity_t *se) {
+    fair_rq_t *fair = &rq->fair;
+    uint64_t period = fair_latency(rq);
+    uint64_t min_gran = fair_min_granularity(rq);
+    if (min_gran && fair->nr > period / min_gran) period = fair->nr * min_gran;
+    uint64_t slice = fair->load ? period * se->weight / fair->load : period;
+
+    if (se->policy == SCHED_INTERACTIVE) slice /= 2;
+    else if (se->policy == SCHED_BATCH) slice *= 4;
+    return slice;
+}
+
+static void fair_place(runqueue_t *rq, sched_entity_t *se, int flags) {
+    uint64_t vruntime = rq->fair.min_vruntime;
+
+    if (flags & ENQUEUE_NEW)
+    {
+        // New processes start at the end of the current period, so that
+        // forking in a loop can't take over the CPU.
+        vruntime += fair_slice(rq, se);
+    }
+    else if (flags & ENQUEUE_WAKEUP)
+    {
+        // Sleepers get at most half a period of credit.
+        if (se->policy == SCHED_INTERACTIVE) vruntime -= fair_latency(rq);
+        else if (se->policy != SCHED_BATCH) vruntime -= fair_latency(rq) / 2;
+    }
+
+    if ((flags & ENQUEUE_NEW) || (int64_t)(vruntime - se->vruntime) > 0) se->vruntime = vruntime;
+}
+
+static void fair_enqueue(runqueue_t *rq, process_t *proc, int flags) {
+    fair_rq_t *fair = &rq->fair;
+    sched_entity_t *se = &proc->se;
+
+    // Migrating processes carry their vruntime relative to the old queue.
+    if (flags & ENQUEUE_MIGRATED) se->vruntime += fair->min_vruntime;
+    if (flags & (ENQUEUE_NEW | ENQUEUE_WAKEUP | ENQUEUE_RESTORE)) fair_place(rq, se, flags);
+
+    proc->enqueued_at = get_jiffies();
+    fair->load += se->weight;
+    fair->nr++;
+    rb_insert(&fair->tree, &se->node, fair_less);
+}
+
+static void fair_dequeue(runqueue_t *rq, process_t *proc, int flags) {
+    fair_rq_t *fair = &rq->fair;
+    rb_erase(&fair->tree, &proc->se.node);
+    fair->load -= proc->se.weight;
+    fair->nr--;
+    fair_update_min_vruntime(fair);
+    if (flags & DEQUEUE_MIGRATE) proc->se.vruntime -= fair->min_vruntime;
+}
+
+static void fair_migrate_sleeper(runqueue_t *src, process_t *proc) {
+    proc->se.vruntime -= src->fair.min_vruntime;
+}
+
+static process_t *fair_pick_next(runqueue_t *rq) {
+    fair_rq_t *fair = &rq->fair;
+    process_t *proc = fair_leftmost(fair);
+    if (proc == NULL) return NULL;
+
+    // The running process stays accounted in load/nr, just not in the tree.
+    rb_erase(&fair->tree, &proc->se.node);
+    proc->wait_time += get_jiffies() - proc->enqueued_at;
+    proc->se.exec_start = rdtsc();
+    proc->se.prev_sum_exec = proc->se.sum_exec;
+    fair->curr = proc;
+    return proc;
+}
+
+static void fair_put_prev(runqueue_t *rq, process_t *proc, bool runnable) {
+    fair_rq_t *fair = &rq->fair;
+    fair_update_curr(fair);
+    fair->curr = NULL;
+
+    if (runnable)
+    {
+        proc->enqueued_at = get_jiffies();
+        rb_insert(&fair->tree, &proc->se.node, fair_less);
+    }
+    else
+    {
+        fair->load -= proc->se.weight;
+        fair->nr--;
+    }
+}
+
+static void fair_set_curr(runqueue_t *rq, process_t *proc) {
+    fair_rq_t *fair = &rq->fair;
+    fair_place(rq, &proc->se, ENQUEUE_RESTORE);
+    fair->load += proc->se.weight;
+    fair->nr++;
+    proc->se.exec_start = rdtsc();
+    proc->se.prev_sum_exec = proc->se.sum_exec;
+    fair->curr = proc;
+}
+
+static void fair_tick(runqueue_t *rq, process_t *curr) {
+    fair_update_curr(&rq->fair);
+
+    uint64_t ideal = fair_slice(rq, &curr->se);
+    if (curr->se.sum_exec - curr->se.prev_sum_exec > ideal)
+    {
+        rq->need_resched = true;
+        return;
+    }
+
+    process_t *left = fair_leftmost(&rq->fair);
+    if (left && (int64_t)(curr->se.vruntime - left->se.vruntime) > (int64_t)ideal) rq->need_resched = true;
+}
+
+static bool fair_wakeup_preempt(runqueue_t *rq, process_t *curr, process_t *woken) {
+    if (woken->se.policy == SCHED_BATCH) return false;
+    fair_update_curr(&rq->fair);
+
+    uint64_t gran = fair_wakeup_granularity(rq);
+    if (woken->se.policy == SCHED_INTERACTIVE) gran /= 2;
+    if (curr->se.policy == SCHED_BATCH) gran /= 2;
+    // Only worth a switch when the woken process is clearly behind.
+    return (int64_t)(curr->se.vruntime - woken->se.vruntime) > (int64_t)fair_scale(gran, &woken->se);
+}
+
+static bool fair_has_ready(runqueue_t *rq) {
+    return !rb_empty(&rq->fair.tree);
+}
+
+// Leftmost first, it has been waiting the longest.
+static process_t *fair_migration_candidate(runqueue_t *rq, uint32_t dst_cpu, bool allow_hot) {
+    rb_node_t *node = rb_first(&rq->fair.tree);
+    for (int scanned = 0; node && scanned < FAIR_MIGRATION_SCAN; node = rb_next(node), scanned++)
+    {
+        process_t *proc = rb_entry(node, process_t, se.node);
+        if (sched_can_migrate(proc, dst_cpu, allow_hot)) return proc;
+    }
+    return NULL;
+}
+
+void fair_set_nice(process_t *proc, int nice) {
+    if (nice < NICE_MIN) nice = NICE_MIN;
+    if (nice > NICE_MAX) nice = NICE_MAX;
+    proc->se.nice = (int8_t)nice;
+    proc->se.weight = nice_to_weight[nice - NICE_MIN];
+}
+
+const sched_class_t fair_sched_class = {
+    .name = "fair",
+    .rank = 2,
+    .enqueue = fair_enqueue,
+    .dequeue = fair_dequeue,
+    .pick_next = fair_pick_next,
+    .put_prev = fair_put_prev,
+    .set_curr = fair_set_curr,
+    .tick = fair_tick,
+    .wakeup_preempt = fair_wakeup_preempt,
+    .has_ready = fair_has_ready,
+    .migration_candidate = fair_migration_candidate,
+    .migrate_sleeper = fair_migrate_sleeper,
+    .next = &bg_sched_class,
+};
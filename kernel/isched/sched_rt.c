@@ -0,0 +1,141 @@
+#include "sched_class.h"
+#include "timing.h"
+
+// Real time class: one FIFO per priority plus a bitmap of the non-empty ones,
+// so picking the next process is a single bit scan. Processes of the same
+// priority take turns every sched_time_slice ticks. Once the class has used
+// SCHED_RT_RUNTIME ticks of a SCHED_RT_PERIOD it is throttled on this CPU
+// until the period ends, lower classes get the rest.
+
+// Starts a new period when the old one is over. True while throttled.
+static bool rt_throttled(runqueue_t *rq) {
+    rt_rq_t *rt = &rq->rt;
+    uint64_t now = get_jiffies();
+    if (now - rt->period_start >= SCHED_RT_PERIOD)
+    {
+        rt->period_start = now;
+        rt->used = 0;
+        rt->throttled = false;
+    }
+    return rt->throttled;
+}
+
+static void rt_unthrottle(ktimer_t *timer) {
+    runqueue_t *rq = timer->data;
+    rq->need_resched = true; // The idle loop or whoever runs has another look.
+}
+
+void rt_rq_init(runqueue_t *rq) {
+    rq->rt.period_start = get_jiffies();
+    timer_setup(&rq->rt.unthrottle, rt_unthrottle, rq);
+}
+
+static void rt_enqueue(runqueue_t *rq, process_t *proc, int flags) {
+    (void)flags;
+    rt_rq_t *rt = &rq->rt;
+    uint8_t prio = proc->priority;
+    proc->next = NULL;
+    proc->enqueued_at = get_jiffies();
+
+    if (rt->tail[prio]) rt->tail[prio]->next = proc;
+    else rt->head[prio] = proc;
+    rt->tail[prio] = proc;
+    rt->bitmap |= 1ULL << prio;
+}
+
+static void rt_dequeue(runqueue_t *rq, process_t *proc, int flags) {
+    (void)flags;
+    rt_rq_t *rt = &rq->rt;
+    uint8_t prio = proc->priority;
+    process_t *prev = NULL;
+    for (process_t *it = rt->head[prio]; it; prev = it, it = it->next)
+    {
+        if (it != proc) continue;
+        if (prev) prev->next = it->next;
+        else rt->head[prio] = it->next;
+        if (rt->tail[prio] == it) rt->tail[prio] = prev;
+        break;
+    }
+    if (rt->head[prio] == NULL) rt->bitmap &= ~(1ULL << prio);
+    proc->next = NULL;
+}
+
+static process_t *rt_pick_next(runqueue_t *rq) {
+    rt_rq_t *rt = &rq->rt;
+    if (rt->bitmap == 0 || rt_throttled(rq)) return NULL;
+
+    uint8_t prio = (uint8_t)__builtin_ctzll(rt->bitmap);
+    process_t *proc = rt->head[prio];
+    rt->head[prio] = proc->next;
+    if (rt->head[prio] == NULL)
+    {
+        rt->tail[prio] = NULL;
+        rt->bitmap &= ~(1ULL << prio);
+    }
+
+    proc->next = NULL;
+    proc->wait_time += get_jiffies() - proc->enqueued_at;
+    proc->slice_left = sched_time_slice;
+    return proc;
+}
+
+static void rt_put_prev(runqueue_t *rq, process_t *proc, bool runnable) {
+    if (runnable) rt_enqueue(rq, proc, 0);
+}
+
+static void rt_set_curr(runqueue_t *rq, process_t *proc) {
+    (void)rq;
+    proc->slice_left = sched_time_slice;
+}
+
+static void rt_tick(runqueue_t *rq, process_t *curr) {
+    rt_rq_t *rt = &rq->rt;
+    if (!rt_throttled(rq) && ++rt->used >= SCHED_RT_RUNTIME)
+    {
+        rt->throttled = true;
+        rq->need_resched = true;
+        timer_add(&rt->unthrottle, rt->period_start + SCHED_RT_PERIOD);
+        return;
+    }
+
+    if (curr->slice_left) curr->slice_left--;
+    if (curr->slice_left == 0) rq->need_resched = true;
+    if (rq->rt.bitmap && __builtin_ctzll(rq->rt.bitmap) < curr->priority) rq->need_resched = true;
+}
+
+static bool rt_wakeup_preempt(runqueue_t *rq, process_t *curr, process_t *woken) {
+    (void)rq;
+    return woken->priority < curr->priority;
+}
+
+static bool rt_has_ready(runqueue_t *rq) {
+    return rq->rt.bitmap != 0 && !rt_throttled(rq);
+}
+
+// Most important process first, it is the one that suffers most from waiting.
+static process_t *rt_migration_candidate(runqueue_t *rq, uint32_t dst_cpu, bool allow_hot) {
+    uint64_t bitmap = rq->rt.bitmap;
+    while (bitmap)
+    {
+        uint8_t prio = (uint8_t)__builtin_ctzll(bitmap);
+        bitmap &= bitmap - 1;
+        for (process_t *proc = rq->rt.head[prio]; proc; proc = proc->next)
+            if (sched_can_migrate(proc, dst_cpu, allow_hot)) return proc;
+    }
+    return NULL;
+}
+
+const sched_class_t rt_sched_class = {
+    .name = "rt",
+    .rank = 1,
+    .enqueue = rt_enqueue,
+    .dequeue = rt_dequeue,
+    .pick_next = rt_pick_next,
+    .put_prev = rt_put_prev,
+    .set_curr = rt_set_curr,
+    .tick = rt_tick,
+    .wakeup_preempt = rt_wakeup_preempt,
+    .has_ready = rt_has_ready,
+    .migration_candidate = rt_migration_candidate,
+    .next = &fair_sched_class,
+};
@@ -1,57 +1,931 @@
 #include "scheduler.h"
+#include "sched_class.h"
+#include "common/memory.h"
+#include "common/memtag.h"
+#include "common/spinlock.h"
+#include "common/slab.h"
+#include "pid.h"
+#include "timing.h"
+#include "cpu.h"
+#include "smp.h"
+#include "fpu.h"
+#include "tick.h"
+#include "timer.h"
+#include "hrtimer.h"
+#include "clocksource.h"
+#include "workqueue.h"
+#include "rcu.h"
 
-process_t simultaenous_processes[MAX_AMOUNT_OF_PROCESSES];
+#define SCHED_BALANCE_INTERVAL 20 // Ticks between periodic balancing runs.
+#define SCHED_MAX_PULL         8  // Processes moved per periodic run.
+#define KSTACK_CACHE           8  // Free kernel stacks kept per CPU.
+#define KSTACK_DEPOT           64 // And shared, for those freed on another CPU than they get reused on.
 
 uint32_t process_amount = 0;
 
-ctx_t jump_context; // The Context, where to jump.
-ctx_t jump_back_context; // The Old Context, where to return.
+uint32_t sched_time_slice = SCHED_DEFAULT_SLICE;
+uint32_t sched_latency_ticks = SCHED_DEFAULT_LATENCY;
 
-bool interrupted = false;
+runqueue_t runqueues[MAX_CPUS];
 
-void switch_context() {
-    save_context(&jump_context, &&back_point);
-    restore_context(&jump_back_context);
+static DEFINE_MEMTAG(memtag_kstack, "kstack");
+static DEFINE_KMEM_CACHE(process_cache, "process", process_t);
 
-back_point:
-    return;
+// Kernel stacks get recycled rather than going back to the frame allocator,
+// which has to search its bitmap for a free run of KSTACK_PAGES each time.
+// Cached ones stay charged to memtag_kstack.
+typedef struct KstackCache
+{
+    uint32_t count;
+    void *stacks[KSTACK_CACHE];
+} __attribute__((aligned(64))) kstack_cache_t;
+
+static kstack_cache_t kstack_caches[MAX_CPUS];
+static spinlock_t kstack_depot_lock = SPINLOCK_INIT;
+static void *kstack_depot; // Linked through their first word.
+static uint32_t kstack_depot_count;
+
+static const sched_class_t *const sched_class_highest = &dl_sched_class;
+
+static void rq_init(runqueue_t *rq, uint32_t cpu, process_t *idle) {
+    spin_lock_init(&rq->lock);
+    rq->cpu = cpu;
+    rq->idle = idle;
+    rq->curr = idle;
+    rq->tsc_per_tick = 1000000000ULL / TIMER_HZ; // Until the first two ticks arrive assume a 1 GHz TSC.
+    rq->next_balance = get_jiffies() + SCHED_BALANCE_INTERVAL;
+    this_cpu_write(rq, rq); // Runs on the CPU it sets up.
+    this_cpu_write(curr, idle);
+    fpu_adopt(idle);
+    rt_rq_init(rq);
+    dl_rq_init(rq);
+
+    idle->cpu = cpu;
+    idle->cpus_allowed = 1ULL << cpu;
+    idle->type = KERNEL;
+    idle->is_running = true;
+    idle->state = PROC_RUNNING;
+    idle->sched_class = NULL;
+    idle->priority = SCHED_PRIORITIES - 1;
+    idle->kstack = NULL; // Whatever stack the CPU was booted on.
+
+    __atomic_store_n(&rq->online, true, __ATOMIC_RELEASE);
+}
+
+bool sched_need_resched() {
+    return this_rq()->need_resched;
+}
+
+static void resched(runqueue_t *rq) {
+    rq->need_resched = true;
+    if (rq != this_rq()) smp_send_resched(rq->cpu);
+}
+
+// Locks two run queues in CPU order, so that nobody can deadlock on them.
+static void double_rq_lock(runqueue_t *a, runqueue_t *b) {
+    if (a == b)
+    {
+        spin_lock(&a->lock);
+    }
+    else if (a->cpu < b->cpu)
+    {
+        spin_lock(&a->lock);
+        spin_lock(&b->lock);
+    }
+    else
+    {
+        spin_lock(&b->lock);
+        spin_lock(&a->lock);
+    }
+}
+
+static void double_rq_unlock(runqueue_t *a, runqueue_t *b) {
+    spin_unlock(&a->lock);
+    if (a != b) spin_unlock(&b->lock);
+}
+
+// With one queue already held we may only wait for queues that come after it.
+static bool lock_second(runqueue_t *held, runqueue_t *other) {
+    if (other->cpu > held->cpu)
+    {
+        spin_lock(&other->lock);
+        return true;
+    }
+    return spin_trylock(&other->lock);
+}
+
+// The process can move between queues while we wait for the lock.
+runqueue_t *task_rq_lock(process_t *proc, uint64_t *flags) {
+    for (;;)
+    {
+        *flags = irq_save();
+        runqueue_t *rq = cpu_rq(proc->cpu);
+        spin_lock(&rq->lock);
+        if (rq == cpu_rq(proc->cpu)) return rq;
+        spin_unlock(&rq->lock);
+        irq_restore(*flags);
+    }
+}
+
+static void enqueue_task(runqueue_t *rq, process_t *proc, int flags) {
+    proc->cpu = rq->cpu;
+    proc->sched_class->enqueue(rq, proc, flags);
+    proc->state = PROC_READY;
+    if (++rq->nr_running == 2) tick_nohz_kick(rq->cpu); // Time slicing again.
+}
+
+static void dequeue_task(runqueue_t *rq, process_t *proc, int flags) {
+    proc->sched_class->dequeue(rq, proc, flags);
+    rq->nr_running--;
+}
+
+// Should the freshly queued process run instead of the current one?
+void check_preempt(runqueue_t *rq, process_t *proc) {
+    process_t *curr = rq->curr;
+    if (curr == rq->idle || proc->sched_class->rank < curr->sched_class->rank) resched(rq);
+    else if (proc->sched_class == curr->sched_class && proc->sched_class->wakeup_preempt(rq, curr, proc)) resched(rq);
+}
+
+bool sched_cache_hot(runqueue_t *rq, process_t *proc) {
+    return proc->last_ran && rdtsc() - proc->last_ran < rq->tsc_per_tick / 2;
+}
+
+// Affinity, narrowed down to its one CPU for an admitted deadline process.
+static inline bool cpu_allowed(const process_t *proc, uint32_t cpu) {
+    if (proc->dl.bw) return proc->dl.cpu == cpu;
+    return proc->cpus_allowed & (1ULL << cpu);
+}
+
+bool sched_can_migrate(process_t *proc, uint32_t dst_cpu, bool allow_hot) {
+    if (!cpu_allowed(proc, dst_cpu)) return false;
+    return allow_hot || !sched_cache_hot(cpu_rq(proc->cpu), proc);
+}
+
+// Wakees go back to the CPU they last ran on while it is allowed, idle CPUs
+// steal them from there if it stays busy.
+static uint32_t select_task_cpu(process_t *proc) {
+    uint32_t cpu = proc->cpu;
+    if (cpu_allowed(proc, cpu) && cpu_rq(cpu)->online) return cpu;
+
+    for (cpu = 0; cpu < MAX_CPUS; cpu++)
+        if (cpu_allowed(proc, cpu) && cpu_rq(cpu)->online) return cpu;
+    return proc->cpu;
+}
+
+// Both queues locked.
+static uint32_t pull_tasks(runqueue_t *rq, runqueue_t *src, uint32_t count, bool allow_hot) {
+    uint32_t moved = 0;
+    while (moved < count)
+    {
+        process_t *proc = NULL;
+        for (const sched_class_t *cls = sched_class_highest; cls && proc == NULL; cls = cls->next)
+            proc = cls->migration_candidate(src, rq->cpu, allow_hot);
+        if (proc == NULL) break;
+
+        dequeue_task(src, proc, DEQUEUE_MIGRATE);
+        enqueue_task(rq, proc, ENQUEUE_MIGRATED);
+        check_preempt(rq, proc);
+        moved++;
+    }
+    return moved;
+}
+
+static runqueue_t *find_busiest(runqueue_t *rq) {
+    runqueue_t *busiest = NULL;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        runqueue_t *other = cpu_rq(cpu);
+        if (other == rq || !__atomic_load_n(&other->online, __ATOMIC_ACQUIRE)) continue;
+        if (busiest == NULL || other->nr_running > busiest->nr_running) busiest = other;
+    }
+    return busiest;
+}
+
+// rq is locked. An idle CPU takes whatever it can get, the periodic run
+// only evens out real imbalance and leaves cache hot processes alone.
+static uint32_t load_balance(runqueue_t *rq, bool idle) {
+    runqueue_t *busiest = find_busiest(rq);
+    if (busiest == NULL) return 0;
+
+    uint32_t imbalance = busiest->nr_running > rq->nr_running ? busiest->nr_running - rq->nr_running : 0;
+    if (idle ? busiest->nr_running < 2 : imbalance < 2) return 0;
+    if (!lock_second(rq, busiest)) return 0;
+
+    uint32_t moved = pull_tasks(rq, busiest, idle ? 1 : MIN(imbalance / 2, SCHED_MAX_PULL), false);
+    if (moved == 0 && idle) moved = pull_tasks(rq, busiest, 1, true); // A cold cache beats an idle CPU.
+
+    spin_unlock(&busiest->lock);
+    rq->pulled += moved;
+    return moved;
 }
 
-void switch_back_context() {
-    save_context(&jump_back_context, &&back_point);
-    restore_context(&jump_context); 
+// Tickless idle CPUs don't balance on their own, wake one up to pull from us.
+static void nohz_balance_kick(runqueue_t *busy) {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        runqueue_t *rq = cpu_rq(cpu);
+        if (rq == busy || !rq->online || rq->nr_running || cpu_data[cpu].tick_state != TICK_STOPPED) continue;
+        resched(rq);
+        return;
+    }
+}
 
-back_point:
-    return;
+bool sched_can_stop_tick() {
+    runqueue_t *rq = this_rq();
+    return rq->curr != rq->idle && rq->nr_running == 1 && !rq->need_resched;
 }
 
+static void *kstack_alloc(void) {
+    uint64_t flags = irq_save();
+    kstack_cache_t *cache = &kstack_caches[cpu_index()];
+    void *stack = cache->count ? cache->stacks[--cache->count] : NULL;
+    irq_restore(flags);
+    if (stack) return stack;
+
+    flags = spin_lock_irqsave(&kstack_depot_lock);
+    stack = kstack_depot;
+    if (stack)
+    {
+        kstack_depot = *(void **)stack;
+        kstack_depot_count--;
+    }
+    spin_unlock_irqrestore(&kstack_depot_lock, flags);
+    if (stack) return stack;
+
+    physaddr_t frames = alloc_contiguous_pages(KSTACK_PAGES);
+    if (frames == 0) return NULL;
+    for (size_t i = 0; i < KSTACK_PAGES; i++) memtag_charge_page(frames + i * PAGE_SIZE, &memtag_kstack);
+    return PHYS_TO_VIRT(frames);
+}
+
+static void kstack_free(void *stack) {
+    uint64_t flags = irq_save();
+    kstack_cache_t *cache = &kstack_caches[cpu_index()];
+    bool cached = cache->count < KSTACK_CACHE;
+    if (cached) cache->stacks[cache->count++] = stack;
+    irq_restore(flags);
+    if (cached) return;
+
+    flags = spin_lock_irqsave(&kstack_depot_lock);
+    cached = kstack_depot_count < KSTACK_DEPOT;
+    if (cached)
+    {
+        *(void **)stack = kstack_depot;
+        kstack_depot = stack;
+        kstack_depot_count++;
+    }
+    spin_unlock_irqrestore(&kstack_depot_lock, flags);
+    if (!cached)
+        for (size_t i = 0; i < KSTACK_PAGES; i++) free_page(VIRT_TO_PHYS(stack) + i * PAGE_SIZE);
+}
+
+static void free_process(process_t *proc) {
+    if (proc->kstack) kstack_free(proc->kstack);
+    fpu_release(proc);
+    proc->state = PROC_UNUSED;
+    kmem_cache_free(&process_cache, proc);
+}
+
+// rq is locked, proc was taken off it. Goes back onto rq if the queue it
+// belongs on is busy, it tries again the next time it leaves the CPU.
+static void push_task(runqueue_t *rq, process_t *proc) {
+    runqueue_t *dst = cpu_rq(select_task_cpu(proc));
+    if (dst == rq || !lock_second(rq, dst))
+    {
+        enqueue_task(rq, proc, ENQUEUE_MIGRATED);
+        return;
+    }
+    enqueue_task(dst, proc, ENQUEUE_MIGRATED);
+    check_preempt(dst, proc);
+    spin_unlock(&dst->lock);
+}
+
+// Runs on the new stack right after every switch, the queue is still locked.
+static void finish_switch(void) {
+    runqueue_t *rq = this_rq();
+    if (rq->zombie)
+    {
+        free_process(rq->zombie);
+        rq->zombie = NULL;
+    }
+    if (rq->push)
+    {
+        push_task(rq, rq->push); // Its stack is ours no more, another CPU may pick it now.
+        rq->push = NULL;
+    }
+    spin_unlock(&rq->lock);
+}
+
+static void process_trampoline(void) {
+    finish_switch();
+    irq_enable();
+    current_process()->entry();
+    process_exit();
+}
+
+static process_t *pick_next_task(runqueue_t *rq) {
+    process_t *next = NULL;
+    for (const sched_class_t *cls = sched_class_highest; cls && next == NULL; cls = cls->next) next = cls->pick_next(rq);
+    return next;
+}
+
+static bool sched_any_ready(runqueue_t *rq, const sched_class_t *above) {
+    for (const sched_class_t *cls = sched_class_highest; cls && cls != above; cls = cls->next)
+        if (cls->has_ready(rq)) return true;
+    return false;
+}
+
+// The run queue is locked and interrupts are off. Returns with it unlocked.
+// Preempted processes stay runnable even if they were about to block.
+static void schedule_locked(runqueue_t *rq, bool preempt) {
+    rq->need_resched = false;
+
+    process_t *prev = rq->curr;
+    if (prev != rq->idle)
+    {
+        bool runnable = prev->state == PROC_RUNNING || (preempt && prev->state == PROC_BLOCKED);
+        prev->sched_class->put_prev(rq, prev, runnable);
+        if (runnable) prev->state = PROC_READY;
+        else rq->nr_running--;
+        if (runnable && !cpu_allowed(prev, rq->cpu))
+        {
+            // Moved elsewhere by affinity or deadline admission. Not picked
+            // again here, finish_switch() queues it where it belongs.
+            dequeue_task(rq, prev, DEQUEUE_MIGRATE);
+            rq->push = prev;
+        }
+    }
+
+    process_t *next = pick_next_task(rq);
+    if (next == NULL && load_balance(rq, true)) next = pick_next_task(rq);
+    if (next == NULL) next = rq->idle;
+    next->state = PROC_RUNNING;
+    if (next->woken_at)
+    {
+        // Wakeup latency: from sched_wakeup() until it got the CPU.
+        uint64_t latency = rdtsc() - next->woken_at;
+        next->woken_at = 0;
+        this_cpu_inc(wakeups);
+        this_cpu_add(wakeup_cycles, latency);
+        if (latency > this_cpu_read(wakeup_max)) this_cpu_write(wakeup_max, latency);
+    }
+
+    if (next == prev)
+    {
+        spin_unlock(&rq->lock);
+        return;
+    }
+
+    if (prev->state == PROC_DEAD) rq->zombie = prev;
+    prev->last_ran = rdtsc();
+    rq->curr = next;
+    this_cpu_write(curr, next);
+    rq->switches++;
+    fpu_switch(prev, next);
+    switch_to(&prev->context, &next->context);
+    finish_switch();
+}
+
+void schedule() {
+    process_t *curr = current_process();
+    // Before the run queue lock, the pool may have to wake another worker.
+    bool worker = curr->flags & PF_WQ_WORKER;
+    if (worker && curr->state == PROC_BLOCKED) wq_worker_sleeping(curr);
+
+    uint64_t flags = irq_save();
+    rcu_note_context_switch();
+    runqueue_t *rq = this_rq();
+    spin_lock(&rq->lock);
+    schedule_locked(rq, false);
+    irq_restore(flags);
+
+    if (worker) wq_worker_running(curr);
+}
+
+void sched_preempt() {
+    this_cpu_inc(preemptions);
+    uint64_t flags = irq_save();
+    rcu_note_context_switch();
+    runqueue_t *rq = this_rq();
+    spin_lock(&rq->lock);
+    schedule_locked(rq, true);
+    irq_restore(flags);
+}
+
+// Timer interrupt.
+void sched_tick() {
+    runqueue_t *rq = this_rq();
+    if (!rq->online) return;
+    spin_lock(&rq->lock);
+
+    uint64_t now = rdtsc();
+    if (tick_tsc_per_jiffy) rq->tsc_per_tick = tick_tsc_per_jiffy; // Ticks aren't evenly spaced any more.
+    else if (rq->last_tick_tsc) rq->tsc_per_tick = (rq->tsc_per_tick * 7 + (now - rq->last_tick_tsc)) / 8;
+    rq->last_tick_tsc = now;
+
+    process_t *curr = rq->curr;
+    if (curr != rq->idle)
+    {
+        curr->sched_class->tick(rq, curr);
+        if (sched_any_ready(rq, curr->sched_class)) resched(rq);
+    }
+
+    uint64_t j = get_jiffies();
+    if (j >= rq->next_balance)
+    {
+        rq->next_balance = j + SCHED_BALANCE_INTERVAL;
+        load_balance(rq, curr == rq->idle);
+        if (rq->nr_running >= 2) nohz_balance_kick(rq);
+    }
+    if (curr == rq->idle && sched_any_ready(rq, NULL)) resched(rq);
+
+    spin_unlock(&rq->lock);
+}
+
+void sched_yield() {
+    schedule();
+}
+
+void sched_set_timeslice(uint32_t ticks) {
+    sched_time_slice = ticks ? ticks : 1;
+}
+
+void sched_set_latency(uint32_t ticks) {
+    sched_latency_ticks = ticks ? ticks : 1;
+}
+
+// Gets the process onto a CPU it may run on. Queued ones move right away,
+// a running one as it leaves its CPU (schedule_locked()), a blocked one
+// when it wakes up.
+static void sched_move(process_t *proc) {
+    uint64_t flags;
+    runqueue_t *rq;
+    runqueue_t *dst;
+    for (;;)
+    {
+        flags = irq_save();
+        rq = cpu_rq(proc->cpu);
+        dst = cpu_rq(select_task_cpu(proc));
+        double_rq_lock(rq, dst);
+        if (rq == cpu_rq(proc->cpu)) break;
+        double_rq_unlock(rq, dst);
+        irq_restore(flags);
+    }
+
+    if (proc == rq->curr && proc != rq->idle)
+    {
+        if (!cpu_allowed(proc, rq->cpu)) resched(rq);
+    }
+    else if (proc->state == PROC_READY && dst != rq)
+    {
+        dequeue_task(rq, proc, DEQUEUE_MIGRATE);
+        enqueue_task(dst, proc, ENQUEUE_MIGRATED);
+        check_preempt(dst, proc);
+    }
+
+    double_rq_unlock(rq, dst);
+    irq_restore(flags);
+}
+
+// Takes the process out of its class, lets change() modify it and puts it back.
+static void sched_change(process_t *proc, const sched_class_t *cls, void (*change)(process_t *, const void *), const void *arg) {
+    uint64_t flags;
+    runqueue_t *rq = task_rq_lock(proc, &flags);
+
+    bool queued = proc->state == PROC_READY;
+    bool running = proc == rq->curr && proc != rq->idle;
+    if (queued) proc->sched_class->dequeue(rq, proc, 0);
+    if (running) proc->sched_class->put_prev(rq, proc, false);
+
+    change(proc, arg);
+    if (proc->sched_class == &dl_sched_class && cls != &dl_sched_class) dl_release(proc);
+    proc->sched_class = cls;
+
+    if (queued)
+    {
+        cls->enqueue(rq, proc, ENQUEUE_RESTORE);
+        check_preempt(rq, proc);
+    }
+    if (running)
+    {
+        cls->set_curr(rq, proc);
+        resched(rq); // Let the new class decide.
+    }
+
+    spin_unlock_irqrestore(&rq->lock, flags);
+}
+
+typedef struct TypePolicy
+{
+    ESchedPolicy policy;
+    int nice;
+} type_policy_t;
+
+// UI work outweighs daemons ten to one even when both saturate the CPUs.
+static const type_policy_t type_defaults[] = {
+    [KERNEL] = { SCHED_NORMAL, 0 },
+    [USER]   = { SCHED_NORMAL, 0 },
+    [UI]     = { SCHED_INTERACTIVE, -5 },
+    [DAEMON] = { SCHED_BATCH, 5 },
+};
+
+static const sched_class_t *policy_class(ESchedPolicy policy) {
+    return policy == SCHED_BACKGROUND ? &bg_sched_class : &fair_sched_class;
+}
+
+static void change_policy(process_t *proc, const void *policy) {
+    proc->se.policy = (uint8_t)*(const ESchedPolicy *)policy;
+}
+
+static void change_type(process_t *proc, const void *type) {
+    const type_policy_t *defaults = &type_defaults[*(const EProcType *)type];
+    proc->type = *(const EProcType *)type;
+    proc->se.policy = (uint8_t)defaults->policy;
+    fair_set_nice(proc, defaults->nice);
+}
+
+static void change_priority(process_t *proc, const void *priority) {
+    proc->priority = *(const uint8_t *)priority;
+}
+
+static void change_nice(process_t *proc, const void *nice) {
+    if (proc->se.policy == SCHED_BACKGROUND) proc->se.policy = SCHED_NORMAL; // Back in the fair class.
+    fair_set_nice(proc, *(const int *)nice);
+}
+
+static void change_deadline(process_t *proc, const void *params) {
+    const uint64_t *p = params;
+    dl_set_params(proc, p[0], p[1], p[2]);
+}
+
+void sched_set_priority(process_t *proc, uint8_t priority) {
+    if (priority >= SCHED_PRIORITIES) priority = SCHED_PRIORITIES - 1;
+    sched_change(proc, &rt_sched_class, change_priority, &priority);
+}
+
+void sched_set_nice(process_t *proc, int nice) {
+    sched_change(proc, &fair_sched_class, change_nice, &nice);
+}
+
+void sched_set_policy(process_t *proc, ESchedPolicy policy) {
+    if (policy > SCHED_BACKGROUND) return;
+    sched_change(proc, policy_class(policy), change_policy, &policy);
+}
+
+void sched_set_type(process_t *proc, EProcType type) {
+    if (type > DAEMON) return;
+    sched_change(proc, policy_class(type_defaults[type].policy), change_type, &type);
+}
+
+bool sched_set_deadline(process_t *proc, uint64_t runtime_ns, uint64_t deadline_ns, uint64_t period_ns) {
+    if (period_ns == 0) period_ns = deadline_ns;
+    if (runtime_ns == 0 || runtime_ns > deadline_ns || deadline_ns > period_ns) return false;
+    if (!dl_admit(proc, runtime_ns, period_ns)) return false;
+
+    uint64_t params[3] = { runtime_ns, deadline_ns, period_ns };
+    sched_change(proc, &dl_sched_class, change_deadline, params);
+    sched_move(proc);
+    return true;
+}
+
+// An admitted deadline process stays on its CPU regardless.
+void sched_set_affinity(process_t *proc, uint64_t cpus) {
+    if (cpus == 0) return;
+    proc->cpus_allowed = cpus;
+    sched_move(proc);
+}
+
+process_t *current_process() {
+    return this_cpu_read(curr);
+}
+
+void sched_prepare_block() {
+    // Must be visible before the caller looks at its wakeup condition. A
+    // dead process stays dead.
+    process_t *curr = current_process();
+    EProcState state = __atomic_load_n(&curr->state, __ATOMIC_RELAXED);
+    while (state != PROC_DEAD
+           && !__atomic_compare_exchange_n(&curr->state, &state, PROC_BLOCKED, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        ;
+}
+
+bool sched_killed() {
+    return __atomic_load_n(&current_process()->flags, __ATOMIC_SEQ_CST) & PF_KILLED;
+}
+
+// After sched_prepare_block(), when nothing of ours is linked anywhere. A
+// kill after this finds us blocked and wakes us up.
+static void exit_if_killed(void) {
+    if (sched_killed()) process_exit();
+}
+
+void sched_block() {
+    sched_prepare_block();
+    schedule();
+}
+
+static void sleep_timeout(ktimer_t *timer) {
+    sched_wakeup(timer->data);
+}
+
+uint64_t schedule_timeout(uint64_t ticks) {
+    uint64_t expires = get_jiffies() + ticks;
+    ktimer_t timer;
+    timer_setup(&timer, sleep_timeout, current_process());
+    timer_add(&timer, expires);
+    schedule();
+    timer_cancel_sync(&timer); // It lives on this stack.
+    uint64_t now = get_jiffies();
+    return expires > now ? expires - now : 0;
+}
+
+void sched_sleep(uint64_t ticks) {
+    while (ticks)
+    {
+        sched_prepare_block();
+        exit_if_killed();
+        ticks = schedule_timeout(ticks);
+    }
+}
+
+void sched_sleep_ms(uint64_t ms) {
+    sched_sleep((ms * TIMER_HZ + 999) / 1000);
+}
+
+static void hrsleep_timeout(hrtimer_t *timer) {
+    sched_wakeup(timer->data);
+}
+
+bool schedule_hrtimeout(uint64_t deadline_ns) {
+    process_t *curr = current_process();
+    hrtimer_t timer;
+    hrtimer_setup(&timer, hrsleep_timeout, curr);
+    hrtimer_set_slack(&timer, curr->timer_slack);
+    if (!hrtimer_start(&timer, deadline_ns))
+    {
+        schedule_timeout(1); // Heap full, settle for the next jiffy.
+        return ktime_get_ns() >= deadline_ns;
+    }
+    schedule();
+    hrtimer_cancel_sync(&timer);
+    return ktime_get_ns() >= deadline_ns;
+}
+
+void sched_nanosleep(uint64_t ns) {
+    uint64_t deadline = ktime_get_ns() + ns;
+    do
+    {
+        sched_prepare_block();
+        exit_if_killed();
+    } while (!schedule_hrtimeout(deadline));
+}
+
+void sched_set_timer_slack(process_t *proc, uint64_t ns) {
+    proc->timer_slack = ns;
+}
+
+// With kill set the process gets PF_KILLED first, under its run queue lock
+// so it can't exit and be freed in between.
+static bool wake_process(process_t *proc, bool kill) {
+    uint64_t flags;
+    runqueue_t *rq;
+    runqueue_t *dst;
+    for (;;)
+    {
+        flags = irq_save();
+        rq = cpu_rq(proc->cpu);
+        dst = cpu_rq(select_task_cpu(proc));
+        double_rq_lock(rq, dst);
+        if (rq == cpu_rq(proc->cpu)) break;
+        double_rq_unlock(rq, dst);
+        irq_restore(flags);
+    }
+
+    if (kill)
+    {
+        if (proc->state == PROC_UNUSED || proc->state == PROC_DEAD || proc == rq->idle)
+        {
+            double_rq_unlock(rq, dst);
+            irq_restore(flags);
+            return false;
+        }
+        __atomic_or_fetch(&proc->flags, PF_KILLED, __ATOMIC_SEQ_CST);
+        if (proc == rq->curr && proc->state != PROC_BLOCKED) resched(rq); // Out to user mode soon.
+    }
+
+    bool woken = proc->state == PROC_BLOCKED;
+    if (woken)
+    {
+        if (proc == rq->curr)
+        {
+            proc->state = PROC_RUNNING; // Hasn't left the CPU yet, so it just won't.
+        }
+        else
+        {
+            int enqueue_flags = ENQUEUE_WAKEUP;
+            if (dst != rq)
+            {
+                // Its vruntime and the like are still relative to rq.
+                if (proc->sched_class->migrate_sleeper) proc->sched_class->migrate_sleeper(rq, proc);
+                enqueue_flags |= ENQUEUE_MIGRATED;
+            }
+            proc->woken_at = rdtsc();
+            enqueue_task(dst, proc, enqueue_flags);
+            check_preempt(dst, proc);
+        }
+    }
+
+    double_rq_unlock(rq, dst);
+    irq_restore(flags);
+    return woken;
+}
+
+bool sched_wakeup(process_t *proc) {
+    return wake_process(proc, false);
+}
+
+static process_t *process_alloc(void) {
+    process_t *proc = kmem_cache_zalloc(&process_cache);
+    if (proc) proc->state = PROC_BLOCKED; // Not runnable yet.
+    return proc;
+}
+
+// The boot thread becomes the BSP's idle process. Idle threads all have pd 0.
+void sched_init() {
+    process_t *idle = process_alloc();
+    if (idle == NULL) return;
+    rq_init(cpu_rq(0), 0, idle);
+    process_amount = 1;
+}
+
+void sched_init_cpu(uint32_t cpu) {
+    process_t *idle = cpu < MAX_CPUS ? process_alloc() : NULL;
+    if (idle == NULL) return;
+    rq_init(cpu_rq(cpu), cpu, idle);
+    __atomic_add_fetch(&process_amount, 1, __ATOMIC_RELAXED);
+}
 
 void evaluate_loop() {
-    if (interrupted)
+    runqueue_t *rq = this_rq();
+    for (;;)
     {
-    
-       switch_context();
-        
+        irq_disable();
+        if (rq->need_resched || sched_any_ready(rq, NULL))
+        {
+            irq_enable();
+            schedule();
+            continue;
+        }
+        tick_nohz_idle_enter();
+        rcu_idle_enter();
+        // sti only takes effect after the next instruction, so no wakeup is lost in between.
+        __asm__ __volatile__ ("sti; hlt" : : : "memory");
+        rcu_idle_exit();
     }
-    interrupted = false;
 }
 
-process_t *create_process(EProcType process_type /* int argc, char *argv[] */) {
-    process_t *proc = NULL;
+// Everything but queueing it, the process starts out blocked.
+static process_t *process_setup(EProcType process_type, void (*entry)(void)) {
+    process_t *proc = process_alloc();
+    if (proc == NULL) return NULL;
+    void *stack = pid_alloc(proc) > 0 ? kstack_alloc() : NULL;
+    if (stack == NULL)
+    {
+        pid_free(proc->pd);
+        free_process(proc);
+        return NULL;
+    }
+
     proc->type = process_type;
     proc->wait_time = 0;
     proc->is_running = true;
-    proc->pd = process_amount;
-    process_amount++;   
-    
+    proc->executable = NULL;
+    proc->priority = SCHED_DEFAULT_PRIORITY;
+    proc->slice_left = sched_time_slice;
+    proc->cpus_allowed = ~0ULL;
+    proc->last_ran = 0;
+    proc->se.vruntime = 0;
+    proc->se.sum_exec = 0;
+    proc->se.prev_sum_exec = 0;
+    proc->se.policy = (uint8_t)type_defaults[process_type].policy;
+    fair_set_nice(proc, type_defaults[process_type].nice);
+    proc->sched_class = policy_class(type_defaults[process_type].policy);
+    proc->kstack = stack;
+    proc->fpu_area = NULL;
+    proc->fpu_cpu = -1;
+    proc->timer_slack = hrtimer_default_slack;
+    proc->entry = entry;
+    init_context(&proc->context, (uint8_t *)proc->kstack + KSTACK_PAGES * PAGE_SIZE, process_trampoline);
+    __atomic_add_fetch(&process_amount, 1, __ATOMIC_RELAXED);
+    return proc;
+}
+
+// New processes go to the least loaded CPU they may run on.
+static runqueue_t *select_rq_new(process_t *proc) {
+    runqueue_t *best = cpu_allowed(proc, this_rq()->cpu) ? this_rq() : NULL;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        runqueue_t *rq = cpu_rq(cpu);
+        if (!rq->online || !cpu_allowed(proc, cpu)) continue;
+        if (best == NULL || rq->nr_running < best->nr_running) best = rq;
+    }
+    return best ? best : this_rq();
+}
+
+static void process_start(process_t *proc) {
+    uint64_t flags = irq_save();
+    runqueue_t *rq = select_rq_new(proc);
+    spin_lock(&rq->lock);
+    enqueue_task(rq, proc, ENQUEUE_NEW);
+    check_preempt(rq, proc);
+    spin_unlock(&rq->lock);
+    irq_restore(flags);
+}
+
+process_t *create_process(EProcType process_type, void (*entry)(void) /* int argc, char *argv[] */) {
+    process_t *proc = process_setup(process_type, entry);
+    if (proc) process_start(proc);
+    return proc;
+}
+
+static void kthread_entry(void) {
+    process_t *self = current_process();
+    self->thread_fn(self->thread_arg);
+}
+
+process_t *kthread_create(void (*fn)(void *), void *arg, uint32_t cpu) {
+    process_t *proc = process_setup(KERNEL, kthread_entry);
+    if (proc == NULL) return NULL;
+    proc->flags |= PF_KTHREAD;
+    proc->thread_fn = fn;
+    proc->thread_arg = arg;
+    if (cpu < MAX_CPUS)
+    {
+        proc->cpus_allowed = 1ULL << cpu;
+        proc->cpu = cpu;
+    }
+    return proc;
+}
+
+void kthread_start(process_t *proc) {
+    process_start(proc);
+}
+
+process_t *kthread_run(void (*fn)(void *), void *arg, uint32_t cpu) {
+    process_t *proc = kthread_create(fn, arg, cpu);
+    if (proc) kthread_start(proc);
     return proc;
 }
 
 void terminate_process(process_t *terminatable_process) {
+    if (terminatable_process != current_process())
+    {
+        wake_process(terminatable_process, true);
+        return;
+    }
+
+    uint64_t flags;
+    runqueue_t *rq = task_rq_lock(terminatable_process, &flags);
+    if (terminatable_process->state == PROC_DEAD || terminatable_process == rq->idle)
+    {
+        spin_unlock_irqrestore(&rq->lock, flags);
+        return;
+    }
+
+    if (terminatable_process->sched_class == &dl_sched_class) dl_release(terminatable_process);
     terminatable_process->is_running = false;
+    pid_free(terminatable_process->pd);
     terminatable_process->pd = -1;
-    process_amount--;
-    return;
+    terminatable_process->state = PROC_DEAD;
+    __atomic_sub_fetch(&process_amount, 1, __ATOMIC_RELAXED);
+    schedule_locked(rq, false); // Doesn't come back, the next process frees our stack.
+    irq_restore(flags);
 }
 
+void process_exit() {
+    terminate_process(current_process());
+    for (;;) cpu_halt();
+}
 
+void sched_dump_stats() {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        runqueue_t *rq = cpu_rq(cpu);
+        if (!rq->online) continue;
+        printf_("cpu%u: %u runnable, %lu switches, %lu pulled, %lu cycles/tick, %lu irqs, %lu preemptions, %lu ticks\n",
+                cpu, rq->nr_running, rq->switches, rq->pulled, rq->tsc_per_tick,
+                cpu_data[cpu].interrupts, cpu_data[cpu].preemptions, cpu_data[cpu].ticks);
+        printf_("      %lu deadline misses%s\n", rq->dl.misses, rq->rt.throttled ? ", rt throttled" : "");
+        uint64_t wakeups = cpu_data[cpu].wakeups;
+        uint64_t cycles_per_us = tsc_hz / 1000000;
+        if (wakeups && cycles_per_us)
+            printf_("      %lu wakeups, %lu ns average latency, %lu ns worst\n", wakeups,
+                    (uint64_t)(cpu_data[cpu].wakeup_cycles / wakeups * NSEC_PER_USEC / cycles_per_us),
+                    (uint64_t)(cpu_data[cpu].wakeup_max * NSEC_PER_USEC / cycles_per_us));
+    }
+    printf_("%u processes, %u pds in use\n", process_amount, pid_count());
+#ifdef SPINLOCK_STATS
+    lock_stat_dump();
+#endif
+    kmem_cache_dump(&process_cache);
+}
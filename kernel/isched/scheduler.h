@@ -2,31 +2,185 @@
 #define SCHEDULER_H
 
 #include "context.h"
+#include "pid.h"
 #include "common/types.h"
-#define MAX_AMOUNT_OF_PROCESSES 1000
+#include "common/rbtree.h"
+
+// Priority levels of the ready queue, 0 is the most important one.
+#define SCHED_PRIORITIES       64
+#define SCHED_DEFAULT_PRIORITY 32
+#define SCHED_DEFAULT_SLICE    10 // Timer ticks.
+
+// Fair class: nice values like everywhere else, -20 (greedy) to 19 (polite).
+#define NICE_MIN -20
+#define NICE_MAX 19
+#define SCHED_DEFAULT_LATENCY  6  // Timer ticks, every runnable fair process runs once per period.
+
+// Deadline class: utilisation in fixed point, at most SCHED_DL_BW_LIMIT of
+// each online CPU may be reserved. The rest keeps the other classes alive.
+#define SCHED_DL_BW_SHIFT 20
+#define SCHED_DL_BW_LIMIT ((95ULL << SCHED_DL_BW_SHIFT) / 100)
+
+// Real time class throttling: within every SCHED_RT_PERIOD ticks it may
+// use SCHED_RT_RUNTIME of them, a runaway loop can't starve the rest.
+#define SCHED_RT_PERIOD  1000
+#define SCHED_RT_RUNTIME 950
+
+#define KSTACK_PAGES 4
 
 typedef enum { KERNEL, USER, UI, DAEMON } EProcType;
 
+// How the fair class treats a process, every EProcType has its default:
+//   NORMAL      KERNEL, USER
+//   INTERACTIVE UI: short slices, wakes up ahead of the others and preempts readily.
+//   BATCH       DAEMON: long slices, never preempts anybody on wakeup.
+//   BACKGROUND  Own class below the fair one, only runs on otherwise idle CPUs.
+typedef enum { SCHED_NORMAL, SCHED_INTERACTIVE, SCHED_BATCH, SCHED_BACKGROUND } ESchedPolicy;
+
+#define SCHED_BG_SLICE 50 // Timer ticks, background processes take turns slowly.
+
+typedef enum { PROC_UNUSED, PROC_READY, PROC_RUNNING, PROC_BLOCKED, PROC_DEAD } EProcState;
+
+// process_t flags.
+#define PF_KTHREAD   (1 << 0) // Started by kthread_create(), runs thread_fn(thread_arg).
+#define PF_WQ_WORKER (1 << 1) // Workqueue worker, the pool hears about it blocking.
+#define PF_KILLED    (1 << 2) // terminate_process() wants it gone, see sched_killed().
+
+#define KTHREAD_ANY_CPU (~0U)
+
+
+struct SchedClass;
 
+// Fair class bookkeeping. Runtimes are TSC cycles.
+typedef struct SchedEntity
+{
+    rb_node_t node;
+    uint64_t vruntime;      // Runtime scaled by NICE_0_LOAD / weight.
+    uint64_t exec_start;    // TSC when we last started accounting.
+    uint64_t sum_exec;
+    uint64_t prev_sum_exec; // sum_exec when we got picked.
+    uint32_t weight;
+    int8_t nice;
+    uint8_t policy; // ESchedPolicy
+} sched_entity_t;
+
+// Deadline class parameters and state, times in ktime_get_ns() nanoseconds.
+// Every period the process may run for runtime, finishing by deadline.
+typedef struct SchedDlEntity
+{
+    rb_node_t node;
+    uint64_t runtime;
+    uint64_t deadline; // Relative to the start of the period.
+    uint64_t period;
+    uint64_t bw;       // runtime / period << SCHED_DL_BW_SHIFT, reserved at admission.
+    uint32_t cpu;      // Where bw is reserved while it isn't 0, it runs nowhere else.
+
+    uint64_t abs_deadline;
+    int64_t runtime_left; // Goes negative on overruns.
+    uint64_t exec_start;
+    bool throttled;       // Budget used up, waiting for the next period.
+    uint8_t queued;       // Which tree of the deadline queue it sits in.
+} sched_dl_entity_t;
 
 typedef struct Process
 {
     int32_t pd; // This is Process Descriptor (pd) Not anything else!
     EProcType type;
-    uint64_t wait_time;
+    uint32_t flags; // PF_*
+    uint64_t wait_time; // Ticks spent waiting in the ready queue.
     bool is_running;
     char *executable; // TODO: Implement file system so we can finally execute someo... Something :P
+
+    EProcState state;
+    const struct SchedClass *sched_class;
+    sched_entity_t se;
+    sched_dl_entity_t dl;
+    uint8_t priority; // Real time class.
+    uint32_t slice_left;
+    uint32_t cpu;          // Run queue we belong to.
+    uint64_t cpus_allowed; // Affinity mask.
+    uint64_t last_ran;     // TSC when we last left the CPU (cache hotness).
+    uint64_t enqueued_at;
+    uint64_t timer_slack; // ns high resolution sleeps may be stretched by.
+    uint64_t woken_at;    // TSC of the last wakeup, until it gets the CPU.
+    ctx_t context;
+    void *fpu_area;  // Extended state, NULL until the first FPU use.
+    int32_t fpu_cpu; // CPU that last loaded it into its registers, -1 for none.
+    void *kstack; // Bottom of the kernel stack (HHDM address).
+    void (*entry)(void);
+    void (*thread_fn)(void *); // Kernel threads.
+    void *thread_arg;
+    struct Process *next; // Ready queue link.
 } process_t;
 
-void jump_to();
-void return_back();
+// Set (per CPU) when the running process should give up the CPU.
+bool sched_need_resched();
+
+void sched_init();
+void sched_init_cpu(uint32_t cpu); // Application processors, from their idle thread.
+void schedule();
+void sched_preempt(); // Interrupt exit.
+void sched_tick();
+bool sched_can_stop_tick(); // Nothing to time slice on this CPU.
+void sched_yield();
+void sched_set_timeslice(uint32_t ticks);
+void sched_set_latency(uint32_t ticks);
+// Moves the process into the real time (priority round-robin) class:
+void sched_set_priority(process_t *proc, uint8_t priority);
+// Moves the process into the fair class:
+void sched_set_nice(process_t *proc, int nice);
+// Moves the process into the deadline class, onto one CPU with room for
+// its utilisation, and binds it there. Fails (false) when the parameters
+// make no sense or no CPU it may run on has that much left.
+bool sched_set_deadline(process_t *proc, uint64_t runtime_ns, uint64_t deadline_ns, uint64_t period_ns);
+// Back to the defaults of that type (policy, nice), any class it was in.
+void sched_set_type(process_t *proc, EProcType type);
+void sched_set_policy(process_t *proc, ESchedPolicy policy);
+
+process_t *current_process();
+
+void sched_set_affinity(process_t *proc, uint64_t cpus);
+void sched_dump_stats();
+
+// Blocking: the current process sleeps until somebody wakes it up.
+// To wait for a condition without losing wakeups:
+//     sched_prepare_block(); if (!condition) schedule(); else sched_wakeup(current_process());
+// sched_wakeup() between the two makes schedule() return right away.
+void sched_prepare_block();
+void sched_block();
+bool sched_wakeup(process_t *proc); // False if it wasn't blocked.
+
+// After sched_prepare_block(): blocks for at most ticks jiffies, returns
+// how many were left when somebody woke us up earlier.
+uint64_t schedule_timeout(uint64_t ticks);
+void sched_sleep(uint64_t ticks);
+void sched_sleep_ms(uint64_t ms);
+// Same on an hrtimer, deadline in ktime_get_ns() time, within timer_slack.
+bool schedule_hrtimeout(uint64_t deadline_ns); // False if woken up earlier.
+void sched_nanosleep(uint64_t ns);
+void sched_set_timer_slack(process_t *proc, uint64_t ns);
 
 void evaluate_loop();
 
-process_t *create_process(EProcType process_type /* int argc, char **argv */);
+process_t *create_process(EProcType process_type, void (*entry)(void) /* int argc, char **argv */);
+
+// Kernel threads: KERNEL processes running fn(arg) until it returns or
+// calls process_exit(). kthread_create() leaves it stopped, so the caller
+// can finish setting it up (priority, flags) before kthread_start(). A cpu
+// other than KTHREAD_ANY_CPU binds it there for good.
+process_t *kthread_create(void (*fn)(void *), void *arg, uint32_t cpu);
+void kthread_start(process_t *proc);
+process_t *kthread_run(void (*fn)(void *), void *arg, uint32_t cpu);
 
+// The current process exits on the spot. Any other one isn't torn down
+// from outside, things on its stack (wait entries, timers, futex waiters)
+// may still be linked elsewhere. It gets PF_KILLED and a wakeup instead:
+// sleeps end and it exits there, on its way back to user mode, or when its
+// entry returns. Loops that never sleep should check sched_killed().
 void terminate_process(process_t *terminatable_process);
+void process_exit() __attribute__((noreturn));
+bool sched_killed();
 
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,161 @@
+#include "wait.h"
+
+#define COMPLETION_ALL (~0U / 2) // Done for good, see complete_all().
+
+void wait_queue_init(wait_queue_t *wq) {
+    spin_lock_init(&wq->lock);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+void wait_entry_init(wait_entry_t *wait) {
+    wait->proc = current_process();
+    wait->func = NULL;
+    wait->flags = 0;
+    wait->prev = NULL;
+    wait->next = NULL;
+}
+
+void wait_entry_init_func(wait_entry_t *wait, bool (*func)(wait_entry_t *wait)) {
+    wait->proc = NULL;
+    wait->func = func;
+    wait->flags = 0;
+    wait->prev = NULL;
+    wait->next = NULL;
+}
+
+static inline bool wait_queued(wait_queue_t *wq, wait_entry_t *wait) {
+    return wait->prev || wq->head == wait;
+}
+
+static void wait_remove(wait_queue_t *wq, wait_entry_t *wait) {
+    if (wait->prev) wait->prev->next = wait->next;
+    else wq->head = wait->next;
+    if (wait->next) wait->next->prev = wait->prev;
+    else wq->tail = wait->prev;
+    wait->prev = NULL;
+    wait->next = NULL;
+}
+
+bool wait_queue_active(wait_queue_t *wq) {
+    return __atomic_load_n(&wq->head, __ATOMIC_ACQUIRE) != NULL;
+}
+
+// Queue locked.
+static void wait_add(wait_queue_t *wq, wait_entry_t *wait, uint32_t flags) {
+    if (wait_queued(wq, wait)) return;
+    wait->flags = flags;
+    if (flags & WAIT_EXCLUSIVE)
+    {
+        wait->prev = wq->tail;
+        if (wq->tail) wq->tail->next = wait;
+        else wq->head = wait;
+        wq->tail = wait;
+    }
+    else
+    {
+        wait->next = wq->head;
+        if (wq->head) wq->head->prev = wait;
+        else wq->tail = wait;
+        wq->head = wait;
+    }
+}
+
+void add_wait_queue(wait_queue_t *wq, wait_entry_t *wait, uint32_t flags) {
+    uint64_t irq = spin_lock_irqsave(&wq->lock);
+    wait_add(wq, wait, flags);
+    spin_unlock_irqrestore(&wq->lock, irq);
+}
+
+void remove_wait_queue(wait_queue_t *wq, wait_entry_t *wait) {
+    uint64_t irq = spin_lock_irqsave(&wq->lock);
+    if (wait_queued(wq, wait)) wait_remove(wq, wait);
+    spin_unlock_irqrestore(&wq->lock, irq);
+}
+
+void prepare_to_wait(wait_queue_t *wq, wait_entry_t *wait, uint32_t flags) {
+    uint64_t irq = spin_lock_irqsave(&wq->lock);
+    wait_add(wq, wait, flags);
+    // Under the lock: a waker that finds us on the queue sees us blocked.
+    sched_prepare_block();
+    spin_unlock_irqrestore(&wq->lock, irq);
+}
+
+void finish_wait(wait_queue_t *wq, wait_entry_t *wait) {
+    process_t *curr = current_process();
+    if (curr->state == PROC_BLOCKED) sched_wakeup(curr); // Didn't sleep after all.
+
+    // Wakers unlink what they wake, but one may still be at it: the entry
+    // lives on our stack, so wait for the lock either way.
+    remove_wait_queue(wq, wait);
+}
+
+uint32_t wake_up_nr(wait_queue_t *wq, uint32_t nr_exclusive) {
+    if (!wait_queue_active(wq)) return 0;
+
+    uint32_t woken = 0;
+    uint64_t irq = spin_lock_irqsave(&wq->lock);
+    wait_entry_t *wait = wq->head;
+    while (wait)
+    {
+        wait_entry_t *next = wait->next;
+        bool exclusive = wait->flags & WAIT_EXCLUSIVE;
+        wait_remove(wq, wait);
+        // Already awake (timeout) doesn't use up an exclusive wakeup.
+        bool did = wait->func ? wait->func(wait) : sched_wakeup(wait->proc);
+        if (did) woken++;
+        if (exclusive && did && --nr_exclusive == 0) break;
+        wait = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, irq);
+    return woken;
+}
+
+void completion_init(completion_t *c) {
+    c->done = 0;
+    wait_queue_init(&c->wq);
+}
+
+bool try_wait_for_completion(completion_t *c) {
+    uint32_t done = __atomic_load_n(&c->done, __ATOMIC_ACQUIRE);
+    while (done)
+    {
+        if (done >= COMPLETION_ALL) return true;
+        if (__atomic_compare_exchange_n(&c->done, &done, done - 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) return true;
+    }
+    return false;
+}
+
+void wait_for_completion(completion_t *c) {
+    wait_event_exclusive(c->wq, try_wait_for_completion(c));
+}
+
+bool wait_for_completion_timeout(completion_t *c, uint64_t ticks) {
+    if (try_wait_for_completion(c)) return true;
+
+    wait_entry_t wait;
+    wait_entry_init(&wait);
+    bool done = false;
+    while (!done && ticks)
+    {
+        prepare_to_wait(&c->wq, &wait, WAIT_EXCLUSIVE);
+        done = try_wait_for_completion(c);
+        if (!done) ticks = schedule_timeout(ticks);
+    }
+    finish_wait(&c->wq, &wait);
+    // Woken right as we timed out: take it, or the wakeup is lost.
+    if (!done) done = try_wait_for_completion(c);
+    return done;
+}
+
+void complete(completion_t *c) {
+    uint32_t done = __atomic_load_n(&c->done, __ATOMIC_RELAXED);
+    while (done < COMPLETION_ALL && !__atomic_compare_exchange_n(&c->done, &done, done + 1, false,
+                                                                 __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    wake_up(&c->wq);
+}
+
+void complete_all(completion_t *c) {
+    __atomic_store_n(&c->done, COMPLETION_ALL, __ATOMIC_RELEASE);
+    wake_up_all(&c->wq);
+}
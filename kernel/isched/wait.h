@@ -0,0 +1,123 @@
+#ifndef WAIT_H
+#define WAIT_H
+
+#include "scheduler.h"
+#include "common/spinlock.h"
+
+// Wait queues: processes sleep here, off every run queue, until somebody
+// wakes them. Non-exclusive waiters all wake up together, exclusive ones
+// (WAIT_EXCLUSIVE) one at a time, so a released lock doesn't wake a herd.
+// Waking takes the queue lock and the woken process's run queue lock,
+// nothing else; nobody touches a queue nobody waits on.
+//
+//     wait_entry_t wait;
+//     wait_entry_init(&wait);
+//     for (;;)
+//     {
+//         prepare_to_wait(&wq, &wait, 0);
+//         if (condition) break;
+//         schedule();
+//     }
+//     finish_wait(&wq, &wait);
+//
+// or just wait_event(wq, condition).
+//
+// Entries with a func get that called (under the queue lock, must not
+// block) instead of waking a process, which is how things other than
+// processes wait: see async.h. They go on and off the queue with
+// add_wait_queue() and remove_wait_queue().
+
+#define WAIT_EXCLUSIVE (1 << 0)
+
+typedef struct WaitEntry
+{
+    process_t *proc;
+    bool (*func)(struct WaitEntry *wait); // Whether it woke anybody, like sched_wakeup().
+    uint32_t flags;
+    struct WaitEntry *prev;
+    struct WaitEntry *next;
+} wait_entry_t;
+
+typedef struct WaitQueue
+{
+    spinlock_t lock;
+    wait_entry_t *head; // Non-exclusive waiters first, exclusive ones in FIFO order.
+    wait_entry_t *tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL }
+
+void wait_queue_init(wait_queue_t *wq);
+void wait_entry_init(wait_entry_t *wait);
+void wait_entry_init_func(wait_entry_t *wait, bool (*func)(wait_entry_t *wait));
+bool wait_queue_active(wait_queue_t *wq);
+
+void add_wait_queue(wait_queue_t *wq, wait_entry_t *wait, uint32_t flags); // Unless it's queued already.
+void remove_wait_queue(wait_queue_t *wq, wait_entry_t *wait);
+
+void prepare_to_wait(wait_queue_t *wq, wait_entry_t *wait, uint32_t flags);
+void finish_wait(wait_queue_t *wq, wait_entry_t *wait);
+
+// Wakes every non-exclusive waiter and up to nr_exclusive exclusive ones.
+// Returns how many processes it woke.
+uint32_t wake_up_nr(wait_queue_t *wq, uint32_t nr_exclusive);
+#define wake_up(wq) wake_up_nr((wq), 1)
+#define wake_up_all(wq) wake_up_nr((wq), ~0U)
+
+#define __wait_event(wq, condition, flags) do {                                   \
+    wait_entry_t __wait;                                                          \
+    wait_entry_init(&__wait);                                                     \
+    for (;;)                                                                      \
+    {                                                                             \
+        prepare_to_wait(&(wq), &__wait, (flags));                                 \
+        if (condition) break;                                                     \
+        schedule();                                                               \
+    }                                                                             \
+    finish_wait(&(wq), &__wait);                                                  \
+} while (0)
+
+#define wait_event(wq, condition) do {                                            \
+    if (!(condition)) __wait_event(wq, condition, 0);                             \
+} while (0)
+
+#define wait_event_exclusive(wq, condition) do {                                  \
+    if (!(condition)) __wait_event(wq, condition, WAIT_EXCLUSIVE);                \
+} while (0)
+
+// Gives up after timeout jiffies. Evaluates to the jiffies left, 0 if it
+// timed out (the condition may still have come true at the last moment).
+#define wait_event_timeout(wq, condition, timeout) __extension__ ({               \
+    uint64_t __left = (timeout);                                                  \
+    if (!(condition))                                                             \
+    {                                                                             \
+        wait_entry_t __wait;                                                      \
+        wait_entry_init(&__wait);                                                 \
+        for (;;)                                                                  \
+        {                                                                         \
+            prepare_to_wait(&(wq), &__wait, 0);                                   \
+            if (condition) break;                                                 \
+            if (__left == 0) break;                                               \
+            __left = schedule_timeout(__left);                                    \
+        }                                                                         \
+        finish_wait(&(wq), &__wait);                                              \
+        if (__left == 0 && (condition)) __left = 1;                               \
+    }                                                                             \
+    __left; })
+
+// One-shot (or counted) events: "this has happened", waited for by others.
+typedef struct Completion
+{
+    uint32_t done;
+    wait_queue_t wq;
+} completion_t;
+
+#define COMPLETION_INIT { 0, WAIT_QUEUE_INIT }
+
+void completion_init(completion_t *c);
+void wait_for_completion(completion_t *c);
+bool wait_for_completion_timeout(completion_t *c, uint64_t ticks); // False on timeout.
+bool try_wait_for_completion(completion_t *c);
+void complete(completion_t *c);     // Releases one waiter.
+void complete_all(completion_t *c); // Releases everybody, now and later.
+
+#endif
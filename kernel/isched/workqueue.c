@@ -0,0 +1,337 @@
+#include "workqueue.h"
+#include "wait.h"
+#include "timing.h"
+#include "percpu.h"
+#include "printf.h"
+#include "common/spinlock.h"
+#include "common/slab.h"
+
+struct WorkerPool;
+
+typedef struct Worker
+{
+    process_t *proc;
+    struct WorkerPool *pool;
+    work_t *current;        // Being executed, compared against only.
+    struct Worker *next;      // Every worker of the pool.
+    struct Worker *idle_next; // Idle list, most recently idle first.
+    bool idle;
+    bool sleeping; // Blocked in the middle of a work item.
+} worker_t;
+
+typedef struct WorkerPool
+{
+    spinlock_t lock;
+    uint32_t cpu;
+    bool online;
+    work_t *head; // FIFO of pending work.
+    work_t *tail;
+    worker_t *workers;
+    worker_t *idle;
+    uint32_t nr_workers;
+    uint32_t nr_idle;
+    uint32_t nr_running; // Neither idle nor blocked. Goes down under the lock only.
+    bool creating;       // A worker is making the next idle one.
+    wait_queue_t done;   // Flushers, woken after every work item.
+    uint64_t executed;
+    uint64_t created;
+    uint64_t retired;
+} __attribute__((aligned(64))) worker_pool_t;
+
+static worker_pool_t pools[MAX_CPUS];
+
+static DEFINE_KMEM_CACHE(worker_cache, "worker", worker_t);
+
+// Work for CPUs without a pool (offline, or before workqueue_init()) goes
+// to the first one.
+static worker_pool_t *pool_of(uint32_t cpu) {
+    if (cpu < MAX_CPUS && pools[cpu].online) return &pools[cpu];
+    return &pools[0];
+}
+
+void work_init(work_t *work, void (*fn)(work_t *work)) {
+    work->next = NULL;
+    work->fn = fn;
+    work->pending = 0;
+    work->cpu = 0;
+}
+
+// Pool locked. Only a worker that is still idle can be woken up here, one
+// leaving the idle list (maybe to exit) takes the lock first.
+static void wake_idle_worker(worker_pool_t *pool) {
+    if (pool->idle) sched_wakeup(pool->idle->proc);
+}
+
+static void insert_work(worker_pool_t *pool, work_t *work) {
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    work->cpu = pool->cpu;
+    work->next = NULL;
+    if (pool->tail) pool->tail->next = work;
+    else pool->head = work;
+    pool->tail = work;
+    if (__atomic_load_n(&pool->nr_running, __ATOMIC_ACQUIRE) == 0) wake_idle_worker(pool);
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+// Pool locked.
+static bool remove_work(worker_pool_t *pool, work_t *work) {
+    work_t *prev = NULL;
+    for (work_t *it = pool->head; it; prev = it, it = it->next)
+    {
+        if (it != work) continue;
+        if (prev) prev->next = it->next;
+        else pool->head = it->next;
+        if (pool->tail == it) pool->tail = prev;
+        it->next = NULL;
+        return true;
+    }
+    return false;
+}
+
+bool queue_work_on(uint32_t cpu, work_t *work) {
+    if (__atomic_exchange_n(&work->pending, 1, __ATOMIC_ACQ_REL)) return false;
+    insert_work(pool_of(cpu), work);
+    return true;
+}
+
+bool queue_work(work_t *work) {
+    return queue_work_on(cpu_index(), work);
+}
+
+static void delayed_work_timer(ktimer_t *timer) {
+    delayed_work_t *dwork = timer->data;
+    insert_work(pool_of(dwork->work.cpu), &dwork->work);
+}
+
+void delayed_work_init(delayed_work_t *dwork, void (*fn)(work_t *work)) {
+    work_init(&dwork->work, fn);
+    timer_setup(&dwork->timer, delayed_work_timer, dwork);
+}
+
+bool queue_delayed_work_on(uint32_t cpu, delayed_work_t *dwork, uint64_t delay) {
+    if (delay == 0) return queue_work_on(cpu, &dwork->work);
+    if (__atomic_exchange_n(&dwork->work.pending, 1, __ATOMIC_ACQ_REL)) return false;
+    dwork->work.cpu = pool_of(cpu)->cpu;
+    timer_add(&dwork->timer, get_jiffies() + delay);
+    return true;
+}
+
+bool queue_delayed_work(delayed_work_t *dwork, uint64_t delay) {
+    return queue_delayed_work_on(cpu_index(), dwork, delay);
+}
+
+bool cancel_work(work_t *work) {
+    worker_pool_t *pool = pool_of(work->cpu);
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    bool removed = remove_work(pool, work);
+    if (removed) __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&pool->lock, flags);
+    return removed;
+}
+
+bool cancel_delayed_work(delayed_work_t *dwork) {
+    if (timer_cancel(&dwork->timer))
+    {
+        __atomic_store_n(&dwork->work.pending, 0, __ATOMIC_RELEASE);
+        return true;
+    }
+    return cancel_work(&dwork->work);
+}
+
+bool work_busy(work_t *work) {
+    if (__atomic_load_n(&work->pending, __ATOMIC_ACQUIRE)) return true;
+    worker_pool_t *pool = pool_of(work->cpu);
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    bool running = false;
+    for (worker_t *worker = pool->workers; worker && !running; worker = worker->next) running = worker->current == work;
+    spin_unlock_irqrestore(&pool->lock, flags);
+    return running;
+}
+
+void flush_work(work_t *work) {
+    wait_event(pool_of(work->cpu)->done, !work_busy(work));
+}
+
+bool cancel_work_sync(work_t *work) {
+    bool cancelled = cancel_work(work);
+    flush_work(work);
+    return cancelled;
+}
+
+bool cancel_delayed_work_sync(delayed_work_t *dwork) {
+    bool cancelled = timer_cancel_sync(&dwork->timer);
+    if (cancelled) __atomic_store_n(&dwork->work.pending, 0, __ATOMIC_RELEASE);
+    else cancelled = cancel_work(&dwork->work);
+    flush_work(&dwork->work);
+    return cancelled;
+}
+
+static void worker_main(void *arg);
+
+// Pool locked.
+static void worker_enter_idle(worker_pool_t *pool, worker_t *worker) {
+    worker->idle = true;
+    worker->idle_next = pool->idle;
+    pool->idle = worker;
+    pool->nr_idle++;
+}
+
+// Pool locked.
+static void worker_leave_idle(worker_pool_t *pool, worker_t *worker) {
+    for (worker_t **it = &pool->idle; *it; it = &(*it)->idle_next)
+    {
+        if (*it != worker) continue;
+        *it = worker->idle_next;
+        break;
+    }
+    worker->idle_next = NULL;
+    worker->idle = false;
+    pool->nr_idle--;
+}
+
+// New workers start out idle, so that nobody makes a second one meanwhile.
+static worker_t *create_worker(worker_pool_t *pool) {
+    worker_t *worker = kmem_cache_zalloc(&worker_cache);
+    if (worker == NULL) return NULL;
+    worker->pool = pool;
+    worker->proc = kthread_create(worker_main, worker, pool->cpu);
+    if (worker->proc == NULL)
+    {
+        kmem_cache_free(&worker_cache, worker);
+        return NULL;
+    }
+    worker->proc->flags |= PF_WQ_WORKER;
+
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    worker->next = pool->workers;
+    pool->workers = worker;
+    pool->nr_workers++;
+    pool->created++;
+    worker_enter_idle(pool, worker);
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    kthread_start(worker->proc);
+    return worker;
+}
+
+// Pool locked.
+static void worker_unlink(worker_pool_t *pool, worker_t *worker) {
+    for (worker_t **it = &pool->workers; *it; it = &(*it)->next)
+    {
+        if (*it != worker) continue;
+        *it = worker->next;
+        return;
+    }
+}
+
+static inline bool need_more_worker(worker_pool_t *pool) {
+    return pool->head && __atomic_load_n(&pool->nr_running, __ATOMIC_ACQUIRE) == 0;
+}
+
+// Runs work while it is the only running worker of the pool, a second one
+// (back from blocking) goes idle after its current item.
+static void worker_main(void *arg) {
+    worker_t *worker = arg;
+    worker_pool_t *pool = worker->pool;
+
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    for (;;)
+    {
+        // Idle. Wakers hold the pool lock, so checking first loses nothing.
+        if (!need_more_worker(pool))
+        {
+            sched_prepare_block();
+            spin_unlock_irqrestore(&pool->lock, flags);
+            uint64_t left = schedule_timeout(WQ_IDLE_TIMEOUT);
+            flags = spin_lock_irqsave(&pool->lock);
+
+            if (left == 0 && pool->head == NULL && pool->nr_idle > WQ_MAX_IDLE)
+            {
+                worker_leave_idle(pool, worker);
+                worker_unlink(pool, worker);
+                pool->nr_workers--;
+                pool->retired++;
+                break;
+            }
+            if (!need_more_worker(pool)) continue;
+        }
+
+        worker_leave_idle(pool, worker);
+        __atomic_add_fetch(&pool->nr_running, 1, __ATOMIC_RELEASE);
+        while (pool->head && __atomic_load_n(&pool->nr_running, __ATOMIC_ACQUIRE) <= 1)
+        {
+            // Keep a spare for when this work blocks.
+            if (pool->nr_idle == 0 && !pool->creating)
+            {
+                pool->creating = true;
+                spin_unlock_irqrestore(&pool->lock, flags);
+                create_worker(pool);
+                flags = spin_lock_irqsave(&pool->lock);
+                pool->creating = false;
+                continue;
+            }
+
+            work_t *work = pool->head;
+            pool->head = work->next;
+            if (pool->head == NULL) pool->tail = NULL;
+            work->next = NULL;
+            worker->current = work;
+            __atomic_store_n(&work->pending, 0, __ATOMIC_RELEASE);
+            spin_unlock_irqrestore(&pool->lock, flags);
+
+            work->fn(work); // May free or requeue it.
+
+            flags = spin_lock_irqsave(&pool->lock);
+            worker->current = NULL;
+            pool->executed++;
+            if (wait_queue_active(&pool->done)) wake_up_all(&pool->done);
+        }
+        __atomic_sub_fetch(&pool->nr_running, 1, __ATOMIC_RELEASE);
+        worker_enter_idle(pool, worker);
+    }
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    kmem_cache_free(&worker_cache, worker);
+    process_exit();
+}
+
+void wq_worker_sleeping(process_t *proc) {
+    worker_t *worker = proc->thread_arg;
+    if (worker->idle || worker->sleeping) return;
+
+    worker_pool_t *pool = worker->pool;
+    uint64_t flags = spin_lock_irqsave(&pool->lock);
+    worker->sleeping = true;
+    if (__atomic_sub_fetch(&pool->nr_running, 1, __ATOMIC_RELEASE) == 0 && pool->head) wake_idle_worker(pool);
+    spin_unlock_irqrestore(&pool->lock, flags);
+}
+
+void wq_worker_running(process_t *proc) {
+    worker_t *worker = proc->thread_arg;
+    if (!worker->sleeping) return;
+    worker->sleeping = false;
+    __atomic_add_fetch(&worker->pool->nr_running, 1, __ATOMIC_RELEASE);
+}
+
+void workqueue_init() {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        worker_pool_t *pool = &pools[cpu];
+        if (!cpu_data[cpu].online) continue;
+        pool->cpu = cpu;
+        wait_queue_init(&pool->done);
+        __atomic_store_n(&pool->online, true, __ATOMIC_RELEASE);
+        if (create_worker(pool) == NULL) printf_("workqueue: no worker for cpu%u\n", cpu);
+    }
+}
+
+void workqueue_dump_stats() {
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        worker_pool_t *pool = &pools[cpu];
+        if (!pool->online) continue;
+        printf_("wq cpu%u: %u workers (%u idle, %u running), %lu executed, %lu created, %lu retired\n",
+                cpu, pool->nr_workers, pool->nr_idle, pool->nr_running, pool->executed, pool->created, pool->retired);
+    }
+    kmem_cache_dump(&worker_cache);
+}
@@ -0,0 +1,80 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include "scheduler.h"
+#include "timer.h"
+
+// Deferred work: functions that run later in a kernel thread, where they
+// may block, instead of in an interrupt or on a hot path. Every CPU has a
+// pool of worker threads bound to it, work queued on a CPU runs there.
+//
+// The pool keeps just enough workers running to keep the CPU busy: one
+// normally, another one as soon as the running worker blocks (on I/O, a
+// mutex...), so slow work doesn't hold up the rest. There's always an idle
+// worker waiting for that moment, whoever takes the last one creates the
+// next before starting on its work. Workers that stay idle for
+// WQ_IDLE_TIMEOUT beyond the first WQ_MAX_IDLE exit again.
+//
+//     static void writeback(work_t *work) { ... }
+//     static DEFINE_WORK(writeback_work, writeback);
+//     queue_work(&writeback_work);
+//
+// A work item is queued at most once at a time, queueing a pending item
+// again does nothing. Once its function started it may be queued again,
+// or freed by the function itself.
+
+#define WQ_MAX_IDLE     2
+#define WQ_IDLE_TIMEOUT (5 * TIMER_HZ) // Jiffies.
+
+typedef struct Work
+{
+    struct Work *next;
+    void (*fn)(struct Work *work);
+    uint32_t pending; // Queued (or its timer armed), not started yet.
+    uint32_t cpu;     // Pool it was last queued on.
+} work_t;
+
+typedef struct DelayedWork
+{
+    work_t work;
+    ktimer_t timer;
+} delayed_work_t;
+
+#define WORK_INIT(f) { NULL, (f), 0, 0 }
+#define DEFINE_WORK(var, f) work_t var = WORK_INIT(f)
+
+void work_init(work_t *work, void (*fn)(work_t *work));
+void delayed_work_init(delayed_work_t *dwork, void (*fn)(work_t *work));
+
+static inline delayed_work_t *to_delayed_work(work_t *work) {
+    return (delayed_work_t *)((uint8_t *)work - __builtin_offsetof(delayed_work_t, work));
+}
+
+void workqueue_init(); // After smp_init(), every online CPU gets its pool.
+
+// False if it was pending already. Callable from interrupts.
+bool queue_work(work_t *work); // On this CPU.
+bool queue_work_on(uint32_t cpu, work_t *work);
+// Queued after delay jiffies, by a timer on this CPU.
+bool queue_delayed_work(delayed_work_t *dwork, uint64_t delay);
+bool queue_delayed_work_on(uint32_t cpu, delayed_work_t *dwork, uint64_t delay);
+
+// Takes it off its pool (or stops the timer), true if it was pending. The
+// function may be running still, the _sync variants wait for it.
+bool cancel_work(work_t *work);
+bool cancel_delayed_work(delayed_work_t *dwork);
+bool cancel_work_sync(work_t *work);
+bool cancel_delayed_work_sync(delayed_work_t *dwork);
+
+// Sleeps until the work is neither pending nor running.
+void flush_work(work_t *work);
+bool work_busy(work_t *work);
+
+// Scheduler hooks for PF_WQ_WORKER processes: blocking in schedule() and
+// getting the CPU back afterwards.
+void wq_worker_sleeping(process_t *proc);
+void wq_worker_running(process_t *proc);
+
+void workqueue_dump_stats();
+
+#endif
@@ -0,0 +1,51 @@
+#include "acpi.h"
+#include "common/memory.h"
+#include "vulnerable/bootloader.h"
+
+static volatile struct limine_rsdp_request rsdp_request = {
+    .id = LIMINE_RSDP_REQUEST,
+    .revision = 0
+};
+
+typedef struct AcpiRsdp
+{
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt;
+    uint32_t length; // ACPI 2.0 onwards:
+    uint64_t xsdt;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+static void *acpi_map(uint64_t addr) {
+    // Older protocol revisions hand out HHDM addresses, newer ones physical.
+    return addr >= hhdm_offset ? (void *)addr : PHYS_TO_VIRT(addr);
+}
+
+static bool acpi_checksum(const void *table, size_t length) {
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++) sum += ((const uint8_t *)table)[i];
+    return sum == 0;
+}
+
+acpi_header_t *acpi_find_table(const char *signature) {
+    if (rsdp_request.response == NULL) return NULL;
+    acpi_rsdp_t *rsdp = acpi_map((uint64_t)rsdp_request.response->address);
+
+    bool xsdt = rsdp->revision >= 2 && rsdp->xsdt;
+    acpi_header_t *root = acpi_map(xsdt ? rsdp->xsdt : rsdp->rsdt);
+    size_t entry_size = xsdt ? 8 : 4;
+    size_t entries = (root->length - sizeof(acpi_header_t)) / entry_size;
+    uint8_t *list = (uint8_t *)root + sizeof(acpi_header_t);
+
+    for (size_t i = 0; i < entries; i++)
+    {
+        uint64_t addr = xsdt ? *(uint64_t *)(list + i * 8) : *(uint32_t *)(list + i * 4);
+        acpi_header_t *table = acpi_map(addr);
+        if (memcmp(table->signature, signature, 4) == 0 && acpi_checksum(table, table->length)) return table;
+    }
+    return NULL;
+}
@@ -0,0 +1,41 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include "common/types.h"
+
+typedef struct AcpiHeader
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_header_t;
+
+typedef struct AcpiAddress
+{
+    uint8_t space; // 0 = memory
+    uint8_t bit_width;
+    uint8_t bit_offset;
+    uint8_t access_size;
+    uint64_t address;
+} __attribute__((packed)) acpi_address_t;
+
+typedef struct AcpiHpet
+{
+    acpi_header_t header;
+    uint32_t event_timer_block_id;
+    acpi_address_t address;
+    uint8_t hpet_number;
+    uint16_t min_tick;
+    uint8_t page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+// Table with the given signature (HHDM address), NULL if the firmware has none.
+acpi_header_t *acpi_find_table(const char *signature);
+
+#endif
@@ -0,0 +1,102 @@
+#include "apic.h"
+#include "cpu.h"
+#include "timing.h"
+#include "common/isr.h"
+#include "common/memory.h"
+#include "tick.h"
+#include "clocksource.h"
+
+// Local APIC: interrupt acknowledgement, IPIs and the per-CPU timer.
+
+#define LAPIC_CALIBRATE_JIFFIES 10
+
+volatile uint32_t *lapic_mmio = NULL;
+uint32_t lapic_ticks_per_jiffy = 0;
+uint64_t lapic_tsc_per_jiffy = 0;
+static bool lapic_deadline;
+
+void lapic_init_cpu() {
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | (1 << 11)); // Global enable.
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | ISR_LAPIC_SPURIOUS);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+}
+
+// Needs the PIT running and interrupts enabled.
+void lapic_init() {
+    uint64_t base = rdmsr(MSR_APIC_BASE) & ~0xFFFULL;
+    lapic_mmio = (volatile uint32_t *)PHYS_TO_VIRT(base);
+    lapic_init_cpu();
+
+    lapic_write(LAPIC_TIMER_DIV, 0x3); // Divide by 16.
+    uint64_t start = get_jiffies();
+    while (get_jiffies() == start) __builtin_ia32_pause();
+
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    uint64_t tsc = rdtsc();
+    start = get_jiffies();
+    while (get_jiffies() - start < LAPIC_CALIBRATE_JIFFIES) __builtin_ia32_pause();
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CUR);
+    tsc = rdtsc() - tsc;
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_ticks_per_jiffy = elapsed / LAPIC_CALIBRATE_JIFFIES;
+    lapic_tsc_per_jiffy = tsc / LAPIC_CALIBRATE_JIFFIES;
+    if (tsc_hz)
+    {
+        // The clocksource measured the TSC more precisely than PIT jiffies
+        // can, scale the timer against it instead.
+        lapic_tsc_per_jiffy = tsc_hz / TIMER_HZ;
+        lapic_ticks_per_jiffy = (uint64_t)elapsed * lapic_tsc_per_jiffy / tsc;
+    }
+
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    lapic_deadline = c & (1 << 24);
+}
+
+bool lapic_has_deadline() {
+    return lapic_deadline;
+}
+
+void lapic_timer_setup() {
+    lapic_write(LAPIC_TIMER_DIV, 0x3);
+    lapic_write(LAPIC_LVT_TIMER, ISR_LAPIC_TIMER | (lapic_deadline ? LAPIC_TIMER_DEADLINE : 0));
+    __asm__ __volatile__ ("mfence" : : : "memory"); // LVT write before the first deadline write.
+}
+
+void lapic_timer_arm(uint64_t tsc) {
+    if (lapic_deadline)
+    {
+        wrmsr(MSR_TSC_DEADLINE, tsc);
+        return;
+    }
+    uint64_t now = rdtsc();
+    uint64_t delta = tsc > now ? tsc - now : 1;
+    uint64_t count = delta * lapic_ticks_per_jiffy / lapic_tsc_per_jiffy;
+    lapic_write(LAPIC_TIMER_INIT, (uint32_t)MIN(MAX(count, 1), 0xFFFFFFFFULL));
+}
+
+void lapic_timer_disarm() {
+    if (lapic_deadline) wrmsr(MSR_TSC_DEADLINE, 0);
+    else lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+void lapic_eoi() {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    uint64_t flags = irq_save();
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) __builtin_ia32_pause();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, vector); // Fixed delivery, physical destination.
+    irq_restore(flags);
+}
+
+// Called by handle_interrupt() for the local APIC vectors.
+void lapic_interrupt(uint64_t vector) {
+    if (vector == ISR_LAPIC_TIMER) tick_interrupt();
+    // ISR_IPI_RESCHED has nothing to do, need_resched is already set.
+    lapic_eoi();
+}
@@ -0,0 +1,50 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include "common/types.h"
+
+// Local APIC registers (xAPIC, memory mapped):
+#define LAPIC_ID         0x020
+#define LAPIC_TPR        0x080
+#define LAPIC_EOI        0x0B0
+#define LAPIC_SVR        0x0F0
+#define LAPIC_ICR_LOW    0x300
+#define LAPIC_ICR_HIGH   0x310
+#define LAPIC_LVT_TIMER  0x320
+#define LAPIC_TIMER_INIT 0x380
+#define LAPIC_TIMER_CUR  0x390
+#define LAPIC_TIMER_DIV  0x3E0
+
+#define LAPIC_SVR_ENABLE      (1 << 8)
+#define LAPIC_ICR_PENDING     (1 << 12)
+#define LAPIC_TIMER_PERIODIC  (1 << 17)
+#define LAPIC_TIMER_DEADLINE  (2 << 17)
+#define LAPIC_LVT_MASKED      (1 << 16)
+
+#define MSR_APIC_BASE    0x1B
+#define MSR_TSC_DEADLINE 0x6E0
+
+extern volatile uint32_t *lapic_mmio;
+
+static force_inline uint32_t lapic_read(uint32_t reg) { return lapic_mmio[reg / 4]; }
+static force_inline void lapic_write(uint32_t reg, uint32_t val) { lapic_mmio[reg / 4] = val; }
+
+static force_inline uint32_t lapic_id(void) { return lapic_read(LAPIC_ID) >> 24; }
+
+void lapic_init();     // BSP: maps the APIC and calibrates its timer (and the TSC) against the PIT.
+void lapic_init_cpu(); // Every CPU: enables its own APIC.
+
+// The timer only ever runs one-shot, in TSC-deadline mode when the CPU has it.
+bool lapic_has_deadline();
+void lapic_timer_setup();
+void lapic_timer_arm(uint64_t tsc); // Fire once the TSC reaches tsc.
+void lapic_timer_disarm();
+void lapic_eoi();
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_interrupt(uint64_t vector);
+
+// Timer ticks (divide by 16) and TSC cycles per PIT jiffy, 0 before calibration.
+extern uint32_t lapic_ticks_per_jiffy;
+extern uint64_t lapic_tsc_per_jiffy;
+
+#endif
@@ -0,0 +1,107 @@
+#include "clocksource.h"
+#include "hpet.h"
+#include "timing.h"
+#include "cpu.h"
+#include "printf.h"
+
+#define CALIBRATE_US    10000
+#define CALIBRATE_ROUNDS 3
+
+uint64_t tsc_hz = 0;
+bool tsc_invariant = false;
+const clocksource_t *clocksource;
+
+static uint64_t clock_base; // Counter value at ktime 0.
+
+static uint64_t read_tsc() { return rdtsc(); }
+static uint64_t read_jiffies() { return get_jiffies(); }
+
+static clocksource_t cs_tsc = { .name = "tsc", .read = read_tsc, .mask = ~0ULL, .rating = 300,
+                               .user_readable = true };
+static clocksource_t cs_hpet = { .name = "hpet", .read = hpet_read, .rating = 250 };
+static clocksource_t cs_jiffies = { .name = "jiffies", .read = read_jiffies, .mask = ~0ULL, .rating = 100 };
+
+static void clocksource_set_hz(clocksource_t *cs, uint64_t hz) {
+    cs->shift = 32;
+    cs->mult = (NSEC_PER_SEC << cs->shift) / hz;
+}
+
+static bool tsc_detect_invariant() {
+    uint32_t a, b, c, d;
+    cpuid(0x80000000, 0, &a, &b, &c, &d);
+    if (a < 0x80000007) return false;
+    cpuid(0x80000007, 0, &a, &b, &c, &d);
+    return d & (1 << 8);
+}
+
+// TSC cycles over CALIBRATE_US on the HPET.
+static uint64_t hpet_measure_tsc() {
+    uint64_t ticks = hpet_hz * CALIBRATE_US / 1000000;
+    uint64_t start = hpet_read();
+    uint64_t tsc = rdtsc();
+    while (((hpet_read() - start) & hpet_mask) < ticks) __builtin_ia32_pause();
+    return rdtsc() - tsc;
+}
+
+// The shortest of a few runs: an SMI or a slow port access only ever
+// makes a window longer.
+static uint64_t tsc_calibrate() {
+    uint64_t best = ~0ULL;
+    for (int i = 0; i < CALIBRATE_ROUNDS; i++)
+    {
+        uint64_t flags = irq_save();
+        uint64_t cycles = hpet_present() ? hpet_measure_tsc() : pit_measure_tsc(CALIBRATE_US);
+        irq_restore(flags);
+        best = MIN(best, cycles);
+    }
+    return best * (1000000 / CALIBRATE_US);
+}
+
+static void clocksource_select(clocksource_t *cs) {
+    if (clocksource == NULL || cs->rating > clocksource->rating) clocksource = cs;
+}
+
+void clocksource_init() {
+    clocksource_set_hz(&cs_jiffies, TIMER_HZ);
+    clocksource_select(&cs_jiffies);
+
+    // A 32 bit HPET wraps every few minutes, good enough to calibrate
+    // against but not to keep time with.
+    if (hpet_init() && hpet_mask == ~0ULL)
+    {
+        cs_hpet.mask = hpet_mask;
+        clocksource_set_hz(&cs_hpet, hpet_hz);
+        clocksource_select(&cs_hpet);
+    }
+
+    // Without the invariant bit the TSC may change rate with P-states,
+    // still better than jiffies: hlt (C1) keeps it running.
+    tsc_invariant = tsc_detect_invariant();
+    tsc_hz = tsc_calibrate();
+    if (tsc_hz)
+    {
+        if (!tsc_invariant) cs_tsc.rating = 150;
+        clocksource_set_hz(&cs_tsc, tsc_hz);
+        clocksource_select(&cs_tsc);
+    }
+
+    clock_base = clocksource->read();
+    printf_("clocksource: %s, TSC %lu kHz%s against the %s\n", clocksource->name, tsc_hz / 1000,
+            tsc_invariant ? " invariant" : "", hpet_present() ? "hpet" : "pit");
+}
+
+uint64_t ktime_get_cycles() {
+    return clocksource->read();
+}
+
+uint64_t cycles_to_ns(uint64_t cycles) {
+    return ((unsigned __int128)cycles * clocksource->mult) >> clocksource->shift;
+}
+
+uint64_t ktime_at(uint64_t cycles) {
+    return cycles_to_ns((cycles - clock_base) & clocksource->mask);
+}
+
+uint64_t ktime_get_ns() {
+    return ktime_at(clocksource->read());
+}
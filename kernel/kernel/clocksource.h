@@ -0,0 +1,37 @@
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+
+#include "common/types.h"
+
+// Monotonic time since clocksource_init(). The best counter available is
+// picked once at boot: the invariant TSC, a 64 bit HPET, any TSC, jiffies.
+// Cycles become nanoseconds as (cycles * mult) >> shift.
+
+#define NSEC_PER_SEC 1000000000ULL
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_USEC 1000ULL
+
+typedef struct ClockSource
+{
+    const char *name;
+    uint64_t (*read)();
+    uint64_t mask;
+    uint64_t mult;
+    uint32_t shift;
+    int rating;
+    bool user_readable; // Ring 3 can read the counter itself (vdso.h).
+} clocksource_t;
+
+void clocksource_init(); // BSP, after init_pmm().
+
+uint64_t ktime_get_ns();
+uint64_t ktime_get_cycles(); // Raw counter of the active clocksource.
+uint64_t cycles_to_ns(uint64_t cycles);
+uint64_t ktime_at(uint64_t cycles); // ktime_get_ns() when the counter read cycles.
+
+// Calibrated TSC frequency, 0 if it could not be measured.
+extern uint64_t tsc_hz;
+extern bool tsc_invariant;
+extern const clocksource_t *clocksource;
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include "common/types.h"
+#include "apic.h"
+#include "percpu.h"
+
+static force_inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ __volatile__ ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+static force_inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static force_inline void wrmsr(uint32_t msr, uint64_t val) {
+    __asm__ __volatile__ ("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)) : "memory");
+}
+
+// Interrupt flag helpers:
+static force_inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ __volatile__ ("pushfq; popq %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static force_inline void irq_restore(uint64_t flags) {
+    __asm__ __volatile__ ("pushq %0; popfq" : : "r"(flags) : "memory", "cc");
+}
+
+static force_inline void irq_enable(void) { __asm__ __volatile__ ("sti" : : : "memory"); }
+static force_inline void irq_disable(void) { __asm__ __volatile__ ("cli" : : : "memory"); }
+static force_inline void cpu_halt(void) { __asm__ __volatile__ ("hlt" : : : "memory"); }
+
+#endif
@@ -0,0 +1,226 @@
+#include "fpu.h"
+#include "cpu.h"
+#include "common/isr.h"
+#include "common/memory.h"
+#include "common/memtag.h"
+
+#define CR0_MP (1 << 1)
+#define CR0_EM (1 << 2)
+#define CR0_TS (1 << 3)
+
+#define CR4_OSFXSR     (1 << 9)
+#define CR4_OSXMMEXCPT (1 << 10)
+#define CR4_OSXSAVE    (1 << 18)
+
+#define MSR_XSS 0xDA0
+
+#define XFEATURES_WANTED 0xE7 // x87, SSE, AVX and the three AVX-512 parts.
+
+#define FPU_VECTOR_NM 7
+
+typedef enum
+{
+    FPU_FXSAVE,
+    FPU_XSAVE,
+    FPU_XSAVEOPT,
+    FPU_XSAVES,
+} EFpuMode;
+
+static EFpuMode fpu_mode = FPU_FXSAVE;
+static uint64_t fpu_xfeatures;
+static void *fpu_init_state; // Saved right after fninit, copied into new areas.
+uint32_t fpu_area_size;
+
+static DEFINE_MEMTAG(memtag_fpu, "fpu");
+
+static force_inline uint64_t read_cr0(void) {
+    uint64_t cr0;
+    __asm__ __volatile__ ("mov %%cr0, %0" : "=r"(cr0));
+    return cr0;
+}
+
+static force_inline void write_cr0(uint64_t cr0) {
+    __asm__ __volatile__ ("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+// Writing CR0 is slow, so only do it when TS actually changes.
+static force_inline void fpu_trap_on(void) {
+    if (this_cpu_read(fpu_ts)) return;
+    write_cr0(read_cr0() | CR0_TS);
+    this_cpu_write(fpu_ts, true);
+}
+
+static force_inline void fpu_trap_off(void) {
+    if (!this_cpu_read(fpu_ts)) return;
+    __asm__ __volatile__ ("clts" : : : "memory");
+    this_cpu_write(fpu_ts, false);
+}
+
+static void fpu_save(void *area) {
+    uint32_t lo = (uint32_t)fpu_xfeatures, hi = (uint32_t)(fpu_xfeatures >> 32);
+    switch (fpu_mode)
+    {
+        case FPU_XSAVES:
+            __asm__ __volatile__ ("xsaves64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        case FPU_XSAVEOPT:
+            __asm__ __volatile__ ("xsaveopt64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        case FPU_XSAVE:
+            __asm__ __volatile__ ("xsave64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        default:
+            __asm__ __volatile__ ("fxsave64 (%0)" : : "r"(area) : "memory");
+            break;
+    }
+}
+
+static void fpu_restore(void *area) {
+    uint32_t lo = (uint32_t)fpu_xfeatures, hi = (uint32_t)(fpu_xfeatures >> 32);
+    switch (fpu_mode)
+    {
+        case FPU_XSAVES:
+            __asm__ __volatile__ ("xrstors64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        case FPU_XSAVEOPT:
+        case FPU_XSAVE:
+            __asm__ __volatile__ ("xrstor64 (%0)" : : "r"(area), "a"(lo), "d"(hi) : "memory");
+            break;
+        default:
+            __asm__ __volatile__ ("fxrstor64 (%0)" : : "r"(area) : "memory");
+            break;
+    }
+}
+
+static void *fpu_alloc_area(void) {
+    size_t pages = (fpu_area_size + PAGE_SIZE - 1) / PAGE_SIZE;
+    physaddr_t frame = pages == 1 ? alloc_page_tagged(&memtag_fpu) : alloc_contiguous_pages(pages);
+    if (frame == 0) return NULL;
+
+    void *area = PHYS_TO_VIRT(frame);
+    if (fpu_init_state) memcpy(area, fpu_init_state, fpu_area_size);
+    else memset(area, 0, fpu_area_size);
+    return area;
+}
+
+// #NM: the current process wants the FPU back.
+static void fpu_trap(AsmPassedInterrupt *regs) {
+    (void)regs;
+    process_t *proc = current_process();
+    fpu_trap_off();
+
+    if (proc->fpu_area == NULL) proc->fpu_area = fpu_alloc_area();
+    if (proc->fpu_area == NULL)
+    {
+        printf_("fpu: no memory for a save area, process %d\n", proc->pd);
+        for (;;) cpu_halt();
+    }
+    fpu_restore(proc->fpu_area);
+
+    proc->fpu_cpu = (int32_t)cpu_index();
+    this_cpu_write(fpu_owner, proc);
+    this_cpu_write(fpu_regs, proc);
+}
+
+void fpu_switch(process_t *prev, process_t *next) {
+    if (this_cpu_read(fpu_owner) == prev)
+    {
+        if (prev->state != PROC_DEAD) fpu_save(prev->fpu_area);
+        this_cpu_write(fpu_owner, NULL); // The registers still hold it, see fpu_regs.
+    }
+
+    if (this_cpu_read(fpu_regs) == next && next->fpu_cpu == (int32_t)cpu_index())
+    {
+        fpu_trap_off();
+        this_cpu_write(fpu_owner, next);
+    }
+    else
+    {
+        fpu_trap_on();
+    }
+}
+
+void fpu_adopt(process_t *proc) {
+    proc->fpu_area = fpu_alloc_area();
+    if (proc->fpu_area == NULL) return;
+    proc->fpu_cpu = (int32_t)cpu_index();
+    this_cpu_write(fpu_owner, proc);
+    this_cpu_write(fpu_regs, proc);
+    this_cpu_write(fpu_ts, false);
+}
+
+// The slot can get reused, fpu_cpu = -1 keeps fpu_regs from matching it.
+void fpu_release(process_t *proc) {
+    if (proc->fpu_area)
+    {
+        size_t pages = (fpu_area_size + PAGE_SIZE - 1) / PAGE_SIZE;
+        for (size_t i = 0; i < pages; i++) free_page(VIRT_TO_PHYS(proc->fpu_area) + i * PAGE_SIZE);
+    }
+    proc->fpu_area = NULL;
+    proc->fpu_cpu = -1;
+}
+
+void fpu_init_cpu() {
+    uint32_t a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+
+    write_cr0((read_cr0() | CR0_MP) & ~(CR0_EM | CR0_TS));
+    uint64_t cr4;
+    __asm__ __volatile__ ("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    if (c & (1 << 26)) cr4 |= CR4_OSXSAVE;
+    __asm__ __volatile__ ("mov %0, %%cr4" : : "r"(cr4) : "memory");
+
+    if (fpu_xfeatures)
+    {
+        __asm__ __volatile__ ("xsetbv" : : "c"(0), "a"((uint32_t)fpu_xfeatures), "d"((uint32_t)(fpu_xfeatures >> 32)));
+        if (fpu_mode == FPU_XSAVES) wrmsr(MSR_XSS, 0); // No supervisor components.
+    }
+    this_cpu_write(fpu_ts, false);
+}
+
+void fpu_init() {
+    uint32_t a, b, c, d;
+    cpuid(0, 0, &a, &b, &c, &d);
+    uint32_t max_leaf = a;
+    cpuid(1, 0, &a, &b, &c, &d);
+
+    fpu_area_size = 512;
+    if ((c & (1 << 26)) && max_leaf >= 0xD)
+    {
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        fpu_xfeatures = (((uint64_t)d << 32) | a) & XFEATURES_WANTED;
+        fpu_mode = FPU_XSAVE;
+
+        cpuid(0xD, 1, &a, &b, &c, &d);
+        if (a & (1 << 3)) fpu_mode = FPU_XSAVES;
+        else if (a & (1 << 0)) fpu_mode = FPU_XSAVEOPT;
+    }
+    fpu_init_cpu();
+
+    // The sizes depend on what XCR0 enables, so ask only now.
+    if (fpu_mode == FPU_XSAVES)
+    {
+        cpuid(0xD, 1, &a, &b, &c, &d);
+        fpu_area_size = b;
+    }
+    else if (fpu_mode != FPU_FXSAVE)
+    {
+        cpuid(0xD, 0, &a, &b, &c, &d);
+        fpu_area_size = b;
+    }
+
+    void *init_state = fpu_alloc_area(); // Zeroed, the XSAVE header has to be.
+    if (init_state)
+    {
+        uint32_t mxcsr = 0x1F80;
+        __asm__ __volatile__ ("fninit; ldmxcsr %0" : : "m"(mxcsr));
+        fpu_save(init_state);
+        fpu_init_state = init_state;
+    }
+
+    registerExceptionHandler(FPU_VECTOR_NM, fpu_trap);
+
+    static const char *modes[] = { "fxsave", "xsave", "xsaveopt", "xsaves" };
+    printf_("fpu: %s, %u byte areas, features %lx\n", modes[fpu_mode], fpu_area_size, fpu_xfeatures);
+}
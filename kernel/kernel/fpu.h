@@ -0,0 +1,28 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "common/types.h"
+#include "scheduler.h"
+
+// Lazy x87/SSE/AVX state switching.
+// A process gets a save area the first time it touches the FPU, until then
+// switching it costs nothing. On a switch the outgoing owner is saved
+// (XSAVEOPT/XSAVES skip untouched components), the incoming one only gets
+// CR0.TS and has its state brought back by the #NM trap if it needs it.
+// If the registers still hold its state from last time even that is skipped.
+
+void fpu_init();     // BSP, after the frame allocator: detects the save format.
+void fpu_init_cpu(); // Every CPU: enables SSE/XSAVE in CR4 and XCR0.
+
+// The thread that booted a CPU owns whatever is in its registers.
+void fpu_adopt(process_t *proc);
+
+// Called by the scheduler with interrupts off, right before switch_to().
+void fpu_switch(process_t *prev, process_t *next);
+
+void fpu_release(process_t *proc);
+
+// Bytes per save area, 0 before fpu_init().
+extern uint32_t fpu_area_size;
+
+#endif
@@ -5,27 +5,32 @@
 // GDT & TSS Entry configurator
 // Copyright (C) 2024 Panagiotis
 
-static GDTEntries gdt;
-static GDTPtr     gdtr;
-static TSSPtr     tss;
+// One of each per CPU, the TSS descriptor can't be shared (ltr marks it busy).
+static GDTEntries gdt[MAX_CPUS];
+static GDTPtr     gdtr[MAX_CPUS];
+static TSSPtr     tss[MAX_CPUS];
 
-TSSPtr *tssPtr = &tss;
+TSSPtr *tssPtr = &tss[0];
 
-void gdt_load_tss(TSSPtr *tss) {
-  size_t addr = (size_t)tss;
+TSSPtr *gdt_tss(uint32_t cpu) {
+  return &tss[cpu];
+}
+
+static void gdt_load_tss(uint32_t cpu) {
+  size_t addr = (size_t)&tss[cpu];
 
-  gdt.tss.base_low = (uint16_t)addr;
-  gdt.tss.base_mid = (uint8_t)(addr >> 16);
-  gdt.tss.flags1 = 0b10001001;
-  gdt.tss.flags2 = 0;
-  gdt.tss.base_high = (uint8_t)(addr >> 24);
-  gdt.tss.base_upper32 = (uint32_t)(addr >> 32);
-  gdt.tss.reserved = 0;
+  gdt[cpu].tss.base_low = (uint16_t)addr;
+  gdt[cpu].tss.base_mid = (uint8_t)(addr >> 16);
+  gdt[cpu].tss.flags1 = 0b10001001;
+  gdt[cpu].tss.flags2 = 0;
+  gdt[cpu].tss.base_high = (uint8_t)(addr >> 24);
+  gdt[cpu].tss.base_upper32 = (uint32_t)(addr >> 32);
+  gdt[cpu].tss.reserved = 0;
 
   __asm__ __volatile__("ltr %0" : : "rm"((uint16_t)0x58) : "memory");
 }
 
-void gdt_reload() {
+static void gdt_reload(uint32_t cpu) {
   __asm__ __volatile__("lgdt %0\n\t"
                "push $0x28\n\t"
                "lea 1f(%%rip), %%rax\n\t"
@@ -39,102 +44,106 @@ void gdt_reload() {
                "mov %%eax, %%gs\n\t"
                "mov %%eax, %%ss\n\t"
                :
-               : "m"(gdtr)
+               : "m"(gdtr[cpu])
                : "rax", "memory");
 }
 
-void initiateGDT() {
+void gdt_init_cpu(uint32_t cpu) {
   // Null descriptor. (0)
-  gdt.descriptors[0].limit = 0;
-  gdt.descriptors[0].base_low = 0;
-  gdt.descriptors[0].base_mid = 0;
-  gdt.descriptors[0].access = 0;
-  gdt.descriptors[0].granularity = 0;
-  gdt.descriptors[0].base_high = 0;
+  gdt[cpu].descriptors[0].limit = 0;
+  gdt[cpu].descriptors[0].base_low = 0;
+  gdt[cpu].descriptors[0].base_mid = 0;
+  gdt[cpu].descriptors[0].access = 0;
+  gdt[cpu].descriptors[0].granularity = 0;
+  gdt[cpu].descriptors[0].base_high = 0;
 
   // Kernel code 16. (8)
-  gdt.descriptors[1].limit = 0xffff;
-  gdt.descriptors[1].base_low = 0;
-  gdt.descriptors[1].base_mid = 0;
-  gdt.descriptors[1].access = 0b10011010;
-  gdt.descriptors[1].granularity = 0b00000000;
-  gdt.descriptors[1].base_high = 0;
+  gdt[cpu].descriptors[1].limit = 0xffff;
+  gdt[cpu].descriptors[1].base_low = 0;
+  gdt[cpu].descriptors[1].base_mid = 0;
+  gdt[cpu].descriptors[1].access = 0b10011010;
+  gdt[cpu].descriptors[1].granularity = 0b00000000;
+  gdt[cpu].descriptors[1].base_high = 0;
 
   // Kernel data 16. (16)
-  gdt.descriptors[2].limit = 0xffff;
-  gdt.descriptors[2].base_low = 0;
-  gdt.descriptors[2].base_mid = 0;
-  gdt.descriptors[2].access = 0b10010010;
-  gdt.descriptors[2].granularity = 0b00000000;
-  gdt.descriptors[2].base_high = 0;
+  gdt[cpu].descriptors[2].limit = 0xffff;
+  gdt[cpu].descriptors[2].base_low = 0;
+  gdt[cpu].descriptors[2].base_mid = 0;
+  gdt[cpu].descriptors[2].access = 0b10010010;
+  gdt[cpu].descriptors[2].granularity = 0b00000000;
+  gdt[cpu].descriptors[2].base_high = 0;
 
   // Kernel code 32. (24)
-  gdt.descriptors[3].limit = 0xffff;
-  gdt.descriptors[3].base_low = 0;
-  gdt.descriptors[3].base_mid = 0;
-  gdt.descriptors[3].access = 0b10011010;
-  gdt.descriptors[3].granularity = 0b11001111;
-  gdt.descriptors[3].base_high = 0;
+  gdt[cpu].descriptors[3].limit = 0xffff;
+  gdt[cpu].descriptors[3].base_low = 0;
+  gdt[cpu].descriptors[3].base_mid = 0;
+  gdt[cpu].descriptors[3].access = 0b10011010;
+  gdt[cpu].descriptors[3].granularity = 0b11001111;
+  gdt[cpu].descriptors[3].base_high = 0;
 
   // Kernel data 32. (32)
-  gdt.descriptors[4].limit = 0xffff;
-  gdt.descriptors[4].base_low = 0;
-  gdt.descriptors[4].base_mid = 0;
-  gdt.descriptors[4].access = 0b10010010;
-  gdt.descriptors[4].granularity = 0b11001111;
-  gdt.descriptors[4].base_high = 0;
+  gdt[cpu].descriptors[4].limit = 0xffff;
+  gdt[cpu].descriptors[4].base_low = 0;
+  gdt[cpu].descriptors[4].base_mid = 0;
+  gdt[cpu].descriptors[4].access = 0b10010010;
+  gdt[cpu].descriptors[4].granularity = 0b11001111;
+  gdt[cpu].descriptors[4].base_high = 0;
 
   // Kernel code 64. (40)
-  gdt.descriptors[5].limit = 0;
-  gdt.descriptors[5].base_low = 0;
-  gdt.descriptors[5].base_mid = 0;
-  gdt.descriptors[5].access = 0b10011010;
-  gdt.descriptors[5].granularity = 0b00100000;
-  gdt.descriptors[5].base_high = 0;
+  gdt[cpu].descriptors[5].limit = 0;
+  gdt[cpu].descriptors[5].base_low = 0;
+  gdt[cpu].descriptors[5].base_mid = 0;
+  gdt[cpu].descriptors[5].access = 0b10011010;
+  gdt[cpu].descriptors[5].granularity = 0b00100000;
+  gdt[cpu].descriptors[5].base_high = 0;
 
   // Kernel data 64. (48)
-  gdt.descriptors[6].limit = 0;
-  gdt.descriptors[6].base_low = 0;
-  gdt.descriptors[6].base_mid = 0;
-  gdt.descriptors[6].access = 0b10010010;
-  gdt.descriptors[6].granularity = 0;
-  gdt.descriptors[6].base_high = 0;
+  gdt[cpu].descriptors[6].limit = 0;
+  gdt[cpu].descriptors[6].base_low = 0;
+  gdt[cpu].descriptors[6].base_mid = 0;
+  gdt[cpu].descriptors[6].access = 0b10010010;
+  gdt[cpu].descriptors[6].granularity = 0;
+  gdt[cpu].descriptors[6].base_high = 0;
 
   // SYSENTER
-  gdt.descriptors[7] = (GDTEntry){0}; // (56)
-  gdt.descriptors[8] = (GDTEntry){0}; // (64)
+  gdt[cpu].descriptors[7] = (GDTEntry){0}; // (56)
+  gdt[cpu].descriptors[8] = (GDTEntry){0}; // (64)
 
   // User code 64. (72)
-  gdt.descriptors[10].limit = 0;
-  gdt.descriptors[10].base_low = 0;
-  gdt.descriptors[10].base_mid = 0;
-  gdt.descriptors[10].access = 0b11111010;
-  gdt.descriptors[10].granularity = 0b00100000;
-  gdt.descriptors[10].base_high = 0;
+  gdt[cpu].descriptors[10].limit = 0;
+  gdt[cpu].descriptors[10].base_low = 0;
+  gdt[cpu].descriptors[10].base_mid = 0;
+  gdt[cpu].descriptors[10].access = 0b11111010;
+  gdt[cpu].descriptors[10].granularity = 0b00100000;
+  gdt[cpu].descriptors[10].base_high = 0;
 
   // User data 64. (80)
-  gdt.descriptors[9].limit = 0;
-  gdt.descriptors[9].base_low = 0;
-  gdt.descriptors[9].base_mid = 0;
-  gdt.descriptors[9].access = 0b11110010;
-  gdt.descriptors[9].granularity = 0;
-  gdt.descriptors[9].base_high = 0;
+  gdt[cpu].descriptors[9].limit = 0;
+  gdt[cpu].descriptors[9].base_low = 0;
+  gdt[cpu].descriptors[9].base_mid = 0;
+  gdt[cpu].descriptors[9].access = 0b11110010;
+  gdt[cpu].descriptors[9].granularity = 0;
+  gdt[cpu].descriptors[9].base_high = 0;
 
   // TSS. (88)
-  gdt.tss.length = 104;
-  gdt.tss.base_low = 0;
-  gdt.tss.base_mid = 0;
-  gdt.tss.flags1 = 0b10001001;
-  gdt.tss.flags2 = 0;
-  gdt.tss.base_high = 0;
-  gdt.tss.base_upper32 = 0;
-  gdt.tss.reserved = 0;
-
-  gdtr.limit = sizeof(GDTEntries) - 1;
-  gdtr.base = (uint64_t)&gdt;
-
-  gdt_reload();
-
-  memset(&tss, 0, sizeof(TSSPtr));
-  gdt_load_tss(&tss);
+  gdt[cpu].tss.length = 104;
+  gdt[cpu].tss.base_low = 0;
+  gdt[cpu].tss.base_mid = 0;
+  gdt[cpu].tss.flags1 = 0b10001001;
+  gdt[cpu].tss.flags2 = 0;
+  gdt[cpu].tss.base_high = 0;
+  gdt[cpu].tss.base_upper32 = 0;
+  gdt[cpu].tss.reserved = 0;
+
+  gdtr[cpu].limit = sizeof(GDTEntries) - 1;
+  gdtr[cpu].base = (uint64_t)&gdt[cpu];
+
+  gdt_reload(cpu);
+
+  memset(&tss[cpu], 0, sizeof(TSSPtr));
+  gdt_load_tss(cpu);
+}
+
+void initiateGDT() {
+  gdt_init_cpu(0);
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "common/types.h"
 #include "common/memory.h"
+#include "cpu.h"
 
 #ifndef GDT_H
 #define GDT_H
@@ -63,6 +64,8 @@ typedef struct GDTPtr {
 #define GDT_USER_DATA 72
 #define GDT_TSS 80
 
-void initiateGDT();
+void initiateGDT(); // BSP
+void gdt_init_cpu(uint32_t cpu);
+TSSPtr *gdt_tss(uint32_t cpu);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include "hpet.h"
+#include "acpi.h"
+#include "printf.h"
+#include "common/memory.h"
+
+#define HPET_CAPABILITIES 0x000
+#define HPET_CONFIG       0x010
+#define HPET_COUNTER      0x0F0
+
+#define HPET_CAP_64BIT    (1ULL << 13)
+#define HPET_CONFIG_ENABLE 1
+
+uint64_t hpet_hz = 0;
+uint64_t hpet_mask = 0;
+static volatile uint8_t *hpet_mmio;
+
+static inline uint64_t hpet_reg(uint32_t reg) { return *(volatile uint64_t *)(hpet_mmio + reg); }
+static inline void hpet_set(uint32_t reg, uint64_t val) { *(volatile uint64_t *)(hpet_mmio + reg) = val; }
+
+bool hpet_init() {
+    acpi_hpet_t *table = (acpi_hpet_t *)acpi_find_table("HPET");
+    if (table == NULL || table->address.space != 0) return false;
+
+    hpet_mmio = PHYS_TO_VIRT(table->address.address);
+    uint64_t caps = hpet_reg(HPET_CAPABILITIES);
+    uint64_t period_fs = caps >> 32; // Femtoseconds per count, at most 100 ns.
+    if (period_fs == 0 || period_fs > 100000000) return false;
+
+    hpet_hz = 1000000000000000ULL / period_fs;
+    hpet_mask = (caps & HPET_CAP_64BIT) ? ~0ULL : 0xFFFFFFFFULL;
+    hpet_set(HPET_CONFIG, hpet_reg(HPET_CONFIG) | HPET_CONFIG_ENABLE);
+
+    printf_("hpet: %lu kHz, %u bit\n", hpet_hz / 1000, hpet_mask == ~0ULL ? 64 : 32);
+    return true;
+}
+
+bool hpet_present() {
+    return hpet_hz != 0;
+}
+
+uint64_t hpet_read() {
+    return hpet_reg(HPET_COUNTER) & hpet_mask;
+}
@@ -0,0 +1,16 @@
+#ifndef HPET_H
+#define HPET_H
+
+#include "common/types.h"
+
+// High Precision Event Timer, only its main counter: a clocksource and a
+// calibration reference for the TSC. Comparators are left alone.
+
+bool hpet_init(); // Finds it through ACPI and starts the counter.
+bool hpet_present();
+uint64_t hpet_read();
+
+extern uint64_t hpet_hz;
+extern uint64_t hpet_mask; // 32 bit counters wrap.
+
+#endif
@@ -0,0 +1,189 @@
+#include "hrtimer.h"
+#include "clocksource.h"
+#include "percpu.h"
+#include "tick.h"
+#include "timing.h"
+#include "common/spinlock.h"
+
+typedef struct HrtimerBase
+{
+    spinlock_t lock;
+    uint32_t count;
+    hrtimer_t *heap[HRTIMER_MAX_PER_CPU];
+} hrtimer_base_t;
+
+static hrtimer_base_t hrtimer_bases[MAX_CPUS];
+uint64_t hrtimer_default_slack = HRTIMER_DEFAULT_SLACK_NS;
+
+static inline void heap_set(hrtimer_base_t *base, uint32_t i, hrtimer_t *timer) {
+    base->heap[i] = timer;
+    timer->index = (int32_t)i;
+}
+
+static void heap_up(hrtimer_base_t *base, uint32_t i) {
+    hrtimer_t *timer = base->heap[i];
+    while (i > 0)
+    {
+        uint32_t parent = (i - 1) / 2;
+        if (base->heap[parent]->hard <= timer->hard) break;
+        heap_set(base, i, base->heap[parent]);
+        i = parent;
+    }
+    heap_set(base, i, timer);
+}
+
+static void heap_down(hrtimer_base_t *base, uint32_t i) {
+    hrtimer_t *timer = base->heap[i];
+    for (;;)
+    {
+        uint32_t child = 2 * i + 1;
+        if (child >= base->count) break;
+        if (child + 1 < base->count && base->heap[child + 1]->hard < base->heap[child]->hard) child++;
+        if (timer->hard <= base->heap[child]->hard) break;
+        heap_set(base, i, base->heap[child]);
+        i = child;
+    }
+    heap_set(base, i, timer);
+}
+
+static void heap_remove(hrtimer_base_t *base, hrtimer_t *timer) {
+    uint32_t i = (uint32_t)timer->index;
+    hrtimer_t *last = base->heap[--base->count];
+    timer->index = -1;
+    if (last == timer) return;
+
+    heap_set(base, i, last);
+    if (i > 0 && base->heap[(i - 1) / 2]->hard > last->hard) heap_up(base, i);
+    else heap_down(base, i);
+}
+
+#define HRTIMER_TSC_SHIFT 24
+#define HRTIMER_MAX_SLEEP_NS (1ULL << 40) // Far away ones get an early look instead of an overflow.
+
+static uint64_t ns_to_tsc_delta(uint64_t ns) {
+    static uint64_t mult; // TSC cycles per ns << HRTIMER_TSC_SHIFT, set once tick_tsc_per_jiffy is.
+    if (mult == 0) mult = (tick_tsc_per_jiffy * TIMER_HZ << HRTIMER_TSC_SHIFT) / NSEC_PER_SEC;
+    return ((unsigned __int128)ns * mult) >> HRTIMER_TSC_SHIFT;
+}
+
+// Interrupts off, base locked.
+static void hrtimer_reprogram(hrtimer_base_t *base) {
+    if (tick_tsc_per_jiffy == 0) return; // The tick polls us.
+
+    uint64_t next = ~0ULL;
+    if (base->count)
+    {
+        uint64_t now = ktime_get_ns();
+        uint64_t hard = base->heap[0]->hard;
+        uint64_t delta = hard > now ? MIN(hard - now, HRTIMER_MAX_SLEEP_NS) : 0;
+        next = rdtsc() + ns_to_tsc_delta(delta);
+    }
+    this_cpu_write(hrtimer_next, next);
+    tick_arm();
+}
+
+void hrtimer_setup(hrtimer_t *timer, void (*fn)(hrtimer_t *timer), void *data) {
+    timer->expires = 0;
+    timer->hard = 0;
+    timer->slack = hrtimer_default_slack;
+    timer->index = -1;
+    timer->running = false;
+    timer->fn = fn;
+    timer->data = data;
+    timer->base = NULL;
+}
+
+void hrtimer_set_slack(hrtimer_t *timer, uint64_t slack_ns) {
+    timer->slack = slack_ns;
+}
+
+bool hrtimer_active(const hrtimer_t *timer) {
+    return timer->index >= 0;
+}
+
+// Takes the timer off whatever base it is queued on. Interrupts off.
+static bool hrtimer_dequeue(hrtimer_t *timer) {
+    for (;;)
+    {
+        hrtimer_base_t *base = timer->base;
+        if (base == NULL) return false;
+
+        spin_lock(&base->lock);
+        if (base != timer->base)
+        {
+            spin_unlock(&base->lock); // Moved meanwhile.
+            continue;
+        }
+        bool was_queued = hrtimer_active(timer);
+        if (was_queued)
+        {
+            bool first = base->heap[0] == timer;
+            heap_remove(base, timer);
+            // Only the owner may touch its APIC, a remote one just fires early.
+            if (first && base == &hrtimer_bases[cpu_index()]) hrtimer_reprogram(base);
+        }
+        spin_unlock(&base->lock);
+        return was_queued;
+    }
+}
+
+bool hrtimer_start(hrtimer_t *timer, uint64_t expires_ns) {
+    uint64_t flags = irq_save();
+    hrtimer_dequeue(timer);
+
+    hrtimer_base_t *base = &hrtimer_bases[tick_tsc_per_jiffy ? cpu_index() : 0];
+    spin_lock(&base->lock);
+    bool queued = base->count < HRTIMER_MAX_PER_CPU;
+    if (queued)
+    {
+        timer->base = base;
+        timer->expires = expires_ns;
+        timer->hard = expires_ns + timer->slack;
+        if (timer->hard < expires_ns) timer->hard = ~0ULL;
+        heap_set(base, base->count++, timer);
+        heap_up(base, (uint32_t)timer->index);
+        if (base->heap[0] == timer) hrtimer_reprogram(base);
+    }
+    spin_unlock(&base->lock);
+    irq_restore(flags);
+    return queued;
+}
+
+bool hrtimer_start_rel(hrtimer_t *timer, uint64_t delta_ns) {
+    return hrtimer_start(timer, ktime_get_ns() + delta_ns);
+}
+
+bool hrtimer_cancel(hrtimer_t *timer) {
+    uint64_t flags = irq_save();
+    bool was_queued = hrtimer_dequeue(timer);
+    irq_restore(flags);
+    return was_queued;
+}
+
+bool hrtimer_cancel_sync(hrtimer_t *timer) {
+    bool was_queued = hrtimer_cancel(timer);
+    while (timer->running) __builtin_ia32_pause();
+    return was_queued;
+}
+
+void hrtimer_run() {
+    hrtimer_base_t *base = &hrtimer_bases[tick_tsc_per_jiffy ? cpu_index() : 0];
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+
+    uint64_t now = ktime_get_ns();
+    while (base->count && base->heap[0]->expires <= now)
+    {
+        hrtimer_t *timer = base->heap[0];
+        heap_remove(base, timer);
+        timer->running = true;
+        spin_unlock(&base->lock);
+
+        timer->fn(timer); // May start it again.
+
+        spin_lock(&base->lock);
+        __atomic_store_n(&timer->running, false, __ATOMIC_RELEASE);
+        now = ktime_get_ns();
+    }
+    hrtimer_reprogram(base);
+    spin_unlock_irqrestore(&base->lock, flags);
+}
@@ -0,0 +1,48 @@
+#ifndef HRTIMER_H
+#define HRTIMER_H
+
+#include "common/types.h"
+
+// High resolution timers: absolute ktime_get_ns() deadlines in a per-CPU
+// min-heap, the local APIC timer (TSC-deadline or one-shot) programmed for
+// the earliest one. Each timer may fire anywhere in [expires, expires +
+// slack]; the heap is ordered by the end of that window and an interrupt
+// runs everything whose window has opened, so timers close together share
+// one interrupt.
+//
+// Callbacks run in interrupt context on the CPU the timer was started on.
+// Without a calibrated local APIC they fall back to the tick.
+
+#define HRTIMER_MAX_PER_CPU 512
+#define HRTIMER_DEFAULT_SLACK_NS 50000ULL
+
+struct HrtimerBase;
+
+typedef struct Hrtimer
+{
+    uint64_t expires; // Soft expiry, ns.
+    uint64_t hard;    // expires + slack.
+    uint64_t slack;
+    int32_t index;    // Heap slot, -1 while not queued.
+    volatile bool running;
+    void (*fn)(struct Hrtimer *timer);
+    void *data;
+    struct HrtimerBase *base;
+} hrtimer_t;
+
+void hrtimer_setup(hrtimer_t *timer, void (*fn)(hrtimer_t *timer), void *data);
+void hrtimer_set_slack(hrtimer_t *timer, uint64_t slack_ns);
+
+// Queues (or moves) the timer on this CPU. False if its heap is full.
+bool hrtimer_start(hrtimer_t *timer, uint64_t expires_ns);
+bool hrtimer_start_rel(hrtimer_t *timer, uint64_t delta_ns);
+bool hrtimer_cancel(hrtimer_t *timer);      // Was it queued.
+bool hrtimer_cancel_sync(hrtimer_t *timer); // And wait for a running callback.
+bool hrtimer_active(const hrtimer_t *timer);
+
+// Local APIC timer interrupt, and the tick on PIT-only systems.
+void hrtimer_run();
+
+extern uint64_t hrtimer_default_slack;
+
+#endif
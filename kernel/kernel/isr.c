@@ -0,0 +1,284 @@
+#include "common/types.h"
+#include "common/isr.h"
+#include "gdt.h"
+#include "idt.h"
+#include "timing.h"
+#include "cpu.h"
+#include "apic.h"
+#include "smp.h"
+#include "tick.h"
+#include "scheduler.h"
+#include "rcu.h"
+#include "common/spinlock.h"
+#include "syscall.h"
+#include "uaccess.h"
+
+// Interrupt entry/exit and the legacy 8259 PIC.
+
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA    0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA    0xA1
+#define PIC_EOI      0x20
+
+#define IDT_INTERRUPT_GATE 0x8E
+#define IDT_USER_GATE      0xEE // DPL 3, for int $0x80 from user space.
+
+#define IRQ_HANDLER_POOL 64
+
+#define EXCEPTION_PAGE_FAULT 14
+
+// Every stub pushes an error code (the CPU does it for some exceptions) and
+// its vector, then the common part saves the registers in the order of
+// AsmPassedInterrupt and calls handle_interrupt().
+__asm__ (
+    ".text\n"
+    ".macro ISR_NOERR n\n"
+    "isr\\n:\n\t"
+    "pushq $0\n\t"
+    "pushq $\\n\n\t"
+    "jmp isr_common\n"
+    ".endm\n"
+    ".macro ISR_ERR n\n"
+    "isr\\n:\n\t"
+    "pushq $\\n\n\t"
+    "jmp isr_common\n"
+    ".endm\n"
+
+    ".irp n, 0,1,2,3,4,5,6,7,9,15,16,18,19,20,22,23,24,25,26,27,28,31\n"
+    "ISR_NOERR \\n\n"
+    ".endr\n"
+    ".irp n, 8,10,11,12,13,14,17,21,29,30\n"
+    "ISR_ERR \\n\n"
+    ".endr\n"
+    ".irp n, 32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49\n"
+    "ISR_NOERR \\n\n"
+    ".endr\n"
+    ".global isr128\n"
+    "ISR_NOERR 128\n"
+    ".global isr255\n"
+    "ISR_NOERR 255\n"
+
+    // From user mode GS still holds the user base, swap in the per-CPU one.
+    "isr_common:\n\t"
+    "testb $3, 24(%rsp)\n\t"
+    "jz 1f\n\t"
+    "swapgs\n"
+    "1:\n\t"
+    "pushq %rax\n\t"
+    "pushq %rbx\n\t"
+    "pushq %rcx\n\t"
+    "pushq %rdx\n\t"
+    "pushq %rsi\n\t"
+    "pushq %rdi\n\t"
+    "pushq %rbp\n\t"
+    "pushq %r8\n\t"
+    "pushq %r9\n\t"
+    "pushq %r10\n\t"
+    "pushq %r11\n\t"
+    "pushq %r12\n\t"
+    "pushq %r13\n\t"
+    "pushq %r14\n\t"
+    "pushq %r15\n\t"
+    "movq %ds, %rax\n\t"
+    "pushq %rax\n\t"
+    "movq %rsp, %rdi\n\t"
+    "cld\n\t"
+    // The frame is 23 qwords on a 16 byte aligned stack, realign it for C.
+    // rbx is callee-saved and already in the frame.
+    "movq %rsp, %rbx\n\t"
+    "andq $-16, %rsp\n\t"
+    "call handle_interrupt\n\t"
+    "movq %rbx, %rsp\n"
+
+    ".global asm_isr_exit\n"
+    "asm_isr_exit:\n\t"
+    "popq %rax\n\t"
+    "movw %ax, %ds\n\t"
+    "movw %ax, %es\n\t"
+    "popq %r15\n\t"
+    "popq %r14\n\t"
+    "popq %r13\n\t"
+    "popq %r12\n\t"
+    "popq %r11\n\t"
+    "popq %r10\n\t"
+    "popq %r9\n\t"
+    "popq %r8\n\t"
+    "popq %rbp\n\t"
+    "popq %rdi\n\t"
+    "popq %rsi\n\t"
+    "popq %rdx\n\t"
+    "popq %rcx\n\t"
+    "popq %rbx\n\t"
+    "popq %rax\n\t"
+    "addq $16, %rsp\n\t" // Vector and error code.
+    "testb $3, 8(%rsp)\n\t"
+    "jz 1f\n\t"
+    "swapgs\n"
+    "1:\n\t"
+    "iretq\n"
+
+    // Stub addresses indexed by vector (0 - 49), relocated like any other data.
+    ".data\n"
+    ".global asm_isr_redirect_table\n"
+    "asm_isr_redirect_table:\n"
+    ".irp n, 0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25,26,27,28,29,30,31\n"
+    ".quad isr\\n\n"
+    ".endr\n"
+    ".irp n, 32,33,34,35,36,37,38,39,40,41,42,43,44,45,46,47,48,49\n"
+    ".quad isr\\n\n"
+    ".endr\n"
+    ".text\n"
+);
+
+// Walked by every interrupt, changed about never: readers use RCU, the
+// writers take irq_chain_lock.
+static irqHandler *irq_chains[ISR_IRQ_COUNT];
+static irqHandler irq_pool[IRQ_HANDLER_POOL];
+static size_t irq_pool_used;
+static irqHandler *irq_pool_free; // Unregistered, after a grace period.
+static spinlock_t irq_chain_lock = SPINLOCK_INIT;
+static FunctionPtr exception_handlers[32];
+
+static inline void io_wait(void) { outbyte(0x80, 0); }
+
+static void pic_remap(void) {
+    // ICW1: init + ICW4 needed, ICW2: vector offsets, ICW3: cascade on IRQ2, ICW4: 8086 mode.
+    outbyte(PIC1_COMMAND, 0x11); io_wait();
+    outbyte(PIC2_COMMAND, 0x11); io_wait();
+    outbyte(PIC1_DATA, ISR_IRQ_BASE); io_wait();
+    outbyte(PIC2_DATA, ISR_IRQ_BASE + 8); io_wait();
+    outbyte(PIC1_DATA, 4); io_wait();
+    outbyte(PIC2_DATA, 2); io_wait();
+    outbyte(PIC1_DATA, 0x01); io_wait();
+    outbyte(PIC2_DATA, 0x01); io_wait();
+
+    // Everything masked until somebody registers a handler (cascade stays open).
+    outbyte(PIC1_DATA, 0xFB);
+    outbyte(PIC2_DATA, 0xFF);
+}
+
+static void pic_unmask(uint8_t irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outbyte(port, inbyte(port) & ~(1 << (irq % 8)));
+}
+
+static void pic_mask(uint8_t irq) {
+    uint16_t port = irq < 8 ? PIC1_DATA : PIC2_DATA;
+    outbyte(port, inbyte(port) | (1 << (irq % 8)));
+}
+
+static void pic_eoi(uint8_t irq) {
+    if (irq >= 8) outbyte(PIC2_COMMAND, PIC_EOI);
+    outbyte(PIC1_COMMAND, PIC_EOI);
+}
+
+void initiateISR() {
+    for (int vector = 0; vector < ISR_LAPIC_TIMER + ISR_APIC_COUNT; vector++)
+        set_idt_gate(vector, (uint64_t)asm_isr_redirect_table[vector], IDT_INTERRUPT_GATE);
+    set_idt_gate(ISR_SYSCALL, (uint64_t)isr128, IDT_USER_GATE);
+    set_idt_gate(ISR_LAPIC_SPURIOUS, (uint64_t)isr255, IDT_INTERRUPT_GATE);
+
+    pic_remap();
+}
+
+irqHandler *registerIRQhandler(uint8_t id, void *handler) {
+    if (id >= ISR_IRQ_COUNT) return NULL;
+
+    uint64_t flags = spin_lock_irqsave(&irq_chain_lock);
+    irqHandler *node = irq_pool_free;
+    if (node) irq_pool_free = node->next;
+    else if (irq_pool_used < IRQ_HANDLER_POOL) node = &irq_pool[irq_pool_used++];
+    if (node == NULL)
+    {
+        spin_unlock_irqrestore(&irq_chain_lock, flags);
+        return NULL;
+    }
+    node->id = id;
+    node->handler = (FunctionPtr)handler;
+    node->argument = 0;
+    node->next = irq_chains[id];
+    rcu_assign_pointer(irq_chains[id], node);
+    pic_unmask(id);
+    spin_unlock_irqrestore(&irq_chain_lock, flags);
+
+    return node;
+}
+
+void unregisterIRQhandler(irqHandler *node) {
+    uint64_t flags = spin_lock_irqsave(&irq_chain_lock);
+    irqHandler **link = &irq_chains[node->id];
+    while (*link && *link != node) link = &(*link)->next;
+    if (*link == NULL)
+    {
+        spin_unlock_irqrestore(&irq_chain_lock, flags);
+        return;
+    }
+    rcu_assign_pointer(*link, node->next); // Interrupts walking it right now still get past it.
+    if (irq_chains[node->id] == NULL && node->id != 2) pic_mask(node->id); // The cascade stays open.
+    spin_unlock_irqrestore(&irq_chain_lock, flags);
+
+    synchronize_rcu();
+    flags = spin_lock_irqsave(&irq_chain_lock);
+    node->next = irq_pool_free;
+    irq_pool_free = node;
+    spin_unlock_irqrestore(&irq_chain_lock, flags);
+}
+
+void registerExceptionHandler(uint8_t vector, FunctionPtr handler) {
+    if (vector < 32) exception_handlers[vector] = handler;
+}
+
+void handle_interrupt(AsmPassedInterrupt *regs) {
+    uint64_t vector = regs->interrupt;
+
+    if (vector < 32)
+    {
+        if (exception_handlers[vector])
+        {
+            exception_handlers[vector](regs);
+            return;
+        }
+        if (vector == EXCEPTION_PAGE_FAULT && uaccess_fixup(regs)) return;
+        printf_("Exception %lu (error %lx) at %lx\n", vector, regs->error, regs->rip);
+        for (;;) {
+            irq_disable();
+            cpu_halt();
+        }
+    }
+
+    rcu_irq_enter();
+    if (vector != ISR_LAPIC_TIMER) tick_irq_enter();
+
+    if (vector >= ISR_IRQ_BASE && vector < ISR_IRQ_BASE + ISR_IRQ_COUNT)
+    {
+        uint8_t irq = (uint8_t)(vector - ISR_IRQ_BASE);
+        rcu_read_lock();
+        for (irqHandler *node = rcu_dereference(irq_chains[irq]); node; node = rcu_dereference(node->next))
+            node->handler(regs);
+        rcu_read_unlock();
+        pic_eoi(irq);
+    }
+    else if (vector >= ISR_LAPIC_TIMER && vector < ISR_LAPIC_TIMER + ISR_APIC_COUNT)
+    {
+        lapic_interrupt(vector);
+    }
+    else if (vector == ISR_SYSCALL)
+    {
+        syscall_dispatch(regs);
+    }
+    else if (vector == ISR_LAPIC_SPURIOUS)
+    {
+        rcu_irq_exit();
+        return; // No EOI for these.
+    }
+    this_cpu_inc(interrupts);
+    rcu_irq_exit();
+
+    // Preemption point: the interrupted thread continues when it gets picked
+    // again. Not out of an RCU read-side section, rcu_read_unlock() does it.
+    if (sched_need_resched() && !rcu_read_lock_held()) sched_preempt();
+    // Nothing of a process returning to user mode is left on its kernel
+    // stack, so a killed one can go here.
+    if ((regs->cs & 3) && sched_killed()) process_exit();
+}
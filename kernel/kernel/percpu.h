@@ -0,0 +1,81 @@
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include "common/types.h"
+
+#define MAX_CPUS 16
+
+struct Process;
+struct RunQueue;
+
+// Per-CPU data block. In kernel mode GS points at the running CPU's block,
+// so the this_cpu_* accessors below are one gs: relative instruction each
+// and need neither a lock nor the CPU number. Interrupts have to be off (or
+// the value only used as a hint) if the task could migrate in between.
+typedef struct CpuData
+{
+    struct CpuData *self; // Has to stay first.
+    uint32_t index;
+    uint32_t lapic_id;
+    struct Process *curr;
+    struct RunQueue *rq;
+    volatile bool online;
+
+    // Lazy FPU switching, see fpu.h:
+    struct Process *fpu_owner; // Running and allowed to touch the registers.
+    struct Process *fpu_regs;  // Whose state the registers hold.
+    bool fpu_ts;               // CR0.TS is set.
+
+    // Tick, see tick.h:
+    uint64_t tick_next;    // TSC of the next tick, ~0 when stopped.
+    uint64_t hrtimer_next; // TSC of the first hrtimer, ~0 if none.
+    uint8_t tick_state;
+
+    // RCU, see rcu.h:
+    uint32_t rcu_nesting;       // Read-side sections we're in.
+    uint32_t rcu_idle;          // Idle, grace periods don't wait for us.
+    bool rcu_irq_from_idle;     // The interrupt being handled came in while idle.
+    uint64_t rcu_qs_gp;         // Grace period we last passed a quiescent state in.
+
+    // Statistics, only ever written by their own CPU:
+    uint64_t interrupts;
+    uint64_t preemptions;
+    uint64_t ticks;
+    uint64_t wakeups;       // Woken processes that got this CPU,
+    uint64_t wakeup_cycles; // and how long they waited for it in total
+    uint64_t wakeup_max;    // and at worst (TSC cycles).
+} __attribute__((aligned(64))) cpu_data_t;
+
+extern cpu_data_t cpu_data[MAX_CPUS];
+
+#define percpu_type(field) __typeof__(((cpu_data_t *)0)->field)
+
+// Plain mov/add: the assembler takes the operand size from the register.
+#define this_cpu_read(field) __extension__ ({                                      \
+    percpu_type(field) __ret;                                                      \
+    __asm__ __volatile__ ("mov %%gs:%c1, %0"                                       \
+                          : "=r"(__ret) : "i"(offsetof(cpu_data_t, field)));       \
+    __ret; })
+
+#define this_cpu_write(field, val) do {                                            \
+    percpu_type(field) __val = (val);                                              \
+    __asm__ __volatile__ ("mov %0, %%gs:%c1"                                       \
+                          : : "r"(__val), "i"(offsetof(cpu_data_t, field)) : "memory"); \
+} while (0)
+
+#define this_cpu_add(field, val) do {                                              \
+    percpu_type(field) __val = (val);                                              \
+    __asm__ __volatile__ ("add %0, %%gs:%c1"                                       \
+                          : : "r"(__val), "i"(offsetof(cpu_data_t, field)) : "memory", "cc"); \
+} while (0)
+
+#define this_cpu_inc(field) this_cpu_add(field, 1)
+
+static force_inline cpu_data_t *this_cpu(void) { return this_cpu_read(self); }
+static force_inline uint32_t cpu_index(void) { return this_cpu_read(index); }
+
+// Points GS at cpu_data[cpu]. Loading the GS selector clears the base, so
+// this has to come after the GDT is (re)loaded.
+void percpu_init(uint32_t cpu);
+
+#endif
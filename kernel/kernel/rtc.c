@@ -0,0 +1,72 @@
+#include "rtc.h"
+#include "timing.h"
+
+#define CMOS_INDEX 0x70
+#define CMOS_DATA  0x71
+
+#define RTC_STATUS_A 0x0A // Bit 7: update in progress.
+#define RTC_STATUS_B 0x0B // Bit 1: 24 hour mode, bit 2: binary instead of BCD.
+
+typedef struct RtcTime
+{
+    uint8_t second, minute, hour, day, month, year;
+} rtc_time_t;
+
+static uint8_t cmos_read(uint8_t reg) {
+    outbyte(CMOS_INDEX, reg);
+    return inbyte(CMOS_DATA);
+}
+
+static void rtc_read_raw(rtc_time_t *t) {
+    while (cmos_read(RTC_STATUS_A) & 0x80) __builtin_ia32_pause();
+    t->second = cmos_read(0x00);
+    t->minute = cmos_read(0x02);
+    t->hour = cmos_read(0x04);
+    t->day = cmos_read(0x07);
+    t->month = cmos_read(0x08);
+    t->year = cmos_read(0x09);
+}
+
+static uint8_t bcd(uint8_t v) {
+    return (v & 0x0F) + (v >> 4) * 10;
+}
+
+// Days from 1970-01-01 to the given civil date.
+static int64_t days_from_civil(int64_t y, uint32_t m, uint32_t d) {
+    y -= m <= 2;
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    uint32_t yoe = (uint32_t)(y - era * 400);
+    uint32_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+uint64_t rtc_read_epoch() {
+    rtc_time_t a, b;
+    // Two identical reads in a row, or we caught it mid update.
+    rtc_read_raw(&b);
+    do
+    {
+        a = b;
+        rtc_read_raw(&b);
+    } while (a.second != b.second || a.minute != b.minute || a.hour != b.hour ||
+             a.day != b.day || a.month != b.month || a.year != b.year);
+
+    uint8_t status = cmos_read(RTC_STATUS_B);
+    bool pm = b.hour & 0x80;
+    b.hour &= 0x7F;
+    if (!(status & 0x04))
+    {
+        b.second = bcd(b.second);
+        b.minute = bcd(b.minute);
+        b.hour = bcd(b.hour);
+        b.day = bcd(b.day);
+        b.month = bcd(b.month);
+        b.year = bcd(b.year);
+    }
+    if (!(status & 0x02)) b.hour = (b.hour % 12) + (pm ? 12 : 0);
+    if (b.month < 1 || b.month > 12 || b.day < 1 || b.day > 31) return 0;
+
+    int64_t days = days_from_civil(2000 + b.year, b.month, b.day);
+    return (uint64_t)(days * 86400 + b.hour * 3600 + b.minute * 60 + b.second);
+}
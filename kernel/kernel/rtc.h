@@ -0,0 +1,10 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include "common/types.h"
+
+// CMOS real time clock, read once at boot for the wall clock.
+// Seconds since 1970-01-01 UTC, assuming the RTC keeps UTC in the 2000s.
+uint64_t rtc_read_epoch();
+
+#endif
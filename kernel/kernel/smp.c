@@ -0,0 +1,89 @@
+#include "smp.h"
+#include "apic.h"
+#include "gdt.h"
+#include "idt.h"
+#include "timing.h"
+#include "common/isr.h"
+#include "vulnerable/bootloader.h"
+#include "scheduler.h"
+#include "fpu.h"
+#include "tick.h"
+
+static volatile struct limine_smp_request smp_request = {
+    .id = LIMINE_SMP_REQUEST,
+    .revision = 0,
+    .flags = 0 // xAPIC, lapic_mmio is what cpu_index() reads.
+};
+
+cpu_data_t cpu_data[MAX_CPUS];
+
+static volatile uint32_t cpus_online = 1;
+
+static void ap_entry(struct limine_smp_info *info) {
+    uint32_t cpu = (uint32_t)info->extra_argument;
+
+    gdt_init_cpu(cpu);
+    percpu_init(cpu);
+    fpu_init_cpu();
+    set_idt();
+    lapic_init_cpu();
+    sched_init_cpu(cpu);
+    tick_start_cpu();
+
+    cpu_data[cpu].online = true;
+    __atomic_add_fetch(&cpus_online, 1, __ATOMIC_RELEASE);
+
+    irq_enable();
+    evaluate_loop();
+}
+
+void percpu_init(uint32_t cpu) {
+    cpu_data[cpu].self = &cpu_data[cpu];
+    cpu_data[cpu].index = cpu;
+    cpu_data[cpu].tick_next = ~0ULL;
+    cpu_data[cpu].hrtimer_next = ~0ULL;
+    wrmsr(MSRID_GSBASE, (uint64_t)&cpu_data[cpu]);
+    wrmsr(MSRID_KERNEL_GSBASE, 0); // User GS, swapped in on the way out.
+}
+
+void smp_init() {
+    lapic_init();
+    tick_init();
+
+    uint32_t bsp = lapic_id();
+    cpu_data[0].lapic_id = bsp;
+    cpu_data[0].online = true;
+
+    struct limine_smp_response *response = smp_request.response;
+    if (response == NULL) return;
+
+    uint32_t count = 1;
+    for (uint64_t i = 0; i < response->cpu_count && count < MAX_CPUS; i++)
+    {
+        struct limine_smp_info *info = response->cpus[i];
+        if (info->lapic_id == bsp || info->lapic_id > 0xFF) continue;
+
+        cpu_data[count].lapic_id = info->lapic_id;
+        info->extra_argument = count;
+        count++;
+    }
+
+    for (uint64_t i = 0; i < response->cpu_count; i++)
+    {
+        struct limine_smp_info *info = response->cpus[i];
+        if (info->lapic_id == bsp || info->lapic_id > 0xFF || info->extra_argument == 0) continue;
+        __atomic_store_n(&info->goto_address, ap_entry, __ATOMIC_RELEASE);
+    }
+
+    while (__atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE) < count) __builtin_ia32_pause();
+    printf_("smp: %u CPUs online\n", count);
+}
+
+uint32_t smp_cpus_online() {
+    return __atomic_load_n(&cpus_online, __ATOMIC_ACQUIRE);
+}
+
+void smp_send_resched(uint32_t cpu) {
+    if (cpu >= MAX_CPUS || !cpu_data[cpu].online || cpu == cpu_index()) return;
+    lapic_send_ipi(cpu_data[cpu].lapic_id, ISR_IPI_RESCHED);
+}
@@ -0,0 +1,15 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include "common/types.h"
+#include "cpu.h"
+
+// Starts every application processor Limine found. They join the scheduler
+// with their boot stack as idle thread.
+void smp_init();
+uint32_t smp_cpus_online();
+
+// Kicks another CPU into checking its need_resched flag.
+void smp_send_resched(uint32_t cpu);
+
+#endif
@@ -0,0 +1,113 @@
+#include "tick.h"
+#include "apic.h"
+#include "cpu.h"
+#include "smp.h"
+#include "timing.h"
+#include "common/isr.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "hrtimer.h"
+#include "rcu.h"
+
+extern volatile uint64_t jiffies_64;
+
+uint64_t tick_tsc_per_jiffy = 0;
+static uint64_t tick_tsc_base; // TSC at jiffies == tick_jiffies_base.
+static uint64_t tick_jiffies_base;
+
+// Jiffies follow the TSC now, whichever CPU happens to be awake moves them.
+static void jiffies_update(void) {
+    uint64_t now = tick_jiffies_base + (rdtsc() - tick_tsc_base) / tick_tsc_per_jiffy;
+    uint64_t seen = jiffies_64;
+    while (now > seen && !__atomic_compare_exchange_n(&jiffies_64, &seen, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+uint64_t get_jiffies() {
+    if (tick_tsc_per_jiffy) jiffies_update(); // The PIT counts them itself.
+    return jiffies_64;
+}
+
+// TSC at which jiffies reaches j.
+static uint64_t jiffy_to_tsc(uint64_t j) {
+    if (j == TIMER_NONE) return ~0ULL;
+    uint64_t delta = j > tick_jiffies_base ? j - tick_jiffies_base : 0;
+    if (delta > (~0ULL - tick_tsc_base) / tick_tsc_per_jiffy) return ~0ULL;
+    return tick_tsc_base + delta * tick_tsc_per_jiffy;
+}
+
+void tick_arm() {
+    if (tick_tsc_per_jiffy == 0) return;
+    uint64_t next = MIN(this_cpu_read(tick_next), this_cpu_read(hrtimer_next));
+    if (next == ~0ULL) lapic_timer_disarm();
+    else lapic_timer_arm(next);
+}
+
+static void tick_program(uint64_t next, ETickState state) {
+    this_cpu_write(tick_next, next);
+    this_cpu_write(tick_state, (uint8_t)state);
+    tick_arm();
+}
+
+static void tick_handle(void) {
+    jiffies_update();
+    this_cpu_inc(ticks);
+    timer_run();
+    sched_tick();
+
+    uint64_t now = rdtsc();
+    uint64_t next = this_cpu_read(tick_next) + tick_tsc_per_jiffy;
+    if (next <= now) next = now + tick_tsc_per_jiffy; // Missed some, don't try to catch up.
+
+    if (sched_can_stop_tick() && !rcu_needs_cpu())
+        tick_program(MIN(now + TICK_NOHZ_BUSY_JIFFIES * tick_tsc_per_jiffy, jiffy_to_tsc(timer_next_expiry())), TICK_DEFERRED);
+    else tick_program(next, TICK_PERIODIC);
+}
+
+void tick_interrupt() {
+    hrtimer_run();
+    if (rdtsc() >= this_cpu_read(tick_next)) tick_handle();
+}
+
+void tick_irq_enter() {
+    if (tick_tsc_per_jiffy == 0 || this_cpu_read(tick_state) == TICK_PERIODIC) return;
+    jiffies_update();
+    tick_program(rdtsc() + tick_tsc_per_jiffy, TICK_PERIODIC);
+}
+
+void tick_nohz_idle_enter() {
+    if (tick_tsc_per_jiffy == 0 || this_cpu_read(tick_state) == TICK_STOPPED) return;
+    uint64_t next = timer_next_expiry();
+    if (next != TIMER_NONE)
+    {
+        tick_program(jiffy_to_tsc(next), TICK_STOPPED); // Sleep until the first timer.
+        return;
+    }
+    tick_program(~0ULL, TICK_STOPPED);
+}
+
+void tick_nohz_kick(uint32_t cpu) {
+    if (tick_tsc_per_jiffy == 0 || cpu_data[cpu].tick_state == TICK_PERIODIC) return;
+    if (cpu == cpu_index()) tick_irq_enter();
+    else lapic_send_ipi(cpu_data[cpu].lapic_id, ISR_IPI_RESCHED);
+}
+
+void tick_start_cpu() {
+    if (tick_tsc_per_jiffy == 0) return;
+    lapic_timer_setup();
+    tick_program(rdtsc() + tick_tsc_per_jiffy, TICK_PERIODIC);
+}
+
+void tick_init() {
+    if (lapic_ticks_per_jiffy == 0 || lapic_tsc_per_jiffy == 0) return; // Stay on the PIT.
+
+    uint64_t flags = irq_save();
+    tick_tsc_base = rdtsc();
+    tick_jiffies_base = jiffies_64;
+    tick_tsc_per_jiffy = lapic_tsc_per_jiffy;
+    pit_stop();
+    tick_start_cpu();
+    irq_restore(flags);
+
+    printf_("tick: %s, %lu kHz TSC\n", lapic_has_deadline() ? "tsc-deadline" : "one-shot",
+            tick_tsc_per_jiffy * TIMER_HZ / 1000);
+}
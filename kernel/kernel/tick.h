@@ -0,0 +1,31 @@
+#ifndef TICK_H
+#define TICK_H
+
+#include "common/types.h"
+
+// Scheduler tick on the local APIC timer, programmed one event at a time.
+// Idle CPUs stop it altogether, a CPU running a single process stretches it
+// to TICK_NOHZ_BUSY_JIFFIES. Any other interrupt brings the regular tick
+// back, the idle loop and the next tick decide again whether to drop it.
+
+#define TICK_NOHZ_BUSY_JIFFIES 100
+
+typedef enum { TICK_PERIODIC, TICK_DEFERRED, TICK_STOPPED } ETickState;
+
+void tick_init();      // BSP, after lapic_init(). Takes over from the PIT.
+void tick_start_cpu(); // Every other CPU.
+
+void tick_interrupt(); // Local APIC timer, shared with the hrtimers.
+void tick_irq_enter(); // Every interrupt but the tick itself.
+void tick_arm();       // Interrupts off: the earlier of tick_next and hrtimer_next.
+
+// Idle loop, interrupts off: nothing to run, stop ticking until the next timer.
+void tick_nohz_idle_enter();
+
+// Somebody queued work on cpu, it needs its tick for time slicing again.
+void tick_nohz_kick(uint32_t cpu);
+
+// Cycles per jiffy, 0 while the PIT still drives the tick.
+extern uint64_t tick_tsc_per_jiffy;
+
+#endif
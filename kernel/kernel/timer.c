@@ -0,0 +1,228 @@
+#include "timer.h"
+#include "percpu.h"
+#include "timing.h"
+#include "tick.h"
+#include "common/spinlock.h"
+
+// Level 0 has a slot per jiffy for the next 256, each level above a slot
+// per 2^(8 + 6 * (level - 1)) jiffies.
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TIMER_LEVELS 5
+#define TIMER_MAX_DELTA 0xFFFFFFFFULL
+
+#define LEVEL_SHIFT(level) (TVR_BITS + ((level) - 1) * TVN_BITS)
+#define INDEX(clk, level) (((clk) >> LEVEL_SHIFT(level)) & TVN_MASK)
+
+typedef struct TimerBase
+{
+    spinlock_t lock;
+    uint64_t clk; // Next jiffy to process.
+    uint64_t pending;
+    ktimer_t *running;
+    uint32_t cpu;
+    ktimer_t *tv1[TVR_SIZE];
+    ktimer_t *tvn[TIMER_LEVELS - 1][TVN_SIZE];
+} timer_base_t;
+
+static timer_base_t timer_bases[MAX_CPUS];
+
+static void slot_insert(ktimer_t **slot, ktimer_t *timer) {
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+static void timer_detach(timer_base_t *base, ktimer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    base->pending--;
+}
+
+static void internal_add_timer(timer_base_t *base, ktimer_t *timer) {
+    uint64_t expires = timer->expires;
+    uint64_t delta = expires - base->clk;
+    ktimer_t **slot;
+
+    if ((int64_t)delta < 0)
+    {
+        slot = &base->tv1[base->clk & TVR_MASK]; // Already due, next tick.
+    }
+    else if (delta < TVR_SIZE)
+    {
+        slot = &base->tv1[expires & TVR_MASK];
+    }
+    else
+    {
+        if (delta > TIMER_MAX_DELTA)
+        {
+            delta = TIMER_MAX_DELTA;
+            expires = base->clk + delta;
+        }
+        uint32_t level = 1;
+        while (level < TIMER_LEVELS - 1 && delta >= (1ULL << LEVEL_SHIFT(level + 1))) level++;
+        slot = &base->tvn[level - 1][INDEX(expires, level)];
+    }
+    slot_insert(slot, timer);
+    base->pending++;
+}
+
+// Spreads one slot of level over the levels below, returns its index so the
+// caller knows whether this level wrapped around as well.
+static uint32_t cascade(timer_base_t *base, uint32_t level) {
+    uint32_t index = INDEX(base->clk, level);
+    ktimer_t *timer = base->tvn[level - 1][index];
+    base->tvn[level - 1][index] = NULL;
+    while (timer)
+    {
+        ktimer_t *next = timer->next;
+        base->pending--;
+        internal_add_timer(base, timer);
+        timer = next;
+    }
+    return index;
+}
+
+// Exact for level 0. For the levels above, the jiffy their first occupied
+// slot cascades at: nothing in it can expire earlier, and once it has
+// cascaded the next call knows better. Every jiffy before it has nothing to
+// run or move, so timer_run() may skip straight to it.
+static uint64_t next_event(timer_base_t *base) {
+    uint64_t next = TIMER_NONE;
+    if (base->pending == 0) return next;
+
+    uint64_t clk = base->clk;
+    for (uint64_t i = 0; i < TVR_SIZE; i++)
+        if (base->tv1[(clk + i) & TVR_MASK])
+        {
+            next = clk + i;
+            break;
+        }
+
+    for (uint32_t level = 1; level < TIMER_LEVELS; level++)
+    {
+        uint64_t step = 1ULL << LEVEL_SHIFT(level);
+        uint64_t point = (clk + step - 1) & ~(step - 1);
+        for (uint64_t i = 0; i < TVN_SIZE && point < next; i++, point += step)
+            if (base->tvn[level - 1][INDEX(point, level)])
+            {
+                next = point;
+                break;
+            }
+    }
+    return next;
+}
+
+// Timers are pinned to their base, but before the first timer_add() the
+// local one is as good as any. Without local APIC ticks only the BSP runs
+// timer_run().
+static timer_base_t *timer_local_base(void) {
+    timer_base_t *base = &timer_bases[tick_tsc_per_jiffy ? cpu_index() : 0];
+    base->cpu = (uint32_t)(base - timer_bases);
+    return base;
+}
+
+void timer_setup(ktimer_t *timer, void (*fn)(ktimer_t *timer), void *data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->data = data;
+    timer->base = NULL;
+}
+
+bool timer_pending(const ktimer_t *timer) {
+    return timer->pprev != NULL;
+}
+
+bool timer_add(ktimer_t *timer, uint64_t expires) {
+    timer_base_t *base = timer->base ? timer->base : timer_local_base();
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    timer->base = base;
+
+    bool was_pending = timer_pending(timer);
+    if (was_pending) timer_detach(base, timer);
+    uint64_t now = get_jiffies();
+    if (base->pending == 0 && now > base->clk) base->clk = now; // Nothing to catch up on.
+
+    timer->expires = expires;
+    internal_add_timer(base, timer);
+    spin_unlock_irqrestore(&base->lock, flags);
+
+    // A stopped or stretched tick on that CPU doesn't know about this one yet.
+    tick_nohz_kick(base->cpu);
+    return was_pending;
+}
+
+bool timer_cancel(ktimer_t *timer) {
+    timer_base_t *base = timer->base;
+    if (base == NULL) return false;
+
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    bool was_pending = timer_pending(timer);
+    if (was_pending) timer_detach(base, timer);
+    spin_unlock_irqrestore(&base->lock, flags);
+    return was_pending;
+}
+
+bool timer_cancel_sync(ktimer_t *timer) {
+    bool was_pending = timer_cancel(timer);
+    timer_base_t *base = timer->base;
+    if (base == NULL) return was_pending;
+    while (__atomic_load_n(&base->running, __ATOMIC_ACQUIRE) == timer) __builtin_ia32_pause();
+    return was_pending;
+}
+
+void timer_run() {
+    timer_base_t *base = timer_local_base();
+    uint64_t now = get_jiffies();
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+
+    if (base->pending == 0 && now >= base->clk) base->clk = now + 1;
+    while (now >= base->clk)
+    {
+        // Behind by more than a jiffy (the tick was stopped): skip the empty
+        // ones instead of walking them with interrupts off.
+        if (now > base->clk) base->clk = MIN(next_event(base), now);
+
+        uint32_t index = base->clk & TVR_MASK;
+        if (index == 0)
+            for (uint32_t level = 1; level < TIMER_LEVELS && cascade(base, level) == 0; level++);
+
+        ktimer_t *timer = base->tv1[index];
+        base->tv1[index] = NULL;
+        if (timer) timer->pprev = &timer;
+        base->clk++;
+
+        // The expired slot is a private list now; the lock is dropped around
+        // each callback, so detach from its head every time.
+        while (timer)
+        {
+            ktimer_t *t = timer;
+            timer_detach(base, t);
+            __atomic_store_n(&base->running, t, __ATOMIC_RELAXED);
+            spin_unlock(&base->lock);
+
+            t->fn(t);
+
+            spin_lock(&base->lock);
+            __atomic_store_n(&base->running, NULL, __ATOMIC_RELEASE);
+        }
+    }
+    spin_unlock_irqrestore(&base->lock, flags);
+}
+
+uint64_t timer_next_expiry() {
+    timer_base_t *base = timer_local_base();
+    uint64_t flags = spin_lock_irqsave(&base->lock);
+    uint64_t next = next_event(base);
+    spin_unlock_irqrestore(&base->lock, flags);
+    return next;
+}
@@ -0,0 +1,44 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include "common/types.h"
+
+// Kernel timers with jiffy resolution on a hierarchical timing wheel, one
+// per CPU. Adding and cancelling are O(1), the tick only looks at the slot
+// for the current jiffy and every 256 jiffies moves one slot of the level
+// above down a level (cascading). Timers further out than 2^32 jiffies
+// are clamped.
+//
+// Callbacks run from the tick interrupt with interrupts off and must not
+// block. A timer stays on the CPU it was first added on.
+
+#define TIMER_NONE (~0ULL)
+
+struct TimerBase;
+
+typedef struct KTimer
+{
+    struct KTimer *next;
+    struct KTimer **pprev; // NULL while not pending.
+    uint64_t expires;      // In jiffies.
+    void (*fn)(struct KTimer *timer);
+    void *data;
+    struct TimerBase *base;
+} ktimer_t;
+
+void timer_setup(ktimer_t *timer, void (*fn)(ktimer_t *timer), void *data);
+
+// (Re)arms the timer for the given jiffy, returns whether it was pending.
+bool timer_add(ktimer_t *timer, uint64_t expires);
+// Returns whether it was still pending. The callback may be running.
+bool timer_cancel(ktimer_t *timer);
+// Also waits for a running callback, don't call it from one.
+bool timer_cancel_sync(ktimer_t *timer);
+bool timer_pending(const ktimer_t *timer);
+
+void timer_run(); // Tick, after jiffies moved.
+
+// Earliest jiffy this CPU has to wake up for, TIMER_NONE if nothing is pending.
+uint64_t timer_next_expiry();
+
+#endif
@@ -1,20 +1,47 @@
 #include "timing.h"
 #include "common/types.h"
+#include "common/isr.h"
+#include "scheduler.h"
+#include "tick.h"
+#include "timer.h"
+#include "hrtimer.h"
 // Ports
 #define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
 #define PIT_COMMAND  0x43
+#define PIT_GATE     0x61 // Bit 0 gates channel 2, bit 1 the speaker, bit 5 reads its output.
 
 // PIT frequency
 #define PIT_FREQUENCY 1193182
 
+volatile uint64_t jiffies_64 = 0; // Read through get_jiffies().
+
 // Write a byte to an I/O port
 void outbyte(uint16_t port, uint8_t val) {
     __asm__ __volatile__ ("outb %0, %1" : : "a"(val), "Nd"(port));
 }
 
+// Read a byte from an I/O port
+uint8_t inbyte(uint16_t port) {
+    uint8_t val;
+    __asm__ __volatile__ ("inb %1, %0" : "=a"(val) : "Nd"(port));
+    return val;
+}
+
+static void pit_irq(AsmPassedInterrupt *regs) {
+    (void)regs;
+    if (tick_tsc_per_jiffy) return; // The local APIC took over.
+    jiffies_64++;
+    timer_run();
+    hrtimer_run();
+    sched_tick();
+}
+
 // Setup PIT to generate IRQ0 at given frequency
 void pit_init(uint32_t frequency) {
     uint32_t divisor = PIT_FREQUENCY / frequency;
+    if (divisor == 0) divisor = 1;
+    if (divisor > 0xFFFF) divisor = 0xFFFF; // 16 bit counter, ~18.2 Hz is the slowest we get.
 
     // Command byte:
     // Channel 0, Access mode = lobyte/hibyte, Mode 2 (rate generator), Binary
@@ -23,4 +50,31 @@ void pit_init(uint32_t frequency) {
     // Send divisor low byte, then high byte
     outbyte(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));
     outbyte(PIT_CHANNEL0, (uint8_t)((divisor >> 8) & 0xFF));
+
+    registerIRQhandler(0, pit_irq);
+}
+
+// Mode 0 with the maximum count: one last interrupt, then silence.
+void pit_stop() {
+    outbyte(PIT_COMMAND, 0x30);
+    outbyte(PIT_CHANNEL0, 0);
+    outbyte(PIT_CHANNEL0, 0);
+}
+
+// Busy-waits us microseconds (at most ~54 ms) on channel 2, which needs no
+// interrupts and leaves the tick on channel 0 alone. Returns the TSC delta.
+uint64_t pit_measure_tsc(uint32_t us) {
+    uint32_t count = (uint64_t)PIT_FREQUENCY * us / 1000000;
+    if (count > 0xFFFF) count = 0xFFFF;
+
+    outbyte(PIT_GATE, inbyte(PIT_GATE) & ~0x03); // Gate low, speaker off.
+    // Channel 2, lobyte/hibyte, Mode 0 (interrupt on terminal count), Binary
+    outbyte(PIT_COMMAND, 0xB0);
+    outbyte(PIT_CHANNEL2, (uint8_t)(count & 0xFF));
+    outbyte(PIT_CHANNEL2, (uint8_t)((count >> 8) & 0xFF));
+
+    outbyte(PIT_GATE, (inbyte(PIT_GATE) & ~0x02) | 0x01); // Start counting.
+    uint64_t start = rdtsc();
+    while (!(inbyte(PIT_GATE) & 0x20)) __builtin_ia32_pause();
+    return rdtsc() - start;
 }
@@ -2,7 +2,24 @@
 #define TIMING_H
 #include "common/types.h"
 
+// Timer interrupt rate:
+#define TIMER_HZ 1000
+
 void outbyte(uint16_t port, uint8_t val);
+uint8_t inbyte(uint16_t port);
 void pit_init(uint32_t frequency);
+void pit_stop();
+uint64_t pit_measure_tsc(uint32_t us);
+
+// Timer interrupts since boot. Brings jiffies up to date first: with the
+// tick deferred or stopped nothing else moves them for a while.
+uint64_t get_jiffies();
+
+// Raw time stamp counter, for cycle-level statistics:
+static force_inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
 
-#endif
\ No newline at end of file
+#endif
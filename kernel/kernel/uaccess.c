@@ -0,0 +1,35 @@
+#include "uaccess.h"
+
+// The one load that may fault, a fault there resumes at uaccess_fault
+// with a non-zero result.
+extern char uaccess_load_u32[];
+extern char uaccess_fault[];
+uint64_t uaccess_read_u32(uint32_t *val, const uint32_t *uaddr);
+
+__asm__ (
+    ".text\n"
+    ".global uaccess_read_u32\n"
+    ".type uaccess_read_u32, @function\n"
+    "uaccess_read_u32:\n"
+    ".global uaccess_load_u32\n"
+    "uaccess_load_u32:\n\t"
+    "movl (%rsi), %eax\n\t"
+    "movl %eax, (%rdi)\n\t"
+    "xorl %eax, %eax\n\t"
+    "ret\n"
+    ".global uaccess_fault\n"
+    "uaccess_fault:\n\t"
+    "movl $1, %eax\n\t"
+    "ret\n"
+);
+
+int64_t get_user_u32(uint32_t *val, const uint32_t *uaddr) {
+    if (!access_ok(uaddr, sizeof(*uaddr))) return ERR(EFAULT);
+    return uaccess_read_u32(val, uaddr) ? ERR(EFAULT) : 0;
+}
+
+bool uaccess_fixup(AsmPassedInterrupt *regs) {
+    if (regs->rip != (uintptr_t)uaccess_load_u32) return false;
+    regs->rip = (uintptr_t)uaccess_fault;
+    return true;
+}
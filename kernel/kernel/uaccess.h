@@ -0,0 +1,26 @@
+#ifndef UACCESS_H
+#define UACCESS_H
+
+#include "common/types.h"
+#include "common/isr.h"
+#include "syscall_defs.h"
+
+// Reading user memory on behalf of a system call. Pointers from user space
+// have to lie in the user half, and even then the page may not be mapped:
+// the accessors turn that page fault into -EFAULT instead of a dead machine.
+// They don't sleep, so they work under spinlocks too.
+
+#define USER_SPACE_END 0x0000800000000000ULL // First non-canonical address.
+
+static inline bool access_ok(const void *uaddr, size_t size) {
+    uintptr_t addr = (uintptr_t)uaddr;
+    return addr < USER_SPACE_END && size <= USER_SPACE_END - addr;
+}
+
+// 0 on success, ERR(EFAULT) if the address isn't readable.
+int64_t get_user_u32(uint32_t *val, const uint32_t *uaddr);
+
+// Page fault handler: true if it hit an accessor, which returns an error.
+bool uaccess_fixup(AsmPassedInterrupt *regs);
+
+#endif
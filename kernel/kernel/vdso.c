@@ -0,0 +1,71 @@
+#include "common/vdso.h"
+#include "common/memory.h"
+#include "common/memtag.h"
+#include "clocksource.h"
+#include "rtc.h"
+#include "cpu.h"
+#include "printf.h"
+
+static DEFINE_MEMTAG(memtag_vdso, "vdso");
+
+vdso_clock_data_t *vdso_data;
+uint64_t vdso_data_phys;
+
+static uint64_t real_offset_ns;
+
+// Writers are rare (boot, settime) but may race, so they serialise on the
+// counter itself: whoever makes it odd owns the page.
+static void vdso_write_begin(void) {
+    for (;;)
+    {
+        uint32_t seq = __atomic_load_n(&vdso_data->seq, __ATOMIC_RELAXED);
+        if (!(seq & 1) && __atomic_compare_exchange_n(&vdso_data->seq, &seq, seq + 1, false,
+                                                      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+        __builtin_ia32_pause();
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE); // Odd count before the data.
+}
+
+static void vdso_write_end(void) {
+    __atomic_add_fetch(&vdso_data->seq, 1, __ATOMIC_RELEASE);
+}
+
+void vdso_update() {
+    if (vdso_data == NULL) return;
+    uint64_t flags = irq_save();
+    vdso_write_begin();
+
+    uint64_t cycles = ktime_get_cycles();
+    vdso_data->clock_mode = clocksource->user_readable ? VDSO_CLOCK_TSC : VDSO_CLOCK_NONE;
+    vdso_data->mult = clocksource->mult;
+    vdso_data->shift = clocksource->shift;
+    vdso_data->cycle_last = cycles;
+    vdso_data->mono_ns = ktime_at(cycles);
+    vdso_data->real_offset_ns = real_offset_ns;
+    vdso_data->tsc_hz = tsc_hz;
+
+    vdso_write_end();
+    irq_restore(flags);
+}
+
+void vdso_settime(uint64_t real_ns) {
+    uint64_t now = ktime_get_ns();
+    real_offset_ns = real_ns > now ? real_ns - now : 0;
+    vdso_update();
+}
+
+uint64_t ktime_get_real_ns() {
+    return ktime_get_ns() + real_offset_ns;
+}
+
+void vdso_init() {
+    vdso_data_phys = alloc_page_tagged(&memtag_vdso);
+    if (vdso_data_phys == 0) return;
+    vdso_data = PHYS_TO_VIRT(vdso_data_phys);
+    memset(vdso_data, 0, PAGE_SIZE);
+    vdso_data->version = VDSO_DATA_VERSION;
+
+    vdso_settime(rtc_read_epoch() * NSEC_PER_SEC);
+    printf_("vdso: clock page at %lx, %s\n", vdso_data_phys,
+            vdso_data->clock_mode == VDSO_CLOCK_TSC ? "tsc" : "syscall only");
+}
@@ -0,0 +1,138 @@
+#include "common/spinlock.h"
+#include "clocksource.h"
+#include "percpu.h"
+#include "printf.h"
+
+#ifdef SPINLOCK_STATS
+#define LOCK_CLASSES 64 // The last one takes whatever doesn't fit.
+
+// Every CPU counts into its own line, plain adds. An interrupt taking a
+// lock of the same class in between can lose one, close enough.
+typedef struct LockClassCpu
+{
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t wait_total;
+    uint64_t wait_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+} __attribute__((aligned(64))) lock_class_cpu_t;
+
+typedef struct LockClass
+{
+    const char *name;
+    lock_class_cpu_t cpu[MAX_CPUS];
+} lock_class_t;
+
+static lock_class_t lock_classes[LOCK_CLASSES];
+static uint32_t lock_class_count;
+static uint8_t lock_class_lock; // Can't be a spinlock_t, it would count itself.
+
+static bool name_eq(const char *a, const char *b) {
+    if (a == b) return true;
+    while (*a && *a == *b) a++, b++;
+    return *a == *b;
+}
+
+static lock_class_t *lock_class_get(lock_stat_t *stat) {
+    lock_class_t *class = __atomic_load_n(&stat->class, __ATOMIC_ACQUIRE);
+    if (class) return class;
+
+    const char *name = stat->name ? stat->name : "(unnamed)";
+    uint64_t flags = irq_save();
+    while (__atomic_exchange_n(&lock_class_lock, 1, __ATOMIC_ACQUIRE)) __builtin_ia32_pause();
+    for (uint32_t i = 0; i < lock_class_count && !class; i++)
+        if (name_eq(lock_classes[i].name, name)) class = &lock_classes[i];
+    if (class == NULL && lock_class_count < LOCK_CLASSES - 1)
+    {
+        class = &lock_classes[lock_class_count];
+        class->name = name;
+        __atomic_store_n(&lock_class_count, lock_class_count + 1, __ATOMIC_RELEASE);
+    }
+    if (class == NULL)
+    {
+        class = &lock_classes[LOCK_CLASSES - 1];
+        class->name = "(other)";
+    }
+    __atomic_store_n(&lock_class_lock, 0, __ATOMIC_RELEASE);
+    irq_restore(flags);
+
+    __atomic_store_n(&stat->class, class, __ATOMIC_RELEASE);
+    return class;
+}
+
+void lock_stat_acquired_shared(lock_stat_t *stat, uint64_t wait_start) {
+    lock_class_cpu_t *s = &lock_class_get(stat)->cpu[cpu_index()];
+    s->acquired++;
+    if (wait_start == 0) return;
+    uint64_t wait = lock_stat_now() - wait_start;
+    s->contended++;
+    s->wait_total += wait;
+    if (wait > s->wait_max) s->wait_max = wait;
+}
+
+void lock_stat_acquired(lock_stat_t *stat, uint64_t wait_start) {
+    lock_stat_acquired_shared(stat, wait_start);
+    stat->acquired_at = lock_stat_now();
+}
+
+// Counted where it's released, which needn't be where it was taken.
+void lock_stat_released(lock_stat_t *stat) {
+    if (stat->acquired_at == 0) return; // Taken before the stat was set up.
+    uint64_t hold = lock_stat_now() - stat->acquired_at;
+    stat->acquired_at = 0;
+    lock_class_cpu_t *s = &lock_class_get(stat)->cpu[cpu_index()];
+    s->hold_total += hold;
+    if (hold > s->hold_max) s->hold_max = hold;
+}
+
+static uint64_t lock_ns(uint64_t cycles) {
+    uint64_t cycles_per_us = tsc_hz / 1000000;
+    return cycles_per_us ? cycles * NSEC_PER_USEC / cycles_per_us : cycles;
+}
+
+void lock_stat_dump() {
+    uint32_t count = __atomic_load_n(&lock_class_count, __ATOMIC_ACQUIRE);
+    if (lock_classes[LOCK_CLASSES - 1].name) count = LOCK_CLASSES;
+    static lock_class_cpu_t sum[LOCK_CLASSES]; // Too big for the stack.
+    uint32_t order[LOCK_CLASSES];
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sum[i] = (lock_class_cpu_t){ 0 };
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+        {
+            lock_class_cpu_t *s = &lock_classes[i].cpu[cpu];
+            sum[i].acquired += s->acquired;
+            sum[i].contended += s->contended;
+            sum[i].wait_total += s->wait_total;
+            sum[i].hold_total += s->hold_total;
+            if (s->wait_max > sum[i].wait_max) sum[i].wait_max = s->wait_max;
+            if (s->hold_max > sum[i].hold_max) sum[i].hold_max = s->hold_max;
+        }
+        // Insertion sort, worst total wait first.
+        uint32_t j = i;
+        for (; j > 0 && sum[order[j - 1]].wait_total < sum[i].wait_total; j--) order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    printf_("lock classes by wait time, in %s:\n", tsc_hz ? "ns" : "cycles");
+    for (uint32_t k = 0; k < count; k++)
+    {
+        lock_class_cpu_t *s = &sum[order[k]];
+        if (s->acquired == 0) continue;
+        printf_("%s: %lu acquired, %lu contended (%lu%%)\n", lock_classes[order[k]].name, s->acquired, s->contended,
+                s->contended * 100 / s->acquired);
+        printf_("      wait %lu total, %lu avg, %lu max; hold %lu avg, %lu max\n", lock_ns(s->wait_total),
+                s->contended ? lock_ns(s->wait_total / s->contended) : 0, lock_ns(s->wait_max),
+                lock_ns(s->hold_total / s->acquired), lock_ns(s->hold_max));
+    }
+}
+
+void lock_stat_reset() {
+    uint32_t count = __atomic_load_n(&lock_class_count, __ATOMIC_ACQUIRE);
+    for (uint32_t i = 0; i < LOCK_CLASSES && (i < count || i == LOCK_CLASSES - 1); i++)
+        for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++)
+            lock_classes[i].cpu[cpu] = (lock_class_cpu_t){ 0 };
+}
+#endif
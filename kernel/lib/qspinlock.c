@@ -0,0 +1,79 @@
+#include "common/qspinlock.h"
+#include "percpu.h"
+
+typedef struct McsNode
+{
+    struct McsNode *next;
+    uint32_t locked; // Set by the predecessor: we're at the head of the queue.
+} mcs_node_t;
+
+typedef struct QNodes
+{
+    mcs_node_t nodes[QSPIN_NODES];
+    uint32_t count; // In use, only touched by its own CPU.
+} __attribute__((aligned(64))) qnodes_t;
+
+static qnodes_t qnodes[MAX_CPUS];
+
+static inline uint16_t encode_tail(uint32_t cpu, uint32_t idx) {
+    return (uint16_t)(((cpu + 1) << 2) | idx);
+}
+
+static inline mcs_node_t *decode_tail(uint16_t tail) {
+    return &qnodes[(tail >> 2) - 1].nodes[tail & 3];
+}
+
+void qspin_lock_slowpath(qspinlock_t *lock) {
+    uint64_t flags = irq_save();
+    uint32_t cpu = cpu_index();
+    qnodes_t *q = &qnodes[cpu];
+    uint32_t idx = q->count++;
+    if (idx >= QSPIN_NODES)
+    {
+        // Nested deeper than we have nodes for, just spin on the word.
+        // Not qspin_trylock(), qspin_lock() does the statistics.
+        uint32_t val = 0;
+        while (!__atomic_compare_exchange_n(&lock->word.val, &val, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            val = 0;
+            __builtin_ia32_pause();
+        }
+        q->count--;
+        irq_restore(flags);
+        return;
+    }
+
+    mcs_node_t *node = &q->nodes[idx];
+    uint16_t tail = encode_tail(cpu, idx);
+    node->next = NULL;
+    node->locked = 0;
+
+    // Queue up, and link in behind whoever was last.
+    uint16_t prev = __atomic_exchange_n(&lock->word.b.tail, tail, __ATOMIC_ACQ_REL);
+    if (prev)
+    {
+        __atomic_store_n(&decode_tail(prev)->next, node, __ATOMIC_RELEASE);
+        while (!__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) __builtin_ia32_pause();
+    }
+
+    // Head of the queue: wait for the owner to let go.
+    uint32_t val;
+    while ((val = __atomic_load_n(&lock->word.val, __ATOMIC_ACQUIRE)) & 0xFF) __builtin_ia32_pause();
+
+    // Last in the queue? Then take the lock and empty the queue in one go.
+    if ((val >> 16) == tail && __atomic_compare_exchange_n(&lock->word.val, &val, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+        q->count--;
+        irq_restore(flags);
+        return;
+    }
+
+    // Somebody queued behind us: take the lock, then make them the head.
+    __atomic_store_n(&lock->word.b.locked, 1, __ATOMIC_RELAXED);
+    mcs_node_t *next;
+    while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) __builtin_ia32_pause();
+    __atomic_store_n(&next->locked, 1, __ATOMIC_RELEASE);
+
+    q->count--;
+    irq_restore(flags);
+}
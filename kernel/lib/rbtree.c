@@ -0,0 +1,235 @@
+#include "common/types.h"
+#include "common/rbtree.h"
+
+static void rb_rotate_left(rb_tree_t *tree, rb_node_t *x) {
+    rb_node_t *y = x->right;
+    x->right = y->left;
+    if (y->left) y->left->parent = x;
+    y->parent = x->parent;
+    if (x->parent == NULL) tree->root = y;
+    else if (x == x->parent->left) x->parent->left = y;
+    else x->parent->right = y;
+    y->left = x;
+    x->parent = y;
+}
+
+static void rb_rotate_right(rb_tree_t *tree, rb_node_t *x) {
+    rb_node_t *y = x->left;
+    x->left = y->right;
+    if (y->right) y->right->parent = x;
+    y->parent = x->parent;
+    if (x->parent == NULL) tree->root = y;
+    else if (x == x->parent->right) x->parent->right = y;
+    else x->parent->left = y;
+    y->right = x;
+    x->parent = y;
+}
+
+static inline bool rb_is_red(const rb_node_t *node) { return node && node->red; }
+
+void rb_insert(rb_tree_t *tree, rb_node_t *node, rb_less_t less) {
+    rb_node_t *parent = NULL;
+    rb_node_t **link = &tree->root;
+    bool leftmost = true;
+
+    while (*link)
+    {
+        parent = *link;
+        if (less(node, parent))
+        {
+            link = &parent->left;
+        }
+        else
+        {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->red = true;
+    *link = node;
+    if (leftmost) tree->leftmost = node;
+
+    // Fix up red-red violations on the way up.
+    while (rb_is_red(node->parent))
+    {
+        rb_node_t *p = node->parent;
+        rb_node_t *g = p->parent;
+        if (p == g->left)
+        {
+            rb_node_t *uncle = g->right;
+            if (rb_is_red(uncle))
+            {
+                p->red = uncle->red = false;
+                g->red = true;
+                node = g;
+                continue;
+            }
+            if (node == p->right)
+            {
+                rb_rotate_left(tree, p);
+                node = p;
+                p = node->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rb_rotate_right(tree, g);
+        }
+        else
+        {
+            rb_node_t *uncle = g->left;
+            if (rb_is_red(uncle))
+            {
+                p->red = uncle->red = false;
+                g->red = true;
+                node = g;
+                continue;
+            }
+            if (node == p->left)
+            {
+                rb_rotate_right(tree, p);
+                node = p;
+                p = node->parent;
+            }
+            p->red = false;
+            g->red = true;
+            rb_rotate_left(tree, g);
+        }
+    }
+    tree->root->red = false;
+}
+
+rb_node_t *rb_next(const rb_node_t *node) {
+    if (node->right)
+    {
+        node = node->right;
+        while (node->left) node = node->left;
+        return (rb_node_t *)node;
+    }
+    while (node->parent && node == node->parent->right) node = node->parent;
+    return node->parent;
+}
+
+static void rb_transplant(rb_tree_t *tree, rb_node_t *u, rb_node_t *v) {
+    if (u->parent == NULL) tree->root = v;
+    else if (u == u->parent->left) u->parent->left = v;
+    else u->parent->right = v;
+    if (v) v->parent = u->parent;
+}
+
+static void rb_erase_fixup(rb_tree_t *tree, rb_node_t *x, rb_node_t *parent) {
+    while (x != tree->root && !rb_is_red(x))
+    {
+        if (x == parent->left)
+        {
+            rb_node_t *w = parent->right;
+            if (rb_is_red(w))
+            {
+                w->red = false;
+                parent->red = true;
+                rb_rotate_left(tree, parent);
+                w = parent->right;
+            }
+            if (!rb_is_red(w->left) && !rb_is_red(w->right))
+            {
+                w->red = true;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (!rb_is_red(w->right))
+            {
+                w->left->red = false;
+                w->red = true;
+                rb_rotate_right(tree, w);
+                w = parent->right;
+            }
+            w->red = parent->red;
+            parent->red = false;
+            if (w->right) w->right->red = false;
+            rb_rotate_left(tree, parent);
+            x = tree->root;
+            break;
+        }
+        else
+        {
+            rb_node_t *w = parent->left;
+            if (rb_is_red(w))
+            {
+                w->red = false;
+                parent->red = true;
+                rb_rotate_right(tree, parent);
+                w = parent->left;
+            }
+            if (!rb_is_red(w->left) && !rb_is_red(w->right))
+            {
+                w->red = true;
+                x = parent;
+                parent = x->parent;
+                continue;
+            }
+            if (!rb_is_red(w->left))
+            {
+                w->right->red = false;
+                w->red = true;
+                rb_rotate_left(tree, w);
+                w = parent->left;
+            }
+            w->red = parent->red;
+            parent->red = false;
+            if (w->left) w->left->red = false;
+            rb_rotate_right(tree, parent);
+            x = tree->root;
+            break;
+        }
+    }
+    if (x) x->red = false;
+}
+
+void rb_erase(rb_tree_t *tree, rb_node_t *node) {
+    if (tree->leftmost == node) tree->leftmost = rb_next(node);
+
+    rb_node_t *x;
+    rb_node_t *x_parent;
+    bool removed_red = node->red;
+
+    if (node->left == NULL)
+    {
+        x = node->right;
+        x_parent = node->parent;
+        rb_transplant(tree, node, node->right);
+    }
+    else if (node->right == NULL)
+    {
+        x = node->left;
+        x_parent = node->parent;
+        rb_transplant(tree, node, node->left);
+    }
+    else
+    {
+        rb_node_t *y = node->right;
+        while (y->left) y = y->left;
+        removed_red = y->red;
+        x = y->right;
+        if (y->parent == node)
+        {
+            x_parent = y;
+        }
+        else
+        {
+            x_parent = y->parent;
+            rb_transplant(tree, y, y->right);
+            y->right = node->right;
+            y->right->parent = y;
+        }
+        rb_transplant(tree, node, y);
+        y->left = node->left;
+        y->left->parent = y;
+        y->red = node->red;
+    }
+
+    if (!removed_red) rb_erase_fixup(tree, x, x_parent);
+    node->parent = node->left = node->right = NULL;
+}
@@ -1,8 +1,10 @@
 #include "common/types.h"
 #include "common/memory.h"
+#include "common/memtag.h"
 
 void *mmap(/*size_t requested_amount*/) {
-    return (void*)alloc_page();
+    // Charged to whoever called mmap(), not to mmap() itself:
+    return (void*)alloc_page_tagged(memtag_callsite(__builtin_return_address(0)));
 
 }
 
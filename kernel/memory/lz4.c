@@ -0,0 +1,153 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "common/lz4.h"
+
+#define LZ4_MINMATCH     4
+#define LZ4_HASH_LOG     12
+#define LZ4_LASTLITERALS 5  // The block always ends with at least 5 literals.
+#define LZ4_MFLIMIT      12 // No match may start within the last 12 bytes.
+#define LZ4_MAX_OFFSET   0xFFFF
+
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_u32;
+
+// Positions are 16 bits, which is why inputs are limited to 64 KiB.
+// Not reentrant: callers (zram) serialise compression.
+static uint16_t lz4_table[1 << LZ4_HASH_LOG];
+
+static inline uint32_t lz4_read32(const uint8_t *p) { return *(const unaligned_u32 *)p; }
+static inline uint32_t lz4_hash(uint32_t seq) { return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG); }
+
+static uint8_t *lz4_write_length(uint8_t *op, size_t len) {
+    while (len >= 255)
+    {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+size_t lz4_compress(const void *src, size_t src_len, void *dst, size_t dst_capacity) {
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *iend = base + src_len;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + dst_capacity;
+
+    if (src_len > 0xFFFF) return 0;
+
+    if (src_len > LZ4_MFLIMIT)
+    {
+        const uint8_t *mflimit = iend - LZ4_MFLIMIT;
+        const uint8_t *matchlimit = iend - LZ4_LASTLITERALS;
+
+        memset(lz4_table, 0, sizeof(lz4_table));
+        ip++;
+        while (ip < mflimit)
+        {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = base + lz4_table[h];
+            lz4_table[h] = (uint16_t)(ip - base);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || lz4_read32(ref) != seq)
+            {
+                ip++;
+                continue;
+            }
+
+            const uint8_t *mp = ip + LZ4_MINMATCH;
+            const uint8_t *rp = ref + LZ4_MINMATCH;
+            while (mp < matchlimit && *mp == *rp)
+            {
+                mp++;
+                rp++;
+            }
+
+            size_t lit_len = (size_t)(ip - anchor);
+            size_t match_len = (size_t)(mp - ip) - LZ4_MINMATCH;
+            // Token + literal length + literals + offset + match length:
+            if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1) return 0;
+
+            uint8_t *token = op++;
+            *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+            if (lit_len >= 15) op = lz4_write_length(op, lit_len - 15);
+            memcpy(op, anchor, lit_len);
+            op += lit_len;
+
+            uint16_t offset = (uint16_t)(ip - ref);
+            *op++ = (uint8_t)(offset & 0xFF);
+            *op++ = (uint8_t)(offset >> 8);
+
+            *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+            if (match_len >= 15) op = lz4_write_length(op, match_len - 15);
+
+            anchor = ip = mp;
+        }
+    }
+
+    // Last literals:
+    size_t lit_len = (size_t)(iend - anchor);
+    if ((size_t)(oend - op) < 1 + lit_len / 255 + 1 + lit_len) return 0;
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) op = lz4_write_length(op, lit_len - 15);
+    memcpy(op, anchor, lit_len);
+    op += lit_len;
+
+    return (size_t)(op - (uint8_t *)dst);
+}
+
+int lz4_decompress(const void *src, size_t src_len, void *dst, size_t dst_capacity) {
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + src_len;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + dst_capacity;
+
+    while (ip < iend)
+    {
+        uint8_t token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15)
+        {
+            uint8_t s;
+            do {
+                if (ip >= iend) return -1;
+                s = *ip++;
+                lit_len += s;
+            } while (s == 255);
+        }
+        if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len) return -1;
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+
+        if (ip >= iend) break; // The last sequence has no match.
+
+        if (iend - ip < 2) return -1;
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst)) return -1;
+
+        size_t match_len = token & 15;
+        if (match_len == 15)
+        {
+            uint8_t s;
+            do {
+                if (ip >= iend) return -1;
+                s = *ip++;
+                match_len += s;
+            } while (s == 255);
+        }
+        match_len += LZ4_MINMATCH;
+        if ((size_t)(oend - op) < match_len) return -1;
+
+        // Byte by byte, the match may overlap what it is copying.
+        const uint8_t *match = op - offset;
+        while (match_len--) *op++ = *match++;
+    }
+
+    return (int)(op - (uint8_t *)dst);
+}
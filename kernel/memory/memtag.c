@@ -0,0 +1,170 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "common/memtag.h"
+#include "common/spinlock.h"
+#include "cpu.h"
+
+#define MEMTAG_SITE_BUCKETS 128 // Power of two.
+
+DEFINE_MEMTAG(memtag_anon, "anon");
+DEFINE_MEMTAG(memtag_zram, "zram");
+static DEFINE_MEMTAG(memtag_self, "memtag");
+static DEFINE_MEMTAG(memtag_overflow, "other"); // When we run out of ids.
+
+static memtag_t *memtag_table[MEMTAG_MAX];
+static uint16_t memtag_count = 1; // Id 0 means "nobody".
+static spinlock_t memtag_lock = SPINLOCK_INIT; // Id assignment only.
+
+// Per CPU rows, so that a CPU only ever writes its own cache lines.
+static memtag_usage_t memtag_usage[MAX_CPUS][MEMTAG_MAX];
+
+// Owner id for every frame the allocator manages.
+static uint16_t *memtag_owner;
+
+static memtag_t memtag_sites[MEMTAG_SITE_BUCKETS];
+
+static uint16_t memtag_id(memtag_t *tag) {
+    uint16_t id = __atomic_load_n(&tag->id, __ATOMIC_ACQUIRE);
+    if (id) return id;
+
+    uint64_t flags = spin_lock_irqsave(&memtag_lock);
+    if (tag->id == 0 && memtag_count < MEMTAG_MAX)
+    {
+        memtag_table[memtag_count] = tag;
+        __atomic_store_n(&tag->id, memtag_count++, __ATOMIC_RELEASE);
+    }
+    id = tag->id;
+    spin_unlock_irqrestore(&memtag_lock, flags);
+
+    if (id) return id;
+    return tag == &memtag_overflow ? 0 : memtag_id(&memtag_overflow);
+}
+
+memtag_t *memtag_callsite(void *site) {
+    size_t bucket = ((uintptr_t)site >> 2) * 0x9E3779B97F4A7C15ULL >> 57; // Top 7 bits.
+    for (size_t probe = 0; probe < MEMTAG_SITE_BUCKETS; probe++)
+    {
+        memtag_t *tag = &memtag_sites[(bucket + probe) & (MEMTAG_SITE_BUCKETS - 1)];
+        void *seen = NULL;
+        if (__atomic_compare_exchange_n(&tag->site, &seen, site, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return tag;
+        if (seen == site) return tag;
+    }
+    return &memtag_overflow;
+}
+
+void memtag_init(void) {
+    // The fallback gets its id before call sites can use them all up.
+    memtag_id(&memtag_overflow);
+    memtag_id(&memtag_self);
+
+    size_t frames = pfa_frame_count();
+    size_t pages = (frames * sizeof(uint16_t) + PAGE_SIZE - 1) / PAGE_SIZE;
+    physaddr_t table = alloc_contiguous_pages(pages);
+    if (table == 0) return;
+
+    memtag_owner = (uint16_t *)PHYS_TO_VIRT(table);
+    memset(memtag_owner, 0, pages * PAGE_SIZE);
+    for (size_t i = 0; i < pages; i++) memtag_charge_page(table + i * PAGE_SIZE, &memtag_self);
+}
+
+void memtag_charge_page(physaddr_t frame, memtag_t *tag) {
+    if (memtag_owner == NULL) return;
+    size_t index = pfa_frame_index(frame);
+    if (index >= pfa_frame_count()) return;
+
+    uint16_t id = memtag_id(tag);
+    uint64_t flags = irq_save(); // Stay on this CPU's row.
+    memtag_usage_t *row = memtag_usage[cpu_index()];
+    uint16_t old = memtag_owner[index];
+    if (old) row[old].pages--; // Reclaimed frames change hands without being freed.
+
+    memtag_owner[index] = id;
+    if (id) row[id].pages++;
+    irq_restore(flags);
+}
+
+void memtag_uncharge_page(physaddr_t frame) {
+    if (memtag_owner == NULL) return;
+    size_t index = pfa_frame_index(frame);
+    if (index >= pfa_frame_count()) return;
+
+    uint64_t flags = irq_save();
+    uint16_t old = memtag_owner[index];
+    if (old) memtag_usage[cpu_index()][old].pages--;
+    memtag_owner[index] = 0;
+    irq_restore(flags);
+}
+
+void memtag_charge_object(memtag_t *tag, int64_t bytes) {
+    uint16_t id = memtag_id(tag);
+    uint64_t flags = irq_save();
+    memtag_usage_t *usage = &memtag_usage[cpu_index()][id];
+    usage->bytes += bytes;
+    usage->objects++;
+    irq_restore(flags);
+}
+
+void memtag_uncharge_object(memtag_t *tag, int64_t bytes) {
+    uint16_t id = memtag_id(tag);
+    uint64_t flags = irq_save();
+    memtag_usage_t *usage = &memtag_usage[cpu_index()][id];
+    usage->bytes -= bytes;
+    usage->objects--;
+    irq_restore(flags);
+}
+
+static void memtag_sum(uint16_t id, memtag_usage_t *out) {
+    out->pages = out->bytes = out->objects = 0;
+    for (size_t cpu = 0; cpu < MAX_CPUS; cpu++)
+    {
+        out->pages += memtag_usage[cpu][id].pages;
+        out->bytes += memtag_usage[cpu][id].bytes;
+        out->objects += memtag_usage[cpu][id].objects;
+    }
+}
+
+void memtag_read(memtag_t *tag, memtag_usage_t *out) {
+    if (tag->id == 0)
+    {
+        out->pages = out->bytes = out->objects = 0; // Never charged.
+        return;
+    }
+    memtag_sum(tag->id, out);
+}
+
+// Footprint used for ranking:
+static int64_t memtag_footprint(const memtag_usage_t *usage) {
+    return usage->pages * PAGE_SIZE + usage->bytes;
+}
+
+void memtag_dump(size_t top) {
+    static memtag_usage_t totals[MEMTAG_MAX];
+    static bool printed[MEMTAG_MAX];
+
+    for (uint16_t id = 1; id < memtag_count; id++)
+    {
+        memtag_sum(id, &totals[id]);
+        printed[id] = false;
+    }
+
+    printf_("memtag: top %lu of %u tags, %lu of %lu frames free\n",
+            top, memtag_count - 1, pfa_free_count(), pfa_frame_count());
+
+    for (size_t rank = 0; rank < top; rank++)
+    {
+        uint16_t best = 0;
+        for (uint16_t id = 1; id < memtag_count; id++)
+        {
+            if (printed[id]) continue;
+            if (best == 0 || memtag_footprint(&totals[id]) > memtag_footprint(&totals[best])) best = id;
+        }
+        if (best == 0 || memtag_footprint(&totals[best]) <= 0) break;
+        printed[best] = true;
+
+        memtag_t *tag = memtag_table[best];
+        if (tag->name) printf_("  %-24s", tag->name);
+        else printf_("  site %-19p", tag->site);
+        printf_(" %8ld pages %10ld bytes in %ld objects\n",
+                totals[best].pages, totals[best].bytes, totals[best].objects);
+    }
+}
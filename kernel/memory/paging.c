@@ -1,13 +1,28 @@
 #include "common/types.h"
 
 #include "common/memory.h"
+#include "common/memtag.h"
+#include "common/qspinlock.h"
+#include "cpu.h"
 
+#define PFA_MAX_COLOURS 1024
+
+
+uint64_t hhdm_offset;
 
 static physaddr_t pfa_region_start;
 static size_t pfa_page_count;
 static size_t pfa_bitmap_words;
+static size_t pfa_free_pages;
 static BITMAP_WORD *pfa_bitmap;
 
+static bool pfa_colouring;
+static uint32_t pfa_colours = 1;
+static size_t pfa_colour_hint[PFA_MAX_COLOURS]; // Lowest bit of each colour that may be free.
+static size_t pfa_contig_next; // Next fit: runs are searched for from where the last one ended.
+static colour_cursor_t pfa_global_cursor;
+static qspinlock_t pfa_lock = QSPINLOCK_INIT; // Every CPU allocates pages.
+
 static inline void set_bit(size_t bit) { pfa_bitmap[bit / 64] |= (1ULL << (bit % 64)); }
 static inline void clr_bit(size_t bit) { pfa_bitmap[bit / 64] &= ~(1ULL << (bit % 64)); }
 static inline int test_bit(size_t bit) { return (pfa_bitmap[bit / 64] >> (bit % 64)) & 1ULL;}
@@ -15,12 +30,13 @@ static inline int test_bit(size_t bit) { return (pfa_bitmap[bit / 64] >> (bit %
 void pfa_init(physaddr_t region_start, size_t page_count, void *bitmap_virt_addr) {
     pfa_region_start = region_start;
     pfa_page_count = page_count;
+    pfa_free_pages = page_count;
     pfa_bitmap = (BITMAP_WORD *)bitmap_virt_addr;
     pfa_bitmap_words = (page_count + 63) / 64;
     memset(pfa_bitmap, 0, pfa_bitmap_words * sizeof(BITMAP_WORD)); // Everything is free! 
 }
 
-physaddr_t alloc_page(void) {
+static physaddr_t pfa_take(void) {
     for (size_t word = 0; word < pfa_bitmap_words; word++)
     {
         if (pfa_bitmap[word] != ~0ULL) // Does this machine have at least one free bit?
@@ -33,6 +49,7 @@ physaddr_t alloc_page(void) {
                     size_t bit = word * 64 + b;
                     if (bit >= pfa_page_count) return 0;
                     set_bit(bit);
+                    pfa_free_pages--;
                     return pfa_region_start + (physaddr_t)bit *PAGE_SIZE;
                 }
                 
@@ -44,10 +61,189 @@ physaddr_t alloc_page(void) {
     return 0; // This is returned when we are out of available pages!
 }
 
+static inline uint32_t pfa_bit_colour(size_t bit) {
+    return (uint32_t)((pfa_region_start / PAGE_SIZE + bit) % pfa_colours);
+}
+
+// Only looks at bits of the wanted colour, starting from its hint.
+static physaddr_t pfa_take_colour(uint32_t colour) {
+    for (size_t bit = pfa_colour_hint[colour]; bit < pfa_page_count; bit += pfa_colours)
+    {
+        if (!test_bit(bit))
+        {
+            set_bit(bit);
+            pfa_free_pages--;
+            pfa_colour_hint[colour] = bit + pfa_colours;
+            return pfa_frame_addr(bit);
+        }
+    }
+    pfa_colour_hint[colour] = pfa_page_count;
+    return 0;
+}
+
+static physaddr_t pfa_take_coloured(colour_cursor_t *cursor) {
+    for (uint32_t tries = 0; tries < pfa_colours; tries++)
+    {
+        uint32_t colour = cursor->next % pfa_colours;
+        cursor->next = (colour + 1) % pfa_colours;
+        physaddr_t page = pfa_take_colour(colour);
+        if (page) return page;
+    }
+    return 0;
+}
+
+static physaddr_t pfa_alloc(memtag_t *tag, bool reclaim, colour_cursor_t *cursor) {
+    uint64_t flags = qspin_lock_irqsave(&pfa_lock);
+    physaddr_t page = pfa_colouring ? pfa_take_coloured(cursor ? cursor : &pfa_global_cursor) : pfa_take();
+    qspin_unlock_irqrestore(&pfa_lock, flags);
+    if (page == 0 && reclaim)
+    {
+        // Out of free frames, push a cold anonymous page into compressed swap:
+        page = swap_reclaim_page();
+    }
+    if (page) memtag_charge_page(page, tag);
+    return page;
+}
+
+physaddr_t alloc_page(void) {
+    return pfa_alloc(memtag_callsite(__builtin_return_address(0)), true, NULL);
+}
+
+physaddr_t alloc_page_tagged(memtag_t *tag) {
+    return pfa_alloc(tag ? tag : memtag_callsite(__builtin_return_address(0)), true, NULL);
+}
+
+physaddr_t alloc_page_noreclaim(memtag_t *tag) {
+    return pfa_alloc(tag ? tag : memtag_callsite(__builtin_return_address(0)), false, NULL);
+}
+
+physaddr_t alloc_page_coloured(colour_cursor_t *cursor, memtag_t *tag) {
+    return pfa_alloc(tag ? tag : memtag_callsite(__builtin_return_address(0)), true, cursor);
+}
+
+physaddr_t alloc_page_colour(uint32_t colour, memtag_t *tag) {
+    if (colour >= pfa_colours) return 0;
+    uint64_t flags = qspin_lock_irqsave(&pfa_lock);
+    physaddr_t page = pfa_take_colour(colour);
+    qspin_unlock_irqrestore(&pfa_lock, flags);
+    if (page) memtag_charge_page(page, tag ? tag : memtag_callsite(__builtin_return_address(0)));
+    return page;
+}
+
+physaddr_t alloc_contiguous_pages(size_t count) {
+    memtag_t *tag = memtag_callsite(__builtin_return_address(0));
+    uint64_t flags = qspin_lock_irqsave(&pfa_lock);
+    size_t run = 0;
+    size_t bit = pfa_contig_next < pfa_page_count ? pfa_contig_next : 0;
+    for (size_t seen = 0; seen < pfa_page_count + count && count; seen++, bit++)
+    {
+        if (bit == pfa_page_count)
+        {
+            bit = 0; // Runs don't wrap around.
+            run = 0;
+        }
+        if (bit % 64 == 0 && pfa_bitmap[bit / 64] == ~0ULL && bit + 64 <= pfa_page_count)
+        {
+            seen += 63; // Whole word in use.
+            bit += 63;
+            run = 0;
+            continue;
+        }
+        run = test_bit(bit) ? 0 : run + 1;
+        if (run == count)
+        {
+            size_t first = bit + 1 - count;
+            for (size_t i = first; i <= bit; i++)
+            {
+                set_bit(i);
+                memtag_charge_page(pfa_frame_addr(i), tag);
+            }
+            pfa_free_pages -= count;
+            pfa_contig_next = bit + 1;
+            qspin_unlock_irqrestore(&pfa_lock, flags);
+            return pfa_frame_addr(first);
+        }
+    }
+    qspin_unlock_irqrestore(&pfa_lock, flags);
+    return 0;
+}
+
 // Free page (physical)
 void free_page(physaddr_t paddr) {
     if (paddr < pfa_region_start) return;
     size_t bit = (paddr - pfa_region_start) / PAGE_SIZE;
     if (bit >= pfa_page_count) return;
-    clr_bit(bit); 
-}
\ No newline at end of file
+    uint64_t flags = qspin_lock_irqsave(&pfa_lock);
+    if (test_bit(bit)) // Double frees are ignored.
+    {
+        memtag_uncharge_page(paddr);
+        clr_bit(bit);
+        uint32_t colour = pfa_bit_colour(bit);
+        if (bit < pfa_colour_hint[colour]) pfa_colour_hint[colour] = bit;
+        pfa_free_pages++;
+    }
+    qspin_unlock_irqrestore(&pfa_lock, flags);
+}
+
+size_t pfa_frame_count(void) { return pfa_page_count; }
+size_t pfa_free_count(void) { return pfa_free_pages; }
+
+size_t pfa_frame_index(physaddr_t paddr) {
+    if (paddr < pfa_region_start) return pfa_page_count;
+    size_t bit = (paddr - pfa_region_start) / PAGE_SIZE;
+    return bit < pfa_page_count ? bit : pfa_page_count;
+}
+
+physaddr_t pfa_frame_addr(size_t index) {
+    return pfa_region_start + (physaddr_t)index * PAGE_SIZE;
+}
+
+// Deterministic cache parameters: Intel has them in leaf 4, AMD in 0x8000001D.
+// Returns the size of one way of the biggest data/unified cache in pages.
+static uint32_t pfa_llc_way_pages(uint32_t leaf) {
+    uint32_t a, b, c, d;
+    uint64_t best_size = 0;
+    uint32_t way_pages = 0;
+    for (uint32_t sub = 0; sub < 16; sub++)
+    {
+        cpuid(leaf, sub, &a, &b, &c, &d);
+        uint32_t type = a & 0x1F;
+        if (type == 0) break;       // No more caches.
+        if (type == 2) continue;    // Instruction cache.
+
+        uint64_t ways = ((b >> 22) & 0x3FF) + 1;
+        uint64_t partitions = ((b >> 12) & 0x3FF) + 1;
+        uint64_t line = (b & 0xFFF) + 1;
+        uint64_t sets = (uint64_t)c + 1;
+        if (ways * partitions * line * sets > best_size)
+        {
+            best_size = ways * partitions * line * sets;
+            way_pages = (uint32_t)(partitions * line * sets / PAGE_SIZE);
+        }
+    }
+    return way_pages;
+}
+
+void pfa_init_colours(void) {
+    uint32_t a, b, c, d;
+    uint32_t way_pages = 0;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a >= 4) way_pages = pfa_llc_way_pages(4);
+    if (way_pages == 0)
+    {
+        cpuid(0x80000000, 0, &a, &b, &c, &d);
+        if (a >= 0x8000001D) way_pages = pfa_llc_way_pages(0x8000001D);
+    }
+
+    pfa_colours = (uint32_t)MIN(MAX(way_pages, 1U), PFA_MAX_COLOURS);
+    for (uint32_t colour = 0; colour < pfa_colours; colour++)
+    {
+        // First bit of this colour:
+        pfa_colour_hint[colour] = (colour + pfa_colours - (pfa_region_start / PAGE_SIZE) % pfa_colours) % pfa_colours;
+    }
+}
+
+void pfa_set_colouring(bool enabled) { pfa_colouring = enabled && pfa_colours > 1; }
+uint32_t pfa_colour_count(void) { return pfa_colours; }
+uint32_t pfa_page_colour(physaddr_t paddr) { return (uint32_t)((paddr / PAGE_SIZE) % pfa_colours); }
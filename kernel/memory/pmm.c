@@ -1,5 +1,33 @@
 #include "vulnerable/bootloader.h"
+#include "common/memory.h"
 
+static volatile struct limine_hhdm_request hhdm_request = {
+    .id = LIMINE_HHDM_REQUEST,
+    .revision = 0
+};
+
+static volatile struct limine_memmap_request memmap_request = {
+    .id = LIMINE_MEMMAP_REQUEST,
+    .revision = 0
+};
+
+// The frame allocator only manages one region, so we hand it the biggest
+// usable one. Its bitmap lives in the first pages of that same region.
 void init_pmm() {
+    if (hhdm_request.response == NULL || memmap_request.response == NULL) return;
+    hhdm_offset = hhdm_request.response->offset;
+
+    struct limine_memmap_entry *best = NULL;
+    for (uint64_t i = 0; i < memmap_request.response->entry_count; i++) {
+        struct limine_memmap_entry *entry = memmap_request.response->entries[i];
+        if (entry->type != LIMINE_MEMMAP_USABLE) continue;
+        if (best == NULL || entry->length > best->length) best = entry;
+    }
+    if (best == NULL) return;
+
+    size_t pages = best->length / PAGE_SIZE;
+    size_t bitmap_pages = ((pages + 63) / 64 * sizeof(BITMAP_WORD) + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages <= bitmap_pages) return;
 
-}
\ No newline at end of file
+    pfa_init(best->base + bitmap_pages * PAGE_SIZE, pages - bitmap_pages, PHYS_TO_VIRT(best->base));
+}
@@ -0,0 +1,170 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "common/memtag.h"
+#include "common/slab.h"
+
+// Slab header, at the start of its frame:
+typedef struct Slab
+{
+    struct Slab *next;
+    struct Slab *prev;
+    void *free;      // Free objects, linked through their first word.
+    uint32_t in_use; // Handed out, magazines included.
+} slab_t;
+
+static inline slab_t *slab_of(void *object) {
+    return (slab_t *)((uintptr_t)object & ~(uintptr_t)(PAGE_SIZE - 1));
+}
+
+static inline size_t slab_stride(kmem_cache_t *cache) {
+    size_t align = MAX(cache->align, sizeof(void *));
+    return (MAX(cache->size, sizeof(void *)) + align - 1) & ~(align - 1);
+}
+
+static inline size_t slab_first(kmem_cache_t *cache) {
+    size_t align = MAX(cache->align, sizeof(void *));
+    return (sizeof(slab_t) + align - 1) & ~(align - 1);
+}
+
+static void slab_unlink(slab_t **list, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else *list = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+}
+
+static void slab_push(slab_t **list, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list) (*list)->prev = slab;
+    *list = slab;
+}
+
+// Cache locked. Frame allocation doesn't reclaim, the swap path may be
+// the one asking us for memory.
+static slab_t *slab_grow(kmem_cache_t *cache) {
+    if (cache->per_slab == 0) cache->per_slab = (PAGE_SIZE - slab_first(cache)) / slab_stride(cache);
+    if (cache->per_slab == 0) return NULL;
+
+    physaddr_t frame = alloc_page_noreclaim(&cache->tag);
+    if (frame == 0) return NULL;
+
+    slab_t *slab = (slab_t *)PHYS_TO_VIRT(frame);
+    slab->in_use = 0;
+    slab->free = NULL;
+    uint8_t *base = (uint8_t *)slab + slab_first(cache);
+    for (size_t i = cache->per_slab; i-- > 0;)
+    {
+        void **object = (void **)(base + i * slab_stride(cache));
+        *object = slab->free;
+        slab->free = object;
+    }
+    cache->slabs++;
+    return slab;
+}
+
+// Cache locked: moves up to count objects from the slabs into the magazine.
+static void slab_refill(kmem_cache_t *cache, slab_magazine_t *mag, uint32_t count) {
+    while (mag->count < count)
+    {
+        slab_t *slab = cache->partial;
+        if (slab == NULL)
+        {
+            slab = cache->empty;
+            if (slab) cache->empty = NULL;
+            else slab = slab_grow(cache);
+            if (slab == NULL) return;
+            slab_push(&cache->partial, slab);
+        }
+
+        while (slab->free && mag->count < count)
+        {
+            void **object = slab->free;
+            slab->free = *object;
+            slab->in_use++;
+            mag->objects[mag->count++] = object;
+        }
+        if (slab->free == NULL)
+        {
+            slab_unlink(&cache->partial, slab);
+            slab_push(&cache->full, slab);
+        }
+    }
+}
+
+// Cache locked.
+static void slab_put(kmem_cache_t *cache, void *object) {
+    slab_t *slab = slab_of(object);
+    bool was_full = slab->free == NULL;
+
+    *(void **)object = slab->free;
+    slab->free = object;
+    slab->in_use--;
+
+    if (was_full)
+    {
+        slab_unlink(&cache->full, slab);
+        slab_push(&cache->partial, slab);
+    }
+    if (slab->in_use == 0)
+    {
+        slab_unlink(&cache->partial, slab);
+        if (cache->empty == NULL)
+        {
+            cache->empty = slab;
+        }
+        else
+        {
+            free_page(VIRT_TO_PHYS(slab));
+            cache->slabs--;
+        }
+    }
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint64_t flags = irq_save();
+    slab_magazine_t *mag = &cache->magazines[cpu_index()];
+    if (mag->count == 0)
+    {
+        spin_lock(&cache->lock);
+        slab_refill(cache, mag, SLAB_MAGAZINE / 2);
+        spin_unlock(&cache->lock);
+    }
+    void *object = mag->count ? mag->objects[--mag->count] : NULL;
+    irq_restore(flags);
+
+    if (object) memtag_charge_object(&cache->tag, cache->size);
+    return object;
+}
+
+void *kmem_cache_zalloc(kmem_cache_t *cache) {
+    void *object = kmem_cache_alloc(cache);
+    if (object) memset(object, 0, cache->size);
+    return object;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *object) {
+    if (object == NULL) return;
+    memtag_uncharge_object(&cache->tag, cache->size);
+
+    uint64_t flags = irq_save();
+    slab_magazine_t *mag = &cache->magazines[cpu_index()];
+    if (mag->count == SLAB_MAGAZINE)
+    {
+        // Give the older half back, the newer objects are still warm.
+        spin_lock(&cache->lock);
+        for (uint32_t i = 0; i < SLAB_MAGAZINE / 2; i++) slab_put(cache, mag->objects[i]);
+        for (uint32_t i = SLAB_MAGAZINE / 2; i < SLAB_MAGAZINE; i++)
+            mag->objects[i - SLAB_MAGAZINE / 2] = mag->objects[i];
+        mag->count = SLAB_MAGAZINE / 2;
+        spin_unlock(&cache->lock);
+    }
+    mag->objects[mag->count++] = object;
+    irq_restore(flags);
+}
+
+void kmem_cache_dump(kmem_cache_t *cache) {
+    memtag_usage_t usage;
+    memtag_read(&cache->tag, &usage);
+    printf_("slab %s: %lu objects of %lu bytes, %lu slabs (%u per slab)\n",
+            cache->name, usage.objects, cache->size, cache->slabs, cache->per_slab);
+}
@@ -0,0 +1,140 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "common/zram.h"
+#include "common/memtag.h"
+#include "common/spinlock.h"
+
+// Swap entries live in the anonymous slot with the present bit cleared.
+#define SWP_TO_SLOT(entry) ((physaddr_t)(entry) << 1)
+#define SLOT_TO_SWP(slot)  ((swp_entry_t)(slot) >> 1)
+
+// Reverse map: frame index -> slot that maps it (NULL = not anonymous).
+static physaddr_t **anon_rmap;
+// Frame index -> users between anon_fault() and anon_unpin(). Reclaim leaves
+// pinned frames alone, they may be written to at any moment.
+static uint16_t *anon_pins;
+static size_t clock_hand;
+// Covers the rmap, the pins, the clock hand and the slots. Never held across a frame
+// allocation, since that can come back here to reclaim.
+static spinlock_t swap_lock = SPINLOCK_INIT;
+
+void anon_init(void) {
+    size_t frames = pfa_frame_count();
+    size_t bytes = frames * (sizeof(physaddr_t *) + sizeof(uint16_t));
+    size_t pages = (bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+    physaddr_t table = alloc_contiguous_pages(pages);
+    if (table == 0) return;
+
+    memset(PHYS_TO_VIRT(table), 0, pages * PAGE_SIZE);
+    anon_pins = (uint16_t *)((physaddr_t **)PHYS_TO_VIRT(table) + frames);
+    anon_rmap = (physaddr_t **)PHYS_TO_VIRT(table);
+}
+
+static void anon_pin(physaddr_t frame) {
+    if (anon_rmap) anon_pins[pfa_frame_index(frame)]++;
+}
+
+static void anon_install(physaddr_t *slot, physaddr_t frame) {
+    *slot = frame | PTE_PRESENT | PTE_WRITABLE | PTE_ACCESSED;
+    if (anon_rmap) anon_rmap[pfa_frame_index(frame)] = slot;
+}
+
+bool anon_map(physaddr_t *slot) {
+    physaddr_t frame = alloc_page_tagged(&memtag_anon);
+    if (frame == 0) return false;
+
+    memset(PHYS_TO_VIRT(frame), 0, PAGE_SIZE);
+    uint64_t flags = spin_lock_irqsave(&swap_lock);
+    anon_install(slot, frame);
+    spin_unlock_irqrestore(&swap_lock, flags);
+    return true;
+}
+
+physaddr_t anon_fault(physaddr_t *slot) {
+    physaddr_t frame = 0;
+    for (;;)
+    {
+        uint64_t flags = spin_lock_irqsave(&swap_lock);
+        if (*slot & PTE_PRESENT)
+        {
+            // Somebody else may have brought it in while we allocated.
+            *slot |= PTE_ACCESSED;
+            physaddr_t present = *slot & PTE_FRAME_MASK;
+            anon_pin(present);
+            spin_unlock_irqrestore(&swap_lock, flags);
+            if (frame) free_page(frame);
+            return present;
+        }
+        if (*slot == 0 || frame)
+        {
+            bool loaded = frame && *slot && zram_load(SLOT_TO_SWP(*slot), PHYS_TO_VIRT(frame));
+            if (loaded)
+            {
+                anon_install(slot, frame);
+                anon_pin(frame);
+            }
+            spin_unlock_irqrestore(&swap_lock, flags);
+            if (loaded) return frame;
+            if (frame) free_page(frame);
+            return 0;
+        }
+        spin_unlock_irqrestore(&swap_lock, flags);
+
+        frame = alloc_page_tagged(&memtag_anon);
+        if (frame == 0) return 0;
+    }
+}
+
+void anon_unpin(physaddr_t *slot) {
+    uint64_t flags = spin_lock_irqsave(&swap_lock);
+    if (anon_rmap && (*slot & PTE_PRESENT)) anon_pins[pfa_frame_index(*slot & PTE_FRAME_MASK)]--;
+    spin_unlock_irqrestore(&swap_lock, flags);
+}
+
+void anon_unmap(physaddr_t *slot) {
+    uint64_t flags = spin_lock_irqsave(&swap_lock);
+    physaddr_t old = *slot;
+    if ((old & PTE_PRESENT) && anon_rmap) anon_rmap[pfa_frame_index(old & PTE_FRAME_MASK)] = NULL;
+    *slot = 0;
+    spin_unlock_irqrestore(&swap_lock, flags);
+
+    if (old & PTE_PRESENT) free_page(old & PTE_FRAME_MASK);
+    else if (old) zram_free(SLOT_TO_SWP(old));
+}
+
+// CLOCK over physical frames: recently used pages get a second chance, the
+// first cold one gets compressed and its frame handed to the caller.
+physaddr_t swap_reclaim_page(void) {
+    if (anon_rmap == NULL) return 0;
+
+    uint64_t flags = spin_lock_irqsave(&swap_lock);
+    physaddr_t reclaimed = 0;
+    size_t frames = pfa_frame_count();
+    for (size_t scanned = 0; scanned < 2 * frames; scanned++)
+    {
+        size_t index = clock_hand;
+        clock_hand = (clock_hand + 1) % frames;
+
+        physaddr_t *slot = anon_rmap[index];
+        if (slot == NULL || anon_pins[index]) continue;
+        if (*slot & PTE_ACCESSED)
+        {
+            *slot &= ~PTE_ACCESSED;
+            continue;
+        }
+
+        physaddr_t frame = *slot & PTE_FRAME_MASK;
+        swp_entry_t entry;
+        if (!zram_store(PHYS_TO_VIRT(frame), &entry)) continue;
+
+        *slot = SWP_TO_SLOT(entry);
+        anon_rmap[index] = NULL;
+
+        // Keep the pool's emergency frames topped up before giving any away.
+        if (zram_donate_page(frame)) continue;
+        reclaimed = frame;
+        break;
+    }
+    spin_unlock_irqrestore(&swap_lock, flags);
+    return reclaimed;
+}
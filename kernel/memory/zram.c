@@ -0,0 +1,236 @@
+#include "common/types.h"
+#include "common/memory.h"
+#include "common/lz4.h"
+#include "common/zram.h"
+#include "common/memtag.h"
+#include "common/spinlock.h"
+#include "timing.h"
+
+// Pool layout:
+// Every pool frame belongs to one size class and starts with a small header,
+// the rest is split into equally sized objects. An object is the compressed
+// length (uint16_t) followed by the LZ4 block.
+
+#define ZRAM_CLASS_SIZE    32
+#define ZRAM_MAX_OBJECT    (PAGE_SIZE * 3 / 4) // Bigger than this is not worth keeping.
+#define ZRAM_CLASSES       (ZRAM_MAX_OBJECT / ZRAM_CLASS_SIZE)
+#define ZRAM_HEADER_SIZE   32
+#define ZRAM_RESERVE_PAGES 8
+#define ZRAM_SLOT_NONE     0xFFFF
+#define ZRAM_SLOT_MASK     (PAGE_SIZE - 1)
+
+typedef struct ZramPage
+{
+    physaddr_t next; // Partial list of the size class.
+    physaddr_t prev;
+    uint16_t class_idx;
+    uint16_t in_use;
+    uint16_t free_head; // Freed slots, linked through their first two bytes.
+    uint16_t bump;      // Slots past this have never been handed out.
+} zpage_t;
+
+static physaddr_t zram_partial[ZRAM_CLASSES];
+static physaddr_t zram_reserve[ZRAM_RESERVE_PAGES];
+static size_t zram_reserve_count;
+static zram_stats_t zram_stats;
+static uint8_t zram_scratch[ZRAM_MAX_OBJECT];
+static spinlock_t zram_lock = SPINLOCK_INIT; // Also covers the LZ4 hash table and the scratch buffer.
+
+static inline zpage_t *zpage(physaddr_t frame) { return (zpage_t *)PHYS_TO_VIRT(frame); }
+static inline size_t zram_object_size(size_t class_idx) { return (class_idx + 1) * ZRAM_CLASS_SIZE; }
+static inline size_t zram_slots(size_t class_idx) { return (PAGE_SIZE - ZRAM_HEADER_SIZE) / zram_object_size(class_idx); }
+
+static uint8_t *zram_object(swp_entry_t entry) {
+    physaddr_t frame = entry & ~(swp_entry_t)ZRAM_SLOT_MASK;
+    zpage_t *zp = zpage(frame);
+    return (uint8_t *)zp + ZRAM_HEADER_SIZE + (entry & ZRAM_SLOT_MASK) * zram_object_size(zp->class_idx);
+}
+
+static void zram_partial_add(physaddr_t frame) {
+    zpage_t *zp = zpage(frame);
+    zp->prev = 0;
+    zp->next = zram_partial[zp->class_idx];
+    if (zp->next) zpage(zp->next)->prev = frame;
+    zram_partial[zp->class_idx] = frame;
+}
+
+static void zram_partial_remove(physaddr_t frame) {
+    zpage_t *zp = zpage(frame);
+    if (zp->prev) zpage(zp->prev)->next = zp->next;
+    else zram_partial[zp->class_idx] = zp->next;
+    if (zp->next) zpage(zp->next)->prev = zp->prev;
+    zp->next = zp->prev = 0;
+}
+
+static physaddr_t zram_pool_page(void) {
+    physaddr_t frame = alloc_page_noreclaim(&memtag_zram);
+    if (frame == 0 && zram_reserve_count) frame = zram_reserve[--zram_reserve_count];
+    if (frame) zram_stats.pool_pages++;
+    return frame;
+}
+
+// Locked. Tops the reserve up before handing frames back to the allocator.
+static bool zram_donate_page_locked(physaddr_t frame) {
+    if (zram_reserve_count >= ZRAM_RESERVE_PAGES) return false;
+    memtag_charge_page(frame, &memtag_zram);
+    zram_reserve[zram_reserve_count++] = frame;
+    return true;
+}
+
+static void zram_pool_release(physaddr_t frame) {
+    zram_stats.pool_pages--;
+    if (!zram_donate_page_locked(frame)) free_page(frame);
+}
+
+static swp_entry_t zram_alloc_object(size_t class_idx) {
+    physaddr_t frame = zram_partial[class_idx];
+    if (frame == 0)
+    {
+        frame = zram_pool_page();
+        if (frame == 0) return 0;
+        zpage_t *zp = zpage(frame);
+        zp->class_idx = (uint16_t)class_idx;
+        zp->in_use = 0;
+        zp->free_head = ZRAM_SLOT_NONE;
+        zp->bump = 0;
+        zram_partial_add(frame);
+    }
+
+    zpage_t *zp = zpage(frame);
+    uint16_t slot;
+    if (zp->free_head != ZRAM_SLOT_NONE)
+    {
+        slot = zp->free_head;
+        zp->free_head = *(uint16_t *)zram_object(frame | slot);
+    }
+    else
+    {
+        slot = zp->bump++;
+    }
+
+    zp->in_use++;
+    if (zp->free_head == ZRAM_SLOT_NONE && zp->bump == zram_slots(class_idx)) zram_partial_remove(frame);
+    return frame | slot;
+}
+
+static void zram_free_locked(swp_entry_t entry) {
+    physaddr_t frame = entry & ~(swp_entry_t)ZRAM_SLOT_MASK;
+    zpage_t *zp = zpage(frame);
+    uint8_t *obj = zram_object(entry);
+    bool was_full = zp->free_head == ZRAM_SLOT_NONE && zp->bump == zram_slots(zp->class_idx);
+
+    zram_stats.stored_pages--;
+    zram_stats.compressed_bytes -= *(uint16_t *)obj;
+
+    *(uint16_t *)obj = zp->free_head;
+    zp->free_head = (uint16_t)(entry & ZRAM_SLOT_MASK);
+    zp->in_use--;
+
+    if (zp->in_use == 0)
+    {
+        if (!was_full) zram_partial_remove(frame);
+        zram_pool_release(frame);
+    }
+    else if (was_full)
+    {
+        zram_partial_add(frame);
+    }
+}
+
+void zram_free(swp_entry_t entry) {
+    uint64_t flags = spin_lock_irqsave(&zram_lock);
+    zram_free_locked(entry);
+    spin_unlock_irqrestore(&zram_lock, flags);
+}
+
+bool zram_store(const void *page, swp_entry_t *entry) {
+    uint64_t flags = spin_lock_irqsave(&zram_lock);
+    uint64_t start = rdtsc();
+
+    size_t len = lz4_compress(page, PAGE_SIZE, zram_scratch, ZRAM_MAX_OBJECT - sizeof(uint16_t));
+    if (len == 0)
+    {
+        zram_stats.rejected++;
+        spin_unlock_irqrestore(&zram_lock, flags);
+        return false;
+    }
+
+    swp_entry_t e = zram_alloc_object((len + sizeof(uint16_t) - 1) / ZRAM_CLASS_SIZE);
+    if (e == 0)
+    {
+        spin_unlock_irqrestore(&zram_lock, flags);
+        return false;
+    }
+
+    uint8_t *obj = zram_object(e);
+    *(uint16_t *)obj = (uint16_t)len;
+    memcpy(obj + sizeof(uint16_t), zram_scratch, len);
+
+    uint64_t cycles = rdtsc() - start;
+    zram_stats.stored_pages++;
+    zram_stats.compressed_bytes += len;
+    zram_stats.swap_outs++;
+    zram_stats.compress_cycles += cycles;
+    zram_stats.max_compress_cycles = MAX(zram_stats.max_compress_cycles, cycles);
+    spin_unlock_irqrestore(&zram_lock, flags);
+
+    *entry = e;
+    return true;
+}
+
+bool zram_load(swp_entry_t entry, void *page) {
+    uint64_t flags = spin_lock_irqsave(&zram_lock);
+    uint64_t start = rdtsc();
+
+    uint8_t *obj = zram_object(entry);
+    int len = lz4_decompress(obj + sizeof(uint16_t), *(uint16_t *)obj, page, PAGE_SIZE);
+    if (len != PAGE_SIZE)
+    {
+        spin_unlock_irqrestore(&zram_lock, flags);
+        return false;
+    }
+    zram_free_locked(entry);
+
+    uint64_t cycles = rdtsc() - start;
+    zram_stats.swap_ins++;
+    zram_stats.decompress_cycles += cycles;
+    zram_stats.max_decompress_cycles = MAX(zram_stats.max_decompress_cycles, cycles);
+    spin_unlock_irqrestore(&zram_lock, flags);
+    return true;
+}
+
+bool zram_donate_page(physaddr_t frame) {
+    uint64_t flags = spin_lock_irqsave(&zram_lock);
+    bool taken = zram_donate_page_locked(frame);
+    spin_unlock_irqrestore(&zram_lock, flags);
+    return taken;
+}
+
+void zram_init(void) {
+    while (zram_reserve_count < ZRAM_RESERVE_PAGES)
+    {
+        physaddr_t frame = alloc_page_noreclaim(&memtag_zram);
+        if (frame == 0) break;
+        zram_reserve[zram_reserve_count++] = frame;
+    }
+}
+
+void zram_get_stats(zram_stats_t *out) {
+    uint64_t flags = spin_lock_irqsave(&zram_lock);
+    *out = zram_stats;
+    spin_unlock_irqrestore(&zram_lock, flags);
+}
+
+void zram_dump_stats(void) {
+    zram_stats_t s;
+    zram_get_stats(&s);
+    // Ratio of what we hold against what it costs us, in hundredths:
+    uint64_t ratio = s.pool_pages ? s.stored_pages * 100 / s.pool_pages : 0;
+
+    printf_("zram: %lu pages in %lu pool frames (ratio %lu.%02lu), %lu payload bytes\n",
+            s.stored_pages, s.pool_pages, ratio / 100, ratio % 100, s.compressed_bytes);
+    printf_("zram: %lu out, %lu in, %lu rejected\n", s.swap_outs, s.swap_ins, s.rejected);
+    printf_("zram: compress avg %lu max %lu cycles, decompress avg %lu max %lu cycles\n",
+            s.swap_outs ? s.compress_cycles / s.swap_outs : 0, s.max_compress_cycles,
+            s.swap_ins ? s.decompress_cycles / s.swap_ins : 0, s.max_decompress_cycles);
+}
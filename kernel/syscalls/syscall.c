@@ -0,0 +1,29 @@
+#include "syscall.h"
+#include "cpu.h"
+#include "futex.h"
+
+typedef uint64_t (*syscall_t)(uint64_t a0, uint64_t a1, uint64_t a2, uint64_t a3, uint64_t a4, uint64_t a5);
+
+static uint64_t sys_futex(uint64_t uaddr, uint64_t op, uint64_t val, uint64_t arg, uint64_t uaddr2, uint64_t val3) {
+    return (uint64_t)futex((uint32_t *)uaddr, (int)op, (uint32_t)val, arg, (uint32_t *)uaddr2, (uint32_t)val3);
+}
+
+static const syscall_t syscall_table[] = {
+    [SYS_FUTEX] = sys_futex,
+};
+
+#define SYSCALL_COUNT (sizeof(syscall_table) / sizeof(syscall_table[0]))
+
+void syscall_dispatch(AsmPassedInterrupt *regs) {
+    uint64_t nr = regs->rax;
+    if (nr >= SYSCALL_COUNT || syscall_table[nr] == NULL)
+    {
+        regs->rax = ERR(ENOSYS);
+        return;
+    }
+
+    // Came in through an interrupt gate; system calls may sleep.
+    irq_enable();
+    regs->rax = syscall_table[nr](regs->rdi, regs->rsi, regs->rdx, regs->r10, regs->r8, regs->r9);
+    irq_disable();
+}
@@ -0,0 +1,10 @@
+#ifndef SYSCALL_H
+#define SYSCALL_H
+
+#include "common/isr.h"
+#include "syscall_defs.h"
+
+// int $0x80, see syscall_defs.h for the ABI.
+void syscall_dispatch(AsmPassedInterrupt *regs);
+
+#endif
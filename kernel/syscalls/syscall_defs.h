@@ -1,6 +1,22 @@
 #ifndef SYSCALL_DEFS_H
 #define SYSCALL_DEFS_H
 
+// System call ABI, shared with user space: int $0x80 with the number in
+// rax and the arguments in rdi, rsi, rdx, r10, r8, r9. The result comes
+// back in rax, errors as negative E* values.
 
+#define SYS_FUTEX 1
 
-#endif
\ No newline at end of file
+// SYS_FUTEX(uint32_t *uaddr, op, uint32_t val, uint64_t arg, uint32_t *uaddr2, uint32_t val3)
+#define FUTEX_WAIT        0 // Sleep while *uaddr == val, arg: timeout in ns (0: none).
+#define FUTEX_WAKE        1 // Wake up to val waiters, returns how many.
+#define FUTEX_REQUEUE     2 // Wake val, move up to arg of the rest over to uaddr2.
+#define FUTEX_CMP_REQUEUE 3 // Same, but only while *uaddr == val3.
+
+#define EAGAIN    11
+#define EFAULT    14
+#define EINVAL    22
+#define ENOSYS    38
+#define ETIMEDOUT 110
+
+#endif
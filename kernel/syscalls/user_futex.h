@@ -0,0 +1,84 @@
+#ifndef USER_FUTEX_H
+#define USER_FUTEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "syscall_defs.h"
+
+// User space side of SYS_FUTEX: a mutex and a condition variable that only
+// enter the kernel when somebody has to sleep or be woken.
+
+static inline int64_t sys_futex(uint32_t *uaddr, int op, uint32_t val, uint64_t arg, uint32_t *uaddr2, uint32_t val3) {
+    int64_t ret;
+    register uint64_t r10 __asm__("r10") = arg;
+    register uint64_t r8 __asm__("r8") = (uint64_t)uaddr2;
+    register uint64_t r9 __asm__("r9") = val3;
+    __asm__ __volatile__ ("int $0x80"
+                          : "=a"(ret)
+                          : "a"((uint64_t)SYS_FUTEX), "D"(uaddr), "S"((uint64_t)op), "d"((uint64_t)val),
+                            "r"(r10), "r"(r8), "r"(r9)
+                          : "rcx", "r11", "memory");
+    return ret;
+}
+
+// 0: unlocked, 1: locked, 2: locked and somebody may be sleeping on it.
+// Uncontended lock and unlock are one atomic each, a contended handoff is
+// one FUTEX_WAIT on the waiting side and one FUTEX_WAKE on the releasing one.
+typedef struct UMutex
+{
+    uint32_t state;
+} umutex_t;
+
+#define UMUTEX_INIT { 0 }
+
+static inline void umutex_lock(umutex_t *m) {
+    uint32_t c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+    if (c != 2) c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0)
+    {
+        sys_futex(&m->state, FUTEX_WAIT, 2, 0, 0, 0);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline bool umutex_trylock(umutex_t *m) {
+    uint32_t c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void umutex_unlock(umutex_t *m) {
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) sys_futex(&m->state, FUTEX_WAKE, 1, 0, 0, 0);
+}
+
+// Waiters sleep on the sequence number; broadcast wakes one and requeues
+// the others onto the mutex, which wakes them one by one as it is released.
+typedef struct UCond
+{
+    uint32_t seq;
+} ucond_t;
+
+#define UCOND_INIT { 0 }
+
+static inline void ucond_wait(ucond_t *cv, umutex_t *m) {
+    uint32_t seq = __atomic_load_n(&cv->seq, __ATOMIC_RELAXED);
+    umutex_unlock(m);
+    sys_futex(&cv->seq, FUTEX_WAIT, seq, 0, 0, 0);
+    // Requeued waiters may share the mutex with others still asleep on it.
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0) sys_futex(&m->state, FUTEX_WAIT, 2, 0, 0, 0);
+}
+
+static inline void ucond_signal(ucond_t *cv) {
+    __atomic_add_fetch(&cv->seq, 1, __ATOMIC_RELEASE);
+    sys_futex(&cv->seq, FUTEX_WAKE, 1, 0, 0, 0);
+}
+
+// With m held: the requeued waiters count as contention, so the unlock wakes one.
+static inline void ucond_broadcast(ucond_t *cv, umutex_t *m) {
+    uint32_t seq = __atomic_add_fetch(&cv->seq, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&m->state, 2, __ATOMIC_RELAXED);
+    if (sys_futex(&cv->seq, FUTEX_CMP_REQUEUE, 1, 0x7FFFFFFF, &m->state, seq) == -EAGAIN)
+        sys_futex(&cv->seq, FUTEX_WAKE, 0x7FFFFFFF, 0, 0, 0); // Raced with another signal, wake them all.
+}
+
+#endif